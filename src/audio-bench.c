@@ -0,0 +1,357 @@
+/*
+ * audio-bench.c -- Benchmark of the audio decoders
+ *
+ * Copyright (C) 2007-2010, 2013 Igalia, S.L.
+ * Authors: Alberto Garcia <berto@igalia.com>
+ *
+ * This file is part of Vagalume and is published under the GNU GPLv3
+ * See the README file for more details.
+ */
+
+/*
+ * This builds the same pipeline as lastfm_audio_init() but with a
+ * fakesink instead of the audio sink, and feeds it a set of recorded
+ * MP3 files through appsrc in the same way as the streams are fed
+ * while playing. For each decoder it reports:
+ *
+ *  - the pipeline start latency (from PLAYING to the first decoded
+ *    buffer reaching the sink),
+ *  - the decode throughput (seconds of audio decoded per second),
+ *  - the CPU time needed to decode each second of audio.
+ *
+ * No network or audio device is needed, so it can be used to compare
+ * decoders and catch regressions on the target devices.
+ */
+
+#include "config.h"
+
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "audio.h"
+#include "audioelem.h"
+
+/* Size of the buffers pushed to the pipeline, the same as the
+ * chunks read from the network or from the stream cache */
+#define BENCH_CHUNK_SIZE 16384
+
+/* A file being decoded */
+typedef struct {
+        const char *data;
+        gsize size;
+        gsize pos;
+        GstAppSrc *appsrc;
+        gboolean wanted;
+        GTimer *timer;
+        double first_buffer;
+        GstClockTime audio_time;
+        gboolean error;
+        GMainLoop *loop;
+} bench_run;
+
+/* Totals of one decoder */
+typedef struct {
+        guint runs;
+        guint errors;
+        double audio;
+        double wall;
+        double cpu;
+        double start_total;
+        double start_max;
+} bench_result;
+
+/* Push data until appsrc's queue is full, as the player does when
+ * its jitter buffer has data. Called from the streaming thread */
+static void
+bench_need_data_cb                      (GstAppSrc *src,
+                                         guint      length,
+                                         gpointer   userdata)
+{
+        bench_run *r = userdata;
+        r->wanted = TRUE;
+        while (r->wanted && r->pos < r->size) {
+                gsize size = MIN (BENCH_CHUNK_SIZE, r->size - r->pos);
+                GstBuffer *buf = audio_elem_buffer_new (r->data + r->pos,
+                                                        size);
+                r->pos += size;
+                gst_app_src_push_buffer (r->appsrc, buf);
+        }
+        if (r->pos == r->size) {
+                gst_app_src_end_of_stream (r->appsrc);
+                r->pos++;
+        }
+}
+
+static void
+bench_enough_data_cb                    (GstAppSrc *src,
+                                         gpointer   userdata)
+{
+        bench_run *r = userdata;
+        r->wanted = FALSE;
+}
+
+/* Called from the streaming thread for each decoded buffer */
+static void
+bench_handoff_cb                        (GstElement *sink,
+                                         GstBuffer  *buf,
+                                         GstPad     *pad,
+                                         gpointer    userdata)
+{
+        bench_run *r = userdata;
+        if (r->first_buffer < 0) {
+                r->first_buffer = g_timer_elapsed (r->timer, NULL);
+        }
+        if (GST_BUFFER_DURATION_IS_VALID (buf)) {
+                r->audio_time += GST_BUFFER_DURATION (buf);
+        }
+}
+
+static gboolean
+bench_bus_cb                            (GstBus     *bus,
+                                         GstMessage *msg,
+                                         gpointer    userdata)
+{
+        bench_run *r = userdata;
+        GError *err = NULL;
+        gchar *debug = NULL;
+
+        switch (GST_MESSAGE_TYPE (msg)) {
+        case GST_MESSAGE_EOS:
+                g_main_loop_quit (r->loop);
+                break;
+        case GST_MESSAGE_ERROR:
+                gst_message_parse_error (msg, &err, &debug);
+                g_printerr ("GStreamer error: %s\n", err->message);
+                g_error_free (err);
+                g_free (debug);
+                r->error = TRUE;
+                g_main_loop_quit (r->loop);
+                break;
+        default:
+                break;
+        }
+        return TRUE;
+}
+
+/**
+ * Decode a file once
+ * @param decoder_name The decoder, or NULL to use the same as the player
+ * @param data The contents of the file
+ * @param size The size of the file
+ * @param result Where the measurements are added
+ * @return FALSE if the pipeline couldn't be created or failed
+ */
+static gboolean
+bench_run_file                          (const char   *decoder_name,
+                                         const char   *data,
+                                         gsize         size,
+                                         bench_result *result)
+{
+        GstElement *pipeline, *source, *decoder, *sink;
+        GstAppSrcCallbacks callbacks;
+        GstBus *bus;
+        guint watch_id;
+        bench_run r;
+        double cpu, wall;
+
+        memset (&r, 0, sizeof (r));
+        r.data = data;
+        r.size = size;
+        r.first_buffer = -1;
+
+        pipeline = gst_pipeline_new (NULL);
+        memset (&callbacks, 0, sizeof (callbacks));
+        callbacks.need_data = bench_need_data_cb;
+        callbacks.enough_data = bench_enough_data_cb;
+        source = audio_elem_create_source (&callbacks, &r);
+        if (decoder_name != NULL) {
+                const char *names[] = { decoder_name, NULL };
+                decoder = audio_elem_create (names, NULL);
+        } else {
+                decoder = audio_elem_create_decoder ();
+        }
+        sink = gst_element_factory_make ("fakesink", NULL);
+        if (!source || !decoder || !sink) {
+                g_printerr ("Error creating GStreamer elements\n");
+                if (source) gst_object_unref (source);
+                if (decoder) gst_object_unref (decoder);
+                if (sink) gst_object_unref (sink);
+                gst_object_unref (pipeline);
+                result->errors++;
+                return FALSE;
+        }
+        r.appsrc = GST_APP_SRC (source);
+        g_object_set (sink, "sync", FALSE, "signal-handoffs", TRUE, NULL);
+        g_signal_connect (sink, "handoff",
+                          G_CALLBACK (bench_handoff_cb), &r);
+        gst_bin_add_many (GST_BIN (pipeline), source, decoder, sink, NULL);
+        gst_element_link (source, decoder);
+        audio_elem_link_decoder (decoder, sink);
+
+        r.loop = g_main_loop_new (NULL, FALSE);
+        bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+        watch_id = gst_bus_add_watch (bus, bench_bus_cb, &r);
+
+        cpu = audio_elem_cpu_time ();
+        r.timer = g_timer_new ();
+        gst_element_set_state (pipeline, GST_STATE_PLAYING);
+        g_main_loop_run (r.loop);
+        wall = g_timer_elapsed (r.timer, NULL);
+        cpu = audio_elem_cpu_time () - cpu;
+
+        /* Fall back to the position if the decoder doesn't set the
+         * duration of the buffers */
+        if (r.audio_time == 0) {
+                GstFormat fmt = GST_FORMAT_TIME;
+                gint64 pos;
+#if GST_CHECK_VERSION(1,0,0)
+                if (gst_element_query_position (sink, fmt, &pos)) {
+#else
+                if (gst_element_query_position (sink, &fmt, &pos)) {
+#endif
+                        r.audio_time = pos;
+                }
+        }
+
+        /* This waits for the streaming threads */
+        gst_element_set_state (pipeline, GST_STATE_NULL);
+        g_source_remove (watch_id);
+        gst_object_unref (bus);
+        gst_object_unref (pipeline);
+        g_main_loop_unref (r.loop);
+        g_timer_destroy (r.timer);
+
+        if (r.error || r.first_buffer < 0) {
+                result->errors++;
+                return FALSE;
+        }
+
+        result->runs++;
+        result->audio += (double) r.audio_time / GST_SECOND;
+        result->wall += wall;
+        result->cpu += cpu;
+        result->start_total += r.first_buffer;
+        result->start_max = MAX (result->start_max, r.first_buffer);
+        return TRUE;
+}
+
+static void
+bench_print_result                      (const char         *title,
+                                         const bench_result *res)
+{
+        g_print ("  %s\n", title);
+        if (res->runs == 0) {
+                g_print ("    no successful runs (%u failed)\n",
+                         res->errors);
+                return;
+        }
+        g_print ("    %u runs (%u failed), %.1f s of audio decoded in "
+                 "%.2f s (%.1fx)\n    CPU %.1f ms per second of audio, "
+                 "start latency avg %.1f ms, max %.1f ms\n",
+                 res->runs, res->errors, res->audio, res->wall,
+                 res->wall > 0 ? res->audio / res->wall : 0,
+                 res->audio > 0 ? res->cpu * 1000 / res->audio : 0,
+                 res->start_total * 1000 / res->runs,
+                 res->start_max * 1000);
+}
+
+static void
+usage                                   (const char *progname)
+{
+        g_printerr ("Usage:\n  %s [-d decoder]... [-n runs] file.mp3...\n\n"
+                    "  decoder:   GStreamer decoder, can be given more "
+                    "than once\n"
+                    "             (default: $%s or '%s')\n"
+                    "  runs:      times each file is decoded "
+                    "(default: 3)\n", progname, GST_DECODER_ENVVAR,
+                    audio_elem_default_decoder_name ());
+}
+
+int
+main                                    (int    argc,
+                                         char **argv)
+{
+        GPtrArray *decoders = g_ptr_array_new ();
+        gboolean failed = FALSE;
+        int runs = 3;
+        int opt, j, k;
+        guint i;
+
+        gst_init (&argc, &argv);
+
+        while ((opt = getopt (argc, argv, "d:n:h")) != -1) {
+                switch (opt) {
+                case 'd':
+                        g_ptr_array_add (decoders, optarg);
+                        break;
+                case 'n':
+                        runs = atoi (optarg);
+                        break;
+                default:
+                        usage (argv[0]);
+                        return 1;
+                }
+        }
+        if (optind >= argc || runs <= 0) {
+                usage (argv[0]);
+                return 1;
+        }
+
+        /* Same decoder as the player */
+        if (decoders->len == 0) {
+                g_ptr_array_add (decoders, NULL);
+        }
+
+        for (i = 0; i < decoders->len; i++) {
+                const char *name = g_ptr_array_index (decoders, i);
+                const char *label = name;
+                bench_result total;
+
+                if (label == NULL) label = g_getenv (GST_DECODER_ENVVAR);
+                if (label == NULL || *label == '\0') {
+                        label = audio_elem_default_decoder_name ();
+                }
+                memset (&total, 0, sizeof (total));
+                g_print ("Decoder %s:\n", label);
+
+                for (j = optind; j < argc; j++) {
+                        bench_result res;
+                        gchar *data;
+                        gsize size;
+                        GError *err = NULL;
+
+                        if (!g_file_get_contents (argv[j], &data,
+                                                  &size, &err)) {
+                                g_printerr ("%s\n", err->message);
+                                g_error_free (err);
+                                failed = TRUE;
+                                continue;
+                        }
+                        memset (&res, 0, sizeof (res));
+                        for (k = 0; k < runs; k++) {
+                                if (!bench_run_file (name, data,
+                                                     size, &res)) {
+                                        failed = TRUE;
+                                }
+                        }
+                        g_free (data);
+
+                        bench_print_result (argv[j], &res);
+                        total.runs += res.runs;
+                        total.errors += res.errors;
+                        total.audio += res.audio;
+                        total.wall += res.wall;
+                        total.cpu += res.cpu;
+                        total.start_total += res.start_total;
+                        total.start_max = MAX (total.start_max,
+                                               res.start_max);
+                }
+                bench_print_result ("total", &total);
+        }
+
+        g_ptr_array_free (decoders, TRUE);
+        return failed ? 1 : 0;
+}
@@ -11,72 +11,634 @@
 #include "config.h"
 
 #include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
 #include <gtk/gtk.h>
 #include <unistd.h>
 #include <string.h>
 
 #include "audio.h"
+#include "audioelem.h"
 #include "controller.h"
 #include "http.h"
+#include "latency.h"
+#include "streamcache.h"
 #include "util.h"
+#include "vgl-object.h"
 #include "compat.h"
 
-#ifdef HAVE_DSPMP3SINK
-static const char *default_decoders[] = { NULL };
-static const char *default_sinks[] = { "dspmp3sink", NULL };
-#else
-static const char *default_decoders[] = { "decodebin", NULL };
-static const char *default_sinks[] = { "autoaudiosink", NULL };
-#endif
-
 static GstElement *pipeline = NULL;
 static GstElement *source = NULL;
 static GstElement *decoder = NULL;
 static GstElement *sink = NULL;
 
-static volatile gboolean http_req_success = FALSE;
+/* Set when the user selects a different decoder or sink. They are
+ * replaced before playing the next track */
+static gboolean elements_changed = FALSE;
 
-static int http_pipe[2] = { -1, -1 };
-static GThread *http_thread = NULL;
 static gboolean audio_started = FALSE;
+static gboolean buffering = FALSE;
 static GCallback audio_started_callback = NULL;
 
-static void
-close_previous_playback                 (void)
-{
-        if (http_pipe[0] != -1) close(http_pipe[0]);
-        if (http_pipe[1] != -1) close(http_pipe[1]);
-        http_pipe[0] = http_pipe[1] = -1;
-}
+/* With GStreamer 1.0, flushing the appsrc element also drops the data
+ * queued in it, so the pipeline can be reused for the next track
+ * without going back to the NULL state */
+#if GST_CHECK_VERSION(1,0,0) && !defined(HAVE_DSPMP3SINK)
+#define AUDIO_CAN_KEEP_WARM 1
+#endif
 
+/* If keep_warm is set, the pipeline is only paused between tracks,
+ * so the audio sink stays open and decodebin keeps its elements.
+ * pipeline_warm is TRUE while it's paused that way, and it's set
+ * to NULL if no other track is played in cool_down_seconds */
+static gboolean keep_warm = FALSE;
+static gboolean pipeline_warm = FALSE;
+static gboolean pipeline_error = FALSE;
+static guint cool_down_id = 0;
+static const guint cool_down_seconds = 10;
+
+/* Time to first audio: from lastfm_audio_play() to the pipeline
+ * reaching the PLAYING state. Kept separately for cold starts (from
+ * the NULL state) and warm starts */
+static GTimer *ttfa_timer = NULL;
+static gboolean ttfa_warm = FALSE;
+static volatile gint first_sample_pending = 0;
+static LastfmAudioTtfaStats ttfa_stats[2] = {
+        { 0, 0, 0, 0 }, { 0, 0, 0, 0 }
+};
+
+/* A stream being downloaded. The data is kept in a buffer (up to
+ * prefetch_max_bytes) until the stream is attached to the pipeline.
+ * From then on the buffer is used as a jitter buffer: data is
+ * pushed to the appsrc element when it needs it, and the pipeline is
+ * paused (using buffering messages) until there's enough data to
+ * start playing or to resume after an underrun */
 typedef struct {
+        VglObject parent;
         char *url;
         char *session_id;
-} get_audio_thread_data;
+        char *cache_key;
+        StreamCacheWriter *cache;
+        GMutex *mutex;
+        GCond *cond;
+        GQueue *buffers;
+        gsize buffered;
+        GstAppSrc *appsrc;
+        gboolean started;
+        gboolean wanted;
+        gboolean buffering;
+        gsize resume_level;
+        gint percent;
+        gboolean eos_sent;
+        gboolean got_data;
+        guint64 received;
+        gboolean reconnecting;
+        GTimer *dropout_timer;
+        GTimer *underrun_timer;
+        gboolean cancelled;
+        gboolean finished;
+        gboolean success;
+        LastfmAudioFeedStats stats;
+} audio_fetch;
+
+/* The stream of the track being played, and the stream of the next
+ * track if it's being prefetched. current_fetch is protected by
+ * current_fetch_mutex, since it's used from the appsrc callbacks */
+static GStaticMutex current_fetch_mutex = G_STATIC_MUTEX_INIT;
+static audio_fetch *current_fetch = NULL;
+static audio_fetch *next_fetch = NULL;
+
+/* Maximum amount of data of the next track kept in memory */
+static gsize prefetch_max_bytes = 1024 * 1024;
+
+/* Thresholds of the jitter buffer: data needed before a track
+ * starts, data needed to resume after an underrun, and maximum
+ * amount of data in the buffer (the download waits if it's full) */
+static gsize buffer_preroll_bytes = 64 * 1024;
+static gsize buffer_low_bytes = 32 * 1024;
+static gsize buffer_high_bytes = 512 * 1024;
+
+/* Statistics of all the streams played so far */
+static GStaticMutex feed_stats_mutex = G_STATIC_MUTEX_INIT;
+static LastfmAudioFeedStats feed_stats = { 0, 0, 0, 0, 0, 0, 0 };
+
+/* Limits to reconnect a stream that failed while being downloaded:
+ * number of attempts, and total time without data. The delay before
+ * each attempt grows with the number of attempts */
+static const guint stream_max_reconnects = 3;
+static const guint stream_max_dropout = 20;
+static const guint stream_reconnect_delay = 1;
+
+static gsize
+audio_buffer_size                       (GstBuffer *buf)
+{
+#if GST_CHECK_VERSION(1,0,0)
+        return gst_buffer_get_size (buf);
+#else
+        return GST_BUFFER_SIZE (buf);
+#endif
+}
+
+static void
+audio_fetch_destroy                     (gpointer data)
+{
+        audio_fetch *f = data;
+        GstBuffer *buf;
+
+        if (f->started) {
+                g_debug ("Stream finished: %" G_GUINT64_FORMAT " bytes in "
+                         "%u buffers, %u underruns (%u ms), download "
+                         "waited %u times, %u reconnects (%u ms)",
+                         f->stats.bytes, f->stats.buffers,
+                         f->stats.underruns, f->stats.underrun_ms,
+                         f->stats.full, f->stats.reconnects,
+                         f->stats.dropout_ms);
+                g_static_mutex_lock (&feed_stats_mutex);
+                feed_stats.bytes += f->stats.bytes;
+                feed_stats.buffers += f->stats.buffers;
+                feed_stats.underruns += f->stats.underruns;
+                feed_stats.underrun_ms += f->stats.underrun_ms;
+                feed_stats.full += f->stats.full;
+                feed_stats.reconnects += f->stats.reconnects;
+                feed_stats.dropout_ms += f->stats.dropout_ms;
+                g_static_mutex_unlock (&feed_stats_mutex);
+        }
+
+        while ((buf = g_queue_pop_head (f->buffers)) != NULL) {
+                gst_buffer_unref (buf);
+        }
+        g_queue_free (f->buffers);
+        g_timer_destroy (f->underrun_timer);
+        g_timer_destroy (f->dropout_timer);
+        g_mutex_free (f->mutex);
+        g_cond_free (f->cond);
+        g_free (f->url);
+        g_free (f->session_id);
+        g_free (f->cache_key);
+}
+
+/**
+ * Post a buffering message if the percentage has changed. Must be
+ * called with the mutex held
+ * @param f The stream
+ * @param percent The percentage of the buffer filled
+ */
+static void
+audio_fetch_post_buffering              (audio_fetch *f,
+                                         gint         percent)
+{
+        if (percent != f->percent) {
+                GstObject *src = GST_OBJECT (f->appsrc);
+                f->percent = percent;
+                gst_element_post_message (GST_ELEMENT (f->appsrc),
+                                          gst_message_new_buffering (
+                                                  src, percent));
+        }
+}
+
+/**
+ * Move data from the jitter buffer to the appsrc element, updating
+ * the buffering state. Must be called with the mutex held, and it
+ * does nothing until appsrc has asked for data for the first time
+ * (the bus of the pipeline drops messages before that).
+ * @param f The stream
+ */
+static void
+audio_fetch_update                      (audio_fetch *f)
+{
+        GstBuffer *buf;
+
+        if (!f->started || f->cancelled || f->eos_sent) return;
+
+        if (f->buffering) {
+                if (f->finished || f->buffered >= f->resume_level) {
+                        f->buffering = FALSE;
+                        if (f->stats.underruns > 0) {
+                                gdouble secs;
+                                secs = g_timer_elapsed (f->underrun_timer,
+                                                        NULL);
+                                f->stats.underrun_ms += secs * 1000;
+                        }
+                        audio_fetch_post_buffering (f, 100);
+                } else {
+                        audio_fetch_post_buffering (
+                                f, f->buffered * 100 / f->resume_level);
+                        return;
+                }
+        }
+
+        /* Pushing a buffer can call audio_fetch_enough_data_cb() */
+        while (f->wanted && (buf = g_queue_pop_head (f->buffers)) != NULL) {
+                gsize size = audio_buffer_size (buf);
+                f->buffered -= size;
+                f->stats.bytes += size;
+                f->stats.buffers++;
+                gst_app_src_push_buffer (f->appsrc, buf);
+        }
+
+        if (f->finished && g_queue_is_empty (f->buffers)) {
+                gst_app_src_end_of_stream (f->appsrc);
+                f->eos_sent = TRUE;
+        }
+
+        /* Wake up the download if it's waiting for free space */
+        g_cond_broadcast (f->cond);
+}
+
+static gboolean
+audio_fetch_data_cb                     (const char *data,
+                                         size_t      size,
+                                         gpointer    userdata)
+{
+        audio_fetch *f = userdata;
+        gboolean waited = FALSE;
+        gboolean ok;
+
+        /* The cache writer is only used by the download thread */
+        if (f->cache != NULL) {
+                stream_cache_writer_append (f->cache, data, size);
+        }
+        f->received += size;
+
+        g_mutex_lock (f->mutex);
+
+        if (f->reconnecting) {
+                /* Data again after a reconnection */
+                f->reconnecting = FALSE;
+                f->stats.dropout_ms +=
+                        g_timer_elapsed (f->dropout_timer, NULL) * 1000;
+        }
+
+        /* Wait if the buffer is full */
+        while (!f->cancelled && f->buffered > 0 &&
+               f->buffered + size > (f->appsrc ? buffer_high_bytes :
+                                     prefetch_max_bytes)) {
+                if (f->appsrc != NULL && !waited) {
+                        f->stats.full++;
+                        waited = TRUE;
+                }
+                g_cond_wait (f->cond, f->mutex);
+        }
+
+        ok = !f->cancelled;
+        if (ok) {
+                if (!f->got_data && f->appsrc != NULL) {
+                        latency_trace_mark (LATENCY_STAGE_FIRST_BYTE);
+                }
+                f->got_data = TRUE;
+                g_queue_push_tail (f->buffers,
+                                   audio_elem_buffer_new (data, size));
+                f->buffered += size;
+                audio_fetch_update (f);
+        }
+
+        g_mutex_unlock (f->mutex);
+        return ok;
+}
+
+/**
+ * Get a reference to the stream being played, if any
+ * @return The stream, or NULL
+ */
+static audio_fetch *
+audio_fetch_get_current                 (void)
+{
+        audio_fetch *f = NULL;
+        g_static_mutex_lock (&current_fetch_mutex);
+        if (current_fetch != NULL) {
+                f = vgl_object_ref (current_fetch);
+        }
+        g_static_mutex_unlock (&current_fetch_mutex);
+        return f;
+}
+
+/* Called from the streaming thread when the queue of appsrc is
+ * empty. If the jitter buffer is empty too, this is an underrun */
+static void
+audio_fetch_need_data_cb                (GstAppSrc *src,
+                                         guint      length,
+                                         gpointer   userdata)
+{
+        audio_fetch *f = audio_fetch_get_current ();
+        if (f == NULL) return;
+
+        g_mutex_lock (f->mutex);
+        f->wanted = TRUE;
+        if (!f->started) {
+                f->started = TRUE;
+        } else if (!f->buffering && !f->finished && !f->cancelled &&
+                   g_queue_is_empty (f->buffers)) {
+                g_debug ("Audio buffer underrun");
+                f->stats.underruns++;
+                f->buffering = TRUE;
+                f->resume_level = buffer_low_bytes;
+                g_timer_start (f->underrun_timer);
+        }
+        audio_fetch_update (f);
+        g_mutex_unlock (f->mutex);
+
+        vgl_object_unref (f);
+}
+
+/* Called when the queue of appsrc is full. This is emitted from
+ * gst_app_src_push_buffer(), so the mutex of the stream is held */
+static void
+audio_fetch_enough_data_cb              (GstAppSrc *src,
+                                         gpointer   userdata)
+{
+        g_static_mutex_lock (&current_fetch_mutex);
+        if (current_fetch != NULL) {
+                current_fetch->wanted = FALSE;
+        }
+        g_static_mutex_unlock (&current_fetch_mutex);
+}
+
+/**
+ * Read a stream from the cache, as if it was being downloaded
+ * @param f The stream
+ * @param file The cached file
+ * @return Whether the file could be read
+ */
+static gboolean
+audio_fetch_read_cached                 (audio_fetch *f,
+                                         FILE        *file)
+{
+        char buf[16384];
+        size_t n;
+        while ((n = fread (buf, 1, sizeof (buf), file)) > 0) {
+                if (!audio_fetch_data_cb (buf, n, f)) break;
+        }
+        return !ferror (file);
+}
+
+/**
+ * Decide whether to reconnect a stream whose download has failed,
+ * and wait a bit before doing it
+ * @param f The stream
+ * @param attempts The number of reconnections made so far
+ * @return TRUE if the stream must be reconnected, FALSE otherwise
+ */
+static gboolean
+audio_fetch_wait_reconnect              (audio_fetch *f,
+                                         guint        attempts)
+{
+        gboolean retry;
+        guint dropout;
+        GTimeVal until;
+
+        g_mutex_lock (f->mutex);
+        if (!f->reconnecting) {
+                f->reconnecting = TRUE;
+                g_timer_start (f->dropout_timer);
+        }
+        dropout = f->stats.dropout_ms +
+                g_timer_elapsed (f->dropout_timer, NULL) * 1000;
+        retry = !f->cancelled && attempts < stream_max_reconnects &&
+                dropout < stream_max_dropout * 1000;
+
+        if (retry) {
+                g_get_current_time (&until);
+                g_time_val_add (&until, (glong) stream_reconnect_delay *
+                                (attempts + 1) * G_USEC_PER_SEC);
+                while (!f->cancelled &&
+                       g_cond_timed_wait (f->cond, f->mutex, &until));
+                retry = !f->cancelled;
+        }
+        if (retry) {
+                f->stats.reconnects++;
+        } else if (f->reconnecting) {
+                f->reconnecting = FALSE;
+                f->stats.dropout_ms +=
+                        g_timer_elapsed (f->dropout_timer, NULL) * 1000;
+        }
+        g_mutex_unlock (f->mutex);
+
+        return retry;
+}
 
 static gpointer
-get_audio_thread                        (gpointer userdata)
+audio_fetch_thread                      (gpointer userdata)
 {
-        g_return_val_if_fail(userdata != NULL && http_pipe[1] > 0, NULL);
-        get_audio_thread_data *data = (get_audio_thread_data *) userdata;
+        audio_fetch *f = userdata;
         GSList *headers = NULL;
         char *cookie = NULL;
-        http_req_success = FALSE;
-        if (data->session_id != NULL) {
-                cookie = g_strconcat("Cookie: Session=", data->session_id,
-                                     NULL);
-                headers = g_slist_append(headers, cookie);
-        }
-        http_req_success = http_get_to_fd (data->url, http_pipe[1], headers);
-        if (!audio_started) http_req_success = FALSE;
-        g_free(data->url);
-        g_free(data->session_id);
-        g_free(cookie);
-        g_slice_free(get_audio_thread_data, data);
-        g_slist_free(headers);
+        FILE *cached = NULL;
+        gboolean success;
+        http_stream_result result;
+        guint attempts = 0;
+
+        if (f->cache_key != NULL) {
+                cached = stream_cache_open (f->cache_key, NULL);
+        }
+
+        if (cached != NULL) {
+                g_debug ("Reading stream %s from the cache", f->cache_key);
+                success = audio_fetch_read_cached (f, cached);
+                fclose (cached);
+        } else {
+                if (f->session_id != NULL) {
+                        cookie = g_strconcat("Cookie: Session=",
+                                             f->session_id, NULL);
+                        headers = g_slist_append(headers, cookie);
+                }
+                if (f->cache_key != NULL) {
+                        f->cache = stream_cache_writer_new (f->cache_key);
+                }
+                http_set_request_tag("stream");
+                result = http_get_stream (f->url, headers, 0,
+                                          audio_fetch_data_cb, f);
+                /* Resume from the last byte received, so the decoder
+                 * gets a continuous stream */
+                while (result == HTTP_STREAM_FAILED &&
+                       audio_fetch_wait_reconnect (f, attempts)) {
+                        attempts++;
+                        g_debug ("Reconnecting stream (attempt %u) at "
+                                 "byte %" G_GUINT64_FORMAT, attempts,
+                                 f->received);
+                        http_set_request_tag("stream");
+                        result = http_get_stream (f->url, headers,
+                                                  f->received,
+                                                  audio_fetch_data_cb, f);
+                }
+                success = (result == HTTP_STREAM_DONE ||
+                           result == HTTP_STREAM_CANCELLED);
+                g_free(cookie);
+                g_slist_free(headers);
+                if (f->cache != NULL) {
+                        gboolean complete;
+                        g_mutex_lock (f->mutex);
+                        complete = result == HTTP_STREAM_DONE &&
+                                !f->cancelled;
+                        g_mutex_unlock (f->mutex);
+                        stream_cache_writer_finish (f->cache, complete);
+                        f->cache = NULL;
+                }
+        }
+
+        /* The rest of the data is pushed from the appsrc callbacks */
+        g_mutex_lock (f->mutex);
+        f->finished = TRUE;
+        f->success = success;
+        audio_fetch_update (f);
+        g_mutex_unlock (f->mutex);
+
+        vgl_object_unref (f);
         return NULL;
 }
 
+/**
+ * Start downloading a stream. The data is kept in memory (up to
+ * prefetch_max_bytes) until audio_fetch_attach() is called.
+ * @param url The URL of the stream
+ * @param session_id The session ID, or NULL
+ * @param cache_key The key of the stream in the stream cache, or NULL
+ * @return A new stream, to be freed with audio_fetch_cancel()
+ */
+static audio_fetch *
+audio_fetch_start                       (const char *url,
+                                         const char *session_id,
+                                         const char *cache_key)
+{
+        audio_fetch *f = vgl_object_new (audio_fetch, audio_fetch_destroy);
+        f->url = g_strdup (url);
+        f->session_id = g_strdup (session_id);
+        f->cache_key = g_strdup (cache_key);
+        f->cache = NULL;
+        f->mutex = g_mutex_new ();
+        f->cond = g_cond_new ();
+        f->buffers = g_queue_new ();
+        f->buffered = 0;
+        f->appsrc = NULL;
+        f->started = FALSE;
+        f->wanted = FALSE;
+        f->buffering = TRUE;
+        f->resume_level = buffer_preroll_bytes;
+        f->percent = -1;
+        f->eos_sent = FALSE;
+        f->got_data = FALSE;
+        f->received = 0;
+        f->reconnecting = FALSE;
+        f->dropout_timer = g_timer_new ();
+        f->underrun_timer = g_timer_new ();
+        f->cancelled = FALSE;
+        f->finished = FALSE;
+        f->success = FALSE;
+        memset (&(f->stats), 0, sizeof (f->stats));
+        /* The thread keeps its own reference, so it doesn't need to
+         * be joined: a cancelled stream finishes in the background */
+        g_thread_create (audio_fetch_thread, vgl_object_ref (f),
+                         FALSE, NULL);
+        return f;
+}
+
+/**
+ * Make a stream the one being played. Its data will be pushed to the
+ * appsrc element once the pipeline starts asking for it.
+ * @param f The stream. The caller's reference is taken
+ * @param appsrc The appsrc element
+ */
+static void
+audio_fetch_attach                      (audio_fetch *f,
+                                         GstAppSrc   *appsrc)
+{
+        g_mutex_lock (f->mutex);
+        f->appsrc = appsrc;
+        if (f->got_data) {
+                /* Prefetched: there's no wait for the network */
+                latency_trace_mark (LATENCY_STAGE_CONNECT);
+                latency_trace_mark (LATENCY_STAGE_FIRST_BYTE);
+        }
+        /* Data needed to start playing */
+        f->resume_level = MAX (buffer_preroll_bytes, 1);
+        g_cond_broadcast (f->cond);
+        g_mutex_unlock (f->mutex);
+
+        g_static_mutex_lock (&current_fetch_mutex);
+        current_fetch = f;
+        g_static_mutex_unlock (&current_fetch_mutex);
+}
+
+/**
+ * Stop downloading a stream and release it
+ * @param f The stream
+ */
+static void
+audio_fetch_cancel                      (audio_fetch *f)
+{
+        g_mutex_lock (f->mutex);
+        f->cancelled = TRUE;
+        g_cond_broadcast (f->cond);
+        g_mutex_unlock (f->mutex);
+        vgl_object_unref (f);
+}
+
+/**
+ * Check whether a stream finished successfully
+ * @param f The stream
+ * @return TRUE if the download is complete, FALSE otherwise
+ */
+static gboolean
+audio_fetch_succeeded                   (audio_fetch *f)
+{
+        gboolean success;
+        g_mutex_lock (f->mutex);
+        success = f->finished && f->success;
+        g_mutex_unlock (f->mutex);
+        return success;
+}
+
+static void
+close_previous_playback                 (void)
+{
+        audio_fetch *f = current_fetch;
+        if (f != NULL) {
+                /* Cancel it before it stops being the current stream,
+                 * so it can't be pushing data (and getting the
+                 * enough-data callback) after that */
+                g_mutex_lock (f->mutex);
+                f->cancelled = TRUE;
+                g_cond_broadcast (f->cond);
+                g_mutex_unlock (f->mutex);
+                g_static_mutex_lock (&current_fetch_mutex);
+                current_fetch = NULL;
+                g_static_mutex_unlock (&current_fetch_mutex);
+                vgl_object_unref (f);
+        }
+        buffering = FALSE;
+}
+
+static void
+audio_ttfa_record                       (void)
+{
+        LastfmAudioTtfaStats *st = &(ttfa_stats[ttfa_warm ? 1 : 0]);
+        guint ms = g_timer_elapsed (ttfa_timer, NULL) * 1000;
+        g_debug ("Time to first audio: %u ms (%s start)",
+                 ms, ttfa_warm ? "warm" : "cold");
+        if (st->count == 0 || ms < st->min_ms) st->min_ms = ms;
+        if (ms > st->max_ms) st->max_ms = ms;
+        st->total_ms += ms;
+        st->count++;
+}
+
+static gboolean
+audio_cool_down_cb                      (gpointer data)
+{
+        g_debug ("Pipeline unused for %u seconds, releasing it",
+                 cool_down_seconds);
+        cool_down_id = 0;
+        pipeline_warm = FALSE;
+        gst_element_set_state (pipeline, GST_STATE_NULL);
+        return FALSE;
+}
+
+static void
+audio_cancel_cool_down                  (void)
+{
+        if (cool_down_id != 0) {
+                g_source_remove (cool_down_id);
+                cool_down_id = 0;
+        }
+}
+
 static gboolean
 audio_started_cb_handler                (gpointer data)
 {
@@ -89,7 +651,9 @@ static gboolean
 gst_eos_handler                         (gpointer data)
 {
         static int failed_tracks = 0;
-        if (http_req_success) {
+        gboolean success = audio_started && current_fetch != NULL &&
+                audio_fetch_succeeded (current_fetch);
+        if (success) {
                 failed_tracks = 0;
                 controller_skip_track ();
         } else if (++failed_tracks == 3) {
@@ -117,15 +681,31 @@ bus_call                                (GstBus     *bus,
 
                 g_warning ("Error: %s", err->message);
                 g_error_free (err);
+                pipeline_error = TRUE;
         } /* No, I haven't forgotten the break here */
         case GST_MESSAGE_EOS:
                 gdk_threads_add_idle (gst_eos_handler, NULL);
                 break;
+        case GST_MESSAGE_BUFFERING: {
+                /* Pause while the jitter buffer is filling */
+                gint percent;
+                gst_message_parse_buffering (msg, &percent);
+                if (percent < 100 && !buffering) {
+                        buffering = TRUE;
+                        gst_element_set_state (pipeline, GST_STATE_PAUSED);
+                } else if (percent == 100 && buffering) {
+                        buffering = FALSE;
+                        gst_element_set_state (pipeline, GST_STATE_PLAYING);
+                }
+                break;
+        }
         case GST_MESSAGE_STATE_CHANGED:
                 if (audio_started_callback != NULL) {
                         GstState st;
                         gst_message_parse_state_changed(msg, NULL, &st, NULL);
                         if (st == GST_STATE_PLAYING) {
+                                latency_trace_mark (LATENCY_STAGE_PLAYING);
+                                audio_ttfa_record ();
                                 gdk_threads_add_idle (audio_started_cb_handler,
                                                       audio_started_callback);
                                 audio_started_callback = NULL;
@@ -150,90 +730,189 @@ bus_call                                (GstBus     *bus,
         return TRUE;
 }
 
-static GstElement *
-audio_element_create                    (const char **elem_names,
-                                         const char  *envvar)
+/* Mark the arrival of the first buffer of each track to the sink.
+ * This is called from the streaming thread */
+#if GST_CHECK_VERSION(1,0,0)
+static GstPadProbeReturn
+sink_buffer_probe                       (GstPad          *pad,
+                                         GstPadProbeInfo *info,
+                                         gpointer         data)
 {
-        g_return_val_if_fail(elem_names != NULL, NULL);
-        GstElement *retval = NULL;
-        const char *user_elem_name = NULL;
-
-        if (envvar != NULL) user_elem_name = g_getenv(envvar);
-        if (user_elem_name != NULL && !strcmp(user_elem_name, "none")) {
-                return NULL;
+        if (g_atomic_int_compare_and_exchange (&first_sample_pending, 1, 0)) {
+                latency_trace_mark (LATENCY_STAGE_FIRST_SAMPLE);
         }
-
-        /* Try to create the element given in the environment variable */
-        if (user_elem_name != NULL && *user_elem_name != '\0') {
-                retval = gst_element_factory_make(user_elem_name, NULL);
-                g_debug("Creating GStreamer element %s: %s", user_elem_name,
-                        retval ? "success" : "ERROR");
-        } else {
-                /* Else try each element in the list */
-                int i;
-                for (i = 0; !retval && elem_names[i]; i++) {
-                        retval = gst_element_factory_make(elem_names[i], NULL);
-                        g_debug("Creating GStreamer element %s: %s",
-                                elem_names[i], retval ? "success" : "ERROR");
-                }
+        return GST_PAD_PROBE_OK;
+}
+#else
+static gboolean
+sink_buffer_probe                       (GstPad    *pad,
+                                         GstBuffer *buffer,
+                                         gpointer   data)
+{
+        if (g_atomic_int_compare_and_exchange (&first_sample_pending, 1, 0)) {
+                latency_trace_mark (LATENCY_STAGE_FIRST_SAMPLE);
         }
-        return retval;
+        return TRUE;
 }
+#endif
 
-#ifndef HAVE_DSPMP3SINK
-static GstElement *
-audio_decoder_create                    (void)
+static void
+audio_sink_add_probe                    (void)
 {
-        return audio_element_create(default_decoders, GST_DECODER_ENVVAR);
+        GstPad *sinkpad = gst_element_get_static_pad (sink, "sink");
+        if (sinkpad != NULL) {
+#if GST_CHECK_VERSION(1,0,0)
+                gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_BUFFER,
+                                   sink_buffer_probe, NULL, NULL);
+#else
+                gst_pad_add_buffer_probe (sinkpad,
+                                          G_CALLBACK (sink_buffer_probe),
+                                          NULL);
+#endif
+                gst_object_unref (sinkpad);
+        }
 }
 
+#ifndef HAVE_DSPMP3SINK
+/**
+ * Replace the decoder and the sink of the pipeline with the ones
+ * selected by the user. Nothing must be playing.
+ */
 static void
-pad_added_cb                            (GstElement *decoder,
-                                         GstPad     *pad,
-                                         GstElement *sink)
+audio_replace_elements                  (void)
 {
-        GstPad *sinkpad = gst_element_get_static_pad (sink, "sink");
-        if (!GST_PAD_IS_LINKED (sinkpad)) {
-                gst_pad_link (pad, sinkpad);
+        GstElement *newdecoder = audio_elem_create_decoder ();
+        GstElement *newsink = audio_elem_create_sink ();
+
+        elements_changed = FALSE;
+        if (newdecoder == NULL || newsink == NULL) {
+                g_warning ("Unable to create the new audio elements");
+                if (newdecoder) gst_object_unref (newdecoder);
+                if (newsink) gst_object_unref (newsink);
+                return;
         }
-        g_object_unref (sinkpad);
+
+        audio_cancel_cool_down ();
+        gst_element_set_state (pipeline, GST_STATE_NULL);
+        pipeline_warm = FALSE;
+        pipeline_error = FALSE;
+
+        /* This also unlinks and destroys them */
+        gst_bin_remove_many (GST_BIN (pipeline), decoder, sink, NULL);
+        decoder = newdecoder;
+        sink = newsink;
+        gst_bin_add_many (GST_BIN (pipeline), decoder, sink, NULL);
+        gst_element_link (source, decoder);
+        audio_elem_link_decoder (decoder, sink);
+        audio_sink_add_probe ();
 }
 #endif
 
-const char *
-lastfm_audio_default_decoder_name       (void)
+/**
+ * Select the decoder and the sink. This can be called before
+ * lastfm_audio_init(). Otherwise the new elements are used from the
+ * next track on. The environment variables take precedence.
+ * @param decoder_name The decoder, or NULL or "" for the default one
+ * @param sink_name The sink, or NULL or "" for the default one
+ */
+void
+lastfm_audio_set_elements               (const char *decoder_name,
+                                         const char *sink_name)
+{
+        if (audio_elem_set_preferred (decoder_name, sink_name) &&
+            pipeline != NULL) {
+                elements_changed = TRUE;
+        }
+}
+
+/**
+ * Get the decoders that can be selected with
+ * lastfm_audio_set_elements(), not all of them may be installed
+ * @return A NULL-terminated list, owned by the audio module
+ */
+const char * const *
+lastfm_audio_get_decoder_candidates     (void)
+{
+        return audio_elem_get_decoder_candidates ();
+}
+
+/**
+ * Get the sinks that can be selected with
+ * lastfm_audio_set_elements(), not all of them may be installed
+ * @return A NULL-terminated list, owned by the audio module
+ */
+const char * const *
+lastfm_audio_get_sink_candidates        (void)
 {
-        return default_decoders[0] ? default_decoders[0] : "none";
+        return audio_elem_get_sink_candidates ();
+}
+
+/**
+ * Release the audio device if the pipeline is being kept warm after
+ * the last track, see lastfm_audio_stop(). Nothing must be playing.
+ */
+void
+lastfm_audio_release                    (void)
+{
+        g_return_if_fail (pipeline != NULL);
+        audio_cancel_cool_down ();
+        if (pipeline_warm) {
+                gst_element_set_state (pipeline, GST_STATE_NULL);
+                pipeline_warm = FALSE;
+        }
+}
+
+/**
+ * Measure which of the available decoders and sinks use less CPU,
+ * see audio_elem_calibrate(). This takes several seconds, so it must
+ * be called from a separate thread, and only while stopped and after
+ * lastfm_audio_release().
+ * @param decoder_name Where to store the best decoder
+ * @param sink_name Where to store the best sink
+ * @param cancel Set it to nonzero to stop the calibration early
+ * @return TRUE on success, in that case both strings must be freed
+ *         with g_free()
+ */
+gboolean
+lastfm_audio_calibrate                  (char          **decoder_name,
+                                         char          **sink_name,
+                                         volatile gint  *cancel)
+{
+        return audio_elem_calibrate (decoder_name, sink_name, cancel);
 }
 
 const char *
-lastfm_audio_default_sink_name          (void)
+lastfm_audio_default_decoder_name       (void)
 {
-        return default_sinks[0] ? default_sinks[0] : "none";
+        return audio_elem_default_decoder_name ();
 }
 
-static GstElement *
-audio_sink_create                       (void)
+const char *
+lastfm_audio_default_sink_name          (void)
 {
-        return audio_element_create(default_sinks, GST_SINK_ENVVAR);
+        return audio_elem_default_sink_name ();
 }
 
 gboolean
 lastfm_audio_init                       (void)
 {
+        GstAppSrcCallbacks callbacks;
         GstBus *bus;
         /* initialize GStreamer */
         gst_init (NULL, NULL);
 
         /* set up */
         pipeline = gst_pipeline_new (NULL);
-        source = gst_element_factory_make ("fdsrc", NULL);
+        memset (&callbacks, 0, sizeof (callbacks));
+        callbacks.need_data = audio_fetch_need_data_cb;
+        callbacks.enough_data = audio_fetch_enough_data_cb;
+        source = audio_elem_create_source (&callbacks, NULL);
 #ifdef HAVE_DSPMP3SINK
         decoder = source; /* Unused, this is only for the assertions */
 #else
-        decoder = audio_decoder_create();
+        decoder = audio_elem_create_decoder();
 #endif
-        sink = audio_sink_create();
+        sink = audio_elem_create_sink();
         if (!pipeline || !source || !decoder || !sink) {
                 g_critical ("Error creating GStreamer elements");
                 return FALSE;
@@ -249,32 +928,82 @@ lastfm_audio_init                       (void)
 #else
         gst_bin_add_many (GST_BIN (pipeline), source, decoder, sink, NULL);
         gst_element_link (source, decoder);
-        g_signal_connect (decoder, "pad-added",
-                          G_CALLBACK (pad_added_cb), sink);
+        audio_elem_link_decoder (decoder, sink);
 #endif
 
+        if (ttfa_timer == NULL) ttfa_timer = g_timer_new ();
+
+        audio_sink_add_probe ();
+
         return TRUE;
 }
 
+/**
+ * Start playing a stream
+ * @param url The URL of the stream
+ * @param audio_started_cb Called when the audio starts playing
+ * @param session_id The session ID, or NULL
+ * @param cache_key The key of the track in the stream cache, or NULL
+ *                  not to use the cache
+ * @return TRUE on success
+ */
 gboolean
 lastfm_audio_play                       (const char *url,
                                          GCallback   audio_started_cb,
-                                         const char *session_id)
+                                         const char *session_id,
+                                         const char *cache_key)
 {
         g_return_val_if_fail(pipeline && source && url, FALSE);
-        get_audio_thread_data *data = NULL;
+        audio_fetch *f = NULL;
         close_previous_playback();
-        if (http_thread != NULL) g_thread_join(http_thread);
-        http_thread = NULL;
+#ifndef HAVE_DSPMP3SINK
+        if (elements_changed) {
+                audio_replace_elements ();
+        }
+#endif
         audio_started = FALSE;
         audio_started_callback = audio_started_cb;
-        pipe(http_pipe);
-        data = g_slice_new(get_audio_thread_data);
-        data->session_id = g_strdup(session_id);
-        data->url = g_strdup (url);
-        http_thread = g_thread_create(get_audio_thread, data, TRUE, NULL);
-        g_object_set(G_OBJECT(source), "fd", http_pipe[0], NULL);
-        gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+        /* Use the prefetched stream if it's this one, unless its
+         * download has already failed */
+        if (next_fetch != NULL) {
+                g_mutex_lock (next_fetch->mutex);
+                if (g_str_equal (next_fetch->url, url) &&
+                    (!next_fetch->finished || next_fetch->success)) {
+                        g_debug ("Using prefetched stream (%" G_GSIZE_FORMAT
+                                 " bytes buffered)", next_fetch->buffered);
+                        f = next_fetch;
+                }
+                g_mutex_unlock (next_fetch->mutex);
+                if (f == NULL) {
+                        audio_fetch_cancel (next_fetch);
+                }
+                next_fetch = NULL;
+        }
+        if (f == NULL) {
+                f = audio_fetch_start (url, session_id, cache_key);
+        }
+
+        /* The pipeline stays paused until the jitter buffer has
+         * enough data, see the GST_MESSAGE_BUFFERING handler */
+        g_timer_start (ttfa_timer);
+        g_atomic_int_set (&first_sample_pending, 1);
+        ttfa_warm = pipeline_warm;
+        audio_cancel_cool_down ();
+        audio_fetch_attach (f, GST_APP_SRC (source));
+        buffering = TRUE;
+#ifdef AUDIO_CAN_KEEP_WARM
+        if (pipeline_warm) {
+                /* Drop the remains of the previous track and clear
+                 * the EOS state. When the appsrc element restarts it
+                 * asks the new stream for data */
+                pipeline_warm = FALSE;
+                gst_element_send_event (source, gst_event_new_flush_start ());
+                gst_element_send_event (source,
+                                        gst_event_new_flush_stop (TRUE));
+        }
+#endif
+        gst_element_set_state(pipeline, GST_STATE_PAUSED);
 #ifdef HAVE_DSPMP3SINK
         /* It seems that dspmp3sink ignores the previous volume level
          * when playing a new song. Workaround: change it and then
@@ -286,24 +1015,155 @@ lastfm_audio_play                       (const char *url,
         return TRUE;
 }
 
+/**
+ * Start downloading the stream of the next track while the current
+ * one is still playing, so lastfm_audio_play() can start it without
+ * waiting for the network. Only one stream is prefetched at a time.
+ * @param url The URL of the stream
+ * @param session_id The session ID, or NULL
+ * @param cache_key The key of the track in the stream cache, or NULL
+ */
+void
+lastfm_audio_prefetch                   (const char *url,
+                                         const char *session_id,
+                                         const char *cache_key)
+{
+        g_return_if_fail (url != NULL);
+        if (next_fetch != NULL) {
+                if (g_str_equal (next_fetch->url, url)) return;
+                audio_fetch_cancel (next_fetch);
+        }
+        g_debug ("Prefetching stream %s", url);
+        next_fetch = audio_fetch_start (url, session_id, cache_key);
+}
+
+/**
+ * Set the thresholds of the jitter buffer
+ * @param preroll Bytes needed before a track starts playing
+ * @param low Bytes needed to resume playing after an underrun
+ * @param high Maximum size of the buffer
+ */
+void
+lastfm_audio_set_buffering              (gsize preroll,
+                                         gsize low,
+                                         gsize high)
+{
+        buffer_high_bytes = MAX (high, 1);
+        buffer_preroll_bytes = MIN (preroll, buffer_high_bytes);
+        buffer_low_bytes = MIN (low, buffer_high_bytes);
+}
+
+/**
+ * Get the statistics of the data fed to the pipeline for the track
+ * being played
+ * @param stats Where to store the statistics
+ * @return FALSE if no track is being played, TRUE otherwise
+ */
+gboolean
+lastfm_audio_get_stream_stats           (LastfmAudioFeedStats *stats)
+{
+        g_return_val_if_fail (stats != NULL, FALSE);
+        if (current_fetch == NULL) return FALSE;
+        g_mutex_lock (current_fetch->mutex);
+        *stats = current_fetch->stats;
+        g_mutex_unlock (current_fetch->mutex);
+        return TRUE;
+}
+
+/**
+ * Get the statistics of the data fed to the pipeline, for all the
+ * streams finished so far
+ * @param stats Where to store the statistics
+ */
+void
+lastfm_audio_get_feed_stats             (LastfmAudioFeedStats *stats)
+{
+        g_return_if_fail (stats != NULL);
+        g_static_mutex_lock (&feed_stats_mutex);
+        *stats = feed_stats;
+        g_static_mutex_unlock (&feed_stats_mutex);
+}
+
+/**
+ * Set the maximum amount of data kept in memory for a prefetched
+ * stream. If the limit is reached the download waits until the
+ * stream is played.
+ * @param bytes The limit, in bytes
+ */
+void
+lastfm_audio_set_prefetch_limit         (gsize bytes)
+{
+        prefetch_max_bytes = bytes;
+}
+
 gboolean
 lastfm_audio_stop                       (void)
 {
         g_return_val_if_fail(pipeline != NULL, FALSE);
-        gst_element_set_state(pipeline, GST_STATE_NULL);
+        audio_cancel_cool_down ();
+        if (keep_warm && !pipeline_error) {
+                /* Keep the sink and the decoder ready for the next
+                 * track, see lastfm_audio_play() */
+                gst_element_set_state(pipeline, GST_STATE_PAUSED);
+                pipeline_warm = TRUE;
+                cool_down_id = g_timeout_add_seconds (cool_down_seconds,
+                                                      audio_cool_down_cb,
+                                                      NULL);
+        } else {
+                gst_element_set_state(pipeline, GST_STATE_NULL);
+                pipeline_warm = FALSE;
+                pipeline_error = FALSE;
+        }
         close_previous_playback();
         return TRUE;
 }
 
+/**
+ * Keep the pipeline paused between tracks instead of shutting it
+ * down, so the audio device doesn't have to be opened again for
+ * each track. Only available with GStreamer 1.0.
+ * @param enable Whether to keep the pipeline warm
+ */
+void
+lastfm_audio_set_keep_warm              (gboolean enable)
+{
+#ifdef AUDIO_CAN_KEEP_WARM
+        keep_warm = enable;
+#else
+        if (enable) g_debug ("Keeping the pipeline warm is not supported");
+#endif
+}
+
+/**
+ * Get the time-to-first-audio statistics of the tracks played so
+ * far, separated into cold starts (the pipeline was shut down) and
+ * warm starts (see lastfm_audio_set_keep_warm())
+ * @param cold Where to store the statistics of cold starts
+ * @param warm Where to store the statistics of warm starts
+ */
+void
+lastfm_audio_get_ttfa_stats             (LastfmAudioTtfaStats *cold,
+                                         LastfmAudioTtfaStats *warm)
+{
+        g_return_if_fail (cold != NULL && warm != NULL);
+        *cold = ttfa_stats[0];
+        *warm = ttfa_stats[1];
+}
+
 void
 lastfm_audio_clear                      (void)
 {
         g_return_if_fail(pipeline != NULL);
+        audio_cancel_cool_down ();
+        pipeline_warm = FALSE;
         gst_element_set_state (pipeline, GST_STATE_NULL);
         gst_object_unref (GST_OBJECT (pipeline));
         pipeline = NULL;
         close_previous_playback();
-        if (http_thread != NULL) g_thread_join(http_thread);
+        if (next_fetch != NULL) {
+                audio_fetch_cancel (next_fetch);
+                next_fetch = NULL;
+        }
 }
 
 int
@@ -16,13 +16,64 @@
 #define GST_DECODER_ENVVAR "VAGALUME_GST_DECODER"
 #define GST_SINK_ENVVAR "VAGALUME_GST_SINK"
 
+/* Data fed to the pipeline. underruns is the number of times the
+ * jitter buffer ran out of data, underrun_ms the total time spent
+ * buffering after those, and full the number of times the download
+ * had to wait because the buffer was full. reconnects is the number
+ * of times the download was resumed after a network error, and
+ * dropout_ms the time without data because of that */
+typedef struct {
+        guint64 bytes;
+        guint buffers;
+        guint underruns;
+        guint underrun_ms;
+        guint full;
+        guint reconnects;
+        guint dropout_ms;
+} LastfmAudioFeedStats;
+
+/* Time to first audio of the tracks played so far, in milliseconds */
+typedef struct {
+        guint count;
+        guint total_ms;
+        guint min_ms;
+        guint max_ms;
+} LastfmAudioTtfaStats;
+
 gboolean
 lastfm_audio_init                       (void);
 
 gboolean
 lastfm_audio_play                       (const char *url,
                                          GCallback   audio_started_cb,
-                                         const char *session_id);
+                                         const char *session_id,
+                                         const char *cache_key);
+
+void
+lastfm_audio_prefetch                   (const char *url,
+                                         const char *session_id,
+                                         const char *cache_key);
+
+void
+lastfm_audio_set_prefetch_limit         (gsize bytes);
+
+void
+lastfm_audio_set_buffering              (gsize preroll,
+                                         gsize low,
+                                         gsize high);
+
+gboolean
+lastfm_audio_get_stream_stats           (LastfmAudioFeedStats *stats);
+
+void
+lastfm_audio_get_feed_stats             (LastfmAudioFeedStats *stats);
+
+void
+lastfm_audio_get_ttfa_stats             (LastfmAudioTtfaStats *cold,
+                                         LastfmAudioTtfaStats *warm);
+
+void
+lastfm_audio_set_keep_warm              (gboolean enable);
 
 gboolean
 lastfm_audio_stop                       (void);
@@ -42,6 +93,24 @@ lastfm_audio_increase_volume            (int inc);
 void
 lastfm_audio_clear                      (void);
 
+void
+lastfm_audio_set_elements               (const char *decoder_name,
+                                         const char *sink_name);
+
+const char * const *
+lastfm_audio_get_decoder_candidates     (void);
+
+const char * const *
+lastfm_audio_get_sink_candidates        (void);
+
+void
+lastfm_audio_release                    (void);
+
+gboolean
+lastfm_audio_calibrate                  (char          **decoder_name,
+                                         char          **sink_name,
+                                         volatile gint  *cancel);
+
 const char *
 lastfm_audio_default_decoder_name       (void);
 
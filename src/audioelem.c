@@ -0,0 +1,626 @@
+/*
+ * audioelem.c -- Creation of the elements of the audio pipeline
+ *
+ * Copyright (C) 2007-2010, 2013 Igalia, S.L.
+ * Authors: Alberto Garcia <berto@igalia.com>
+ *
+ * This file is part of Vagalume and is published under the GNU GPLv3
+ * See the README file for more details.
+ */
+
+/* For RUSAGE_THREAD */
+#define _GNU_SOURCE
+
+#include "config.h"
+
+#include <string.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "audioelem.h"
+#include "audio.h"
+
+#ifdef HAVE_DSPMP3SINK
+static const char *default_decoders[] = { NULL };
+static const char *default_sinks[] = { "dspmp3sink", NULL };
+#else
+static const char *default_decoders[] = { "decodebin", NULL };
+static const char *default_sinks[] = { "autoaudiosink", NULL };
+#endif
+
+/* Decoders and sinks compared by audio_elem_calibrate(). Decoders
+ * can be pipeline descriptions, for those that need a parser */
+#ifdef HAVE_DSPMP3SINK
+static const char *calibration_decoders[] = { NULL };
+static const char *calibration_sinks[] = { "dspmp3sink", NULL };
+#elif GST_CHECK_VERSION(1,0,0)
+static const char *calibration_decoders[] = {
+        "decodebin",
+        "mpegaudioparse ! mpg123audiodec",
+        "mpegaudioparse ! avdec_mp3",
+        "mpegaudioparse ! mad",
+        "mpegaudioparse ! flump3dec",
+        NULL
+};
+static const char *calibration_sinks[] = {
+        "autoaudiosink", "pulsesink", "alsasink", "osssink", NULL
+};
+#else
+static const char *calibration_decoders[] = {
+        "decodebin", "mad", "flump3dec", "mp3parse ! ffdec_mp3", NULL
+};
+static const char *calibration_sinks[] = {
+        "autoaudiosink", "pulsesink", "alsasink", "osssink", NULL
+};
+#endif
+
+/* Elements selected by the user, used instead of the first ones of
+ * the default lists. NULL to use the defaults */
+static char *preferred_decoder = NULL;
+static char *preferred_sink = NULL;
+
+/* Length of the samples used for the calibration, in MP3 frames
+ * (26 ms each): decoders are measured with a longer sample decoded
+ * as fast as possible, sinks with a short one played in real time */
+static const guint calibration_decode_frames = 383;
+static const guint calibration_play_frames = 39;
+
+/* Maximum time to wait for each calibration run, in seconds */
+static const guint calibration_timeout = 10;
+
+/* Size of the queue of the appsrc element. It's small since the
+ * jitter buffer is in front of it */
+static const guint64 feed_max_bytes = 32 * 1024;
+
+/**
+ * Create a GStreamer element from its name, or a bin from a pipeline
+ * description such as "mpegaudioparse ! mad"
+ * @param name The name or the description
+ * @return The new element, or NULL
+ */
+static GstElement *
+audio_elem_make                         (const char *name)
+{
+        GstElement *elem;
+
+        if (strchr (name, '!') != NULL) {
+                GError *err = NULL;
+                elem = gst_parse_bin_from_description (name, TRUE, &err);
+                /* Missing elements are not fatal for the parser */
+                if (err != NULL) {
+                        if (elem != NULL) gst_object_unref (elem);
+                        elem = NULL;
+                        g_error_free (err);
+                }
+        } else {
+                elem = gst_element_factory_make (name, NULL);
+        }
+        g_debug("Creating GStreamer element %s: %s", name,
+                elem ? "success" : "ERROR");
+        return elem;
+}
+
+/**
+ * Create a GStreamer element, either the one named in an environment
+ * variable or the first one of a list that can be created
+ * @param elem_names NULL-terminated list of element names
+ * @param envvar Name of the environment variable, or NULL
+ * @return The new element, or NULL if none could be created or the
+ *         environment variable is set to "none"
+ */
+GstElement *
+audio_elem_create                       (const char **elem_names,
+                                         const char  *envvar)
+{
+        g_return_val_if_fail(elem_names != NULL, NULL);
+        GstElement *retval = NULL;
+        const char *user_elem_name = NULL;
+
+        if (envvar != NULL) user_elem_name = g_getenv(envvar);
+        if (user_elem_name != NULL && !strcmp(user_elem_name, "none")) {
+                return NULL;
+        }
+
+        /* Try to create the element given in the environment variable */
+        if (user_elem_name != NULL && *user_elem_name != '\0') {
+                retval = audio_elem_make(user_elem_name);
+        } else {
+                /* Else try each element in the list */
+                int i;
+                for (i = 0; !retval && elem_names[i]; i++) {
+                        retval = audio_elem_make(elem_names[i]);
+                }
+        }
+        return retval;
+}
+
+/**
+ * Like audio_elem_create(), but try the element selected by the user
+ * before the list, unless the environment variable is set
+ * @param elem_names NULL-terminated list of element names
+ * @param preferred The element selected by the user, or NULL
+ * @param envvar Name of the environment variable
+ * @return The new element, or NULL
+ */
+static GstElement *
+audio_elem_create_preferred             (const char **elem_names,
+                                         const char  *preferred,
+                                         const char  *envvar)
+{
+        const char *user_elem_name = g_getenv(envvar);
+        if ((user_elem_name == NULL || *user_elem_name == '\0') &&
+            preferred != NULL) {
+                GstElement *retval = audio_elem_make(preferred);
+                if (retval != NULL) return retval;
+        }
+        return audio_elem_create(elem_names, envvar);
+}
+
+static gboolean
+audio_elem_replace_preferred            (char       **preferred,
+                                         const char  *name)
+{
+        if (name != NULL && *name == '\0') name = NULL;
+        if (name == NULL && *preferred == NULL) return FALSE;
+        if (name != NULL && *preferred != NULL &&
+            !strcmp (name, *preferred)) return FALSE;
+        g_free (*preferred);
+        *preferred = g_strdup (name);
+        return TRUE;
+}
+
+/**
+ * Set the decoder and sink selected by the user. They are used by
+ * audio_elem_create_decoder() and audio_elem_create_sink() unless
+ * the environment variables are set or they can't be created.
+ * @param decoder The decoder, or NULL or "" to use the default one
+ * @param sink The sink, or NULL or "" to use the default one
+ * @return Whether the selection has changed
+ */
+gboolean
+audio_elem_set_preferred                (const char *decoder,
+                                         const char *sink)
+{
+        gboolean changed;
+        changed = audio_elem_replace_preferred (&preferred_decoder, decoder);
+        changed = audio_elem_replace_preferred (&preferred_sink, sink) ||
+                changed;
+        return changed;
+}
+
+/**
+ * Create the appsrc element that the audio data is pushed to
+ * @param callbacks The need-data and enough-data callbacks
+ * @param userdata Data passed to the callbacks
+ * @return The new element, or NULL
+ */
+GstElement *
+audio_elem_create_source                (GstAppSrcCallbacks *callbacks,
+                                         gpointer            userdata)
+{
+        GstElement *source = gst_element_factory_make ("appsrc", NULL);
+        if (source == NULL) return NULL;
+
+        gst_app_src_set_max_bytes (GST_APP_SRC (source), feed_max_bytes);
+        gst_app_src_set_stream_type (GST_APP_SRC (source),
+                                     GST_APP_STREAM_TYPE_STREAM);
+        if (callbacks != NULL) {
+                gst_app_src_set_callbacks (GST_APP_SRC (source), callbacks,
+                                           userdata, NULL);
+        }
+        return source;
+}
+
+/**
+ * Create a buffer with a copy of some data
+ * @param data The data
+ * @param size The size of the data
+ * @return A new buffer
+ */
+GstBuffer *
+audio_elem_buffer_new                   (const char *data,
+                                         size_t      size)
+{
+        gpointer copy = g_memdup (data, size);
+#if GST_CHECK_VERSION(1,0,0)
+        return gst_buffer_new_wrapped (copy, size);
+#else
+        GstBuffer *buf = gst_buffer_new ();
+        GST_BUFFER_MALLOCDATA (buf) = copy;
+        GST_BUFFER_DATA (buf) = copy;
+        GST_BUFFER_SIZE (buf) = size;
+        return buf;
+#endif
+}
+
+/**
+ * Create the decoder, see audio_elem_create_preferred()
+ * @return The new element, or NULL
+ */
+GstElement *
+audio_elem_create_decoder               (void)
+{
+        return audio_elem_create_preferred(default_decoders, preferred_decoder,
+                                           GST_DECODER_ENVVAR);
+}
+
+/**
+ * Create the audio sink, see audio_elem_create_preferred()
+ * @return The new element, or NULL
+ */
+GstElement *
+audio_elem_create_sink                  (void)
+{
+        return audio_elem_create_preferred(default_sinks, preferred_sink,
+                                           GST_SINK_ENVVAR);
+}
+
+static void
+pad_added_cb                            (GstElement *decoder,
+                                         GstPad     *pad,
+                                         GstElement *sink)
+{
+        GstPad *sinkpad = gst_element_get_static_pad (sink, "sink");
+        if (!GST_PAD_IS_LINKED (sinkpad)) {
+                gst_pad_link (pad, sinkpad);
+        }
+        g_object_unref (sinkpad);
+}
+
+/**
+ * Link a decoder to the element after it. Decoders with an always
+ * source pad are linked immediately, the rest when their pad is
+ * added (as decodebin does once it knows the type of the stream).
+ * Both elements must already be in the same bin.
+ * @param decoder The decoder
+ * @param sink The next element
+ * @return FALSE if the elements couldn't be linked
+ */
+gboolean
+audio_elem_link_decoder                 (GstElement *decoder,
+                                         GstElement *sink)
+{
+        GstPad *srcpad;
+
+        g_return_val_if_fail (decoder != NULL && sink != NULL, FALSE);
+
+        srcpad = gst_element_get_static_pad (decoder, "src");
+        if (srcpad != NULL) {
+                g_object_unref (srcpad);
+                return gst_element_link (decoder, sink);
+        }
+
+        g_signal_connect (decoder, "pad-added",
+                          G_CALLBACK (pad_added_cb), sink);
+        return TRUE;
+}
+
+const char *
+audio_elem_default_decoder_name         (void)
+{
+        return default_decoders[0] ? default_decoders[0] : "none";
+}
+
+const char *
+audio_elem_default_sink_name            (void)
+{
+        return default_sinks[0] ? default_sinks[0] : "none";
+}
+
+const char * const *
+audio_elem_get_decoder_candidates       (void)
+{
+        return calibration_decoders;
+}
+
+const char * const *
+audio_elem_get_sink_candidates          (void)
+{
+        return calibration_sinks;
+}
+
+static double
+audio_elem_rusage_time                  (int who)
+{
+        struct rusage ru;
+        getrusage (who, &ru);
+        return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+                (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+/**
+ * Get the CPU time used by the whole process
+ * @return The user and system time, in seconds
+ */
+double
+audio_elem_cpu_time                     (void)
+{
+        return audio_elem_rusage_time (RUSAGE_SELF);
+}
+
+#ifdef RUSAGE_THREAD
+/* CPU time used by the streaming threads of a pipeline, see
+ * calibrate_stream_status_cb() */
+typedef struct {
+        GMutex *mutex;
+        double cpu;
+} calibration_cpu;
+
+/* The CPU time of the current thread when it entered the pipeline,
+ * or -1 */
+static GStaticPrivate thread_cpu_start = G_STATIC_PRIVATE_INIT;
+
+/* The streaming threads post these messages themselves when they
+ * start and stop working for the pipeline, so each one can measure
+ * its own CPU time. The rest of the process (UI, network...) is not
+ * counted */
+static GstBusSyncReply
+calibrate_stream_status_cb              (GstBus     *bus,
+                                         GstMessage *msg,
+                                         gpointer    data)
+{
+        calibration_cpu *c = data;
+        if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_STREAM_STATUS) {
+                GstStreamStatusType type;
+                double *start = g_static_private_get (&thread_cpu_start);
+                gst_message_parse_stream_status (msg, &type, NULL);
+                if (type == GST_STREAM_STATUS_TYPE_ENTER) {
+                        if (start == NULL) {
+                                start = g_new (double, 1);
+                                g_static_private_set (&thread_cpu_start,
+                                                      start, g_free);
+                        }
+                        *start = audio_elem_rusage_time (RUSAGE_THREAD);
+                } else if (type == GST_STREAM_STATUS_TYPE_LEAVE &&
+                           start != NULL && *start >= 0) {
+                        double cpu;
+                        cpu = audio_elem_rusage_time (RUSAGE_THREAD) - *start;
+                        *start = -1;
+                        g_mutex_lock (c->mutex);
+                        c->cpu += cpu;
+                        g_mutex_unlock (c->mutex);
+                }
+        }
+        return GST_BUS_PASS;
+}
+#endif
+
+/**
+ * Create an MP3 stream of digital silence, so no sample file needs
+ * to be installed. Each frame is MPEG-1 Layer III, 128 kbps, 44.1 kHz
+ * with all the side information set to zero
+ * @param frames The number of frames
+ * @param size Where to store the size of the stream
+ * @return The stream, to be freed with g_free()
+ */
+static char *
+audio_elem_silent_mp3                   (guint  frames,
+                                         gsize *size)
+{
+        static const guchar header[] = { 0xFF, 0xFB, 0x90, 0x64 };
+        const gsize frame_size = 417;
+        char *data = g_malloc0 (frames * frame_size);
+        guint i;
+        for (i = 0; i < frames; i++) {
+                memcpy (data + i * frame_size, header, sizeof (header));
+        }
+        *size = frames * frame_size;
+        return data;
+}
+
+/**
+ * Play a stream once and measure it. This blocks until the stream
+ * has finished, so it's meant to be used from a separate thread.
+ * Where RUSAGE_THREAD is available only the streaming threads of the
+ * pipeline are measured, otherwise the whole process.
+ * @param decoder_name The decoder
+ * @param sink_name The sink, or NULL to decode as fast as possible
+ * @param data The stream
+ * @param size The size of the stream
+ * @param cpu Where to store the CPU time used, in seconds
+ * @param start Where to store the time to reach the PLAYING state
+ * @return FALSE if the pipeline couldn't be created or failed
+ */
+static gboolean
+audio_elem_calibrate_run                (const char *decoder_name,
+                                         const char *sink_name,
+                                         const char *data,
+                                         gsize       size,
+                                         double     *cpu,
+                                         double     *start)
+{
+        const char *decoders[] = { decoder_name, NULL };
+        const char *sinks[] = { sink_name, NULL };
+        GstElement *pipeline, *source, *decoder, *sink;
+        gboolean done = FALSE;
+        gboolean ok = FALSE;
+        GTimer *timer;
+        GstBus *bus;
+#ifdef RUSAGE_THREAD
+        calibration_cpu c;
+#endif
+
+        pipeline = gst_pipeline_new (NULL);
+        source = audio_elem_create_source (NULL, NULL);
+        decoder = audio_elem_create (decoders, NULL);
+        if (sink_name != NULL) {
+                sink = audio_elem_create (sinks, NULL);
+        } else {
+                sink = gst_element_factory_make ("fakesink", NULL);
+                if (sink) g_object_set (sink, "sync", FALSE, NULL);
+        }
+        if (!source || !decoder || !sink) {
+                if (source) gst_object_unref (source);
+                if (decoder) gst_object_unref (decoder);
+                if (sink) gst_object_unref (sink);
+                gst_object_unref (pipeline);
+                return FALSE;
+        }
+        gst_bin_add_many (GST_BIN (pipeline), source, decoder, sink, NULL);
+        gst_element_link (source, decoder);
+        audio_elem_link_decoder (decoder, sink);
+
+        gst_app_src_push_buffer (GST_APP_SRC (source),
+                                 audio_elem_buffer_new (data, size));
+        gst_app_src_end_of_stream (GST_APP_SRC (source));
+
+        bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+        *start = -1;
+#ifdef RUSAGE_THREAD
+        c.mutex = g_mutex_new ();
+        c.cpu = 0;
+#if GST_CHECK_VERSION(1,0,0)
+        gst_bus_set_sync_handler (bus, calibrate_stream_status_cb, &c, NULL);
+#else
+        gst_bus_set_sync_handler (bus, calibrate_stream_status_cb, &c);
+#endif
+#else
+        *cpu = audio_elem_cpu_time ();
+#endif
+        timer = g_timer_new ();
+        gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+        while (!done) {
+                GstMessage *msg;
+                msg = gst_bus_timed_pop_filtered (
+                        bus, calibration_timeout * GST_SECOND,
+                        GST_MESSAGE_EOS | GST_MESSAGE_ERROR |
+                        GST_MESSAGE_STATE_CHANGED);
+                if (msg == NULL) break; /* Timeout */
+                switch (GST_MESSAGE_TYPE (msg)) {
+                case GST_MESSAGE_STATE_CHANGED:
+                        if (GST_MESSAGE_SRC (msg) == GST_OBJECT (pipeline)) {
+                                GstState newstate;
+                                gst_message_parse_state_changed (
+                                        msg, NULL, &newstate, NULL);
+                                if (newstate == GST_STATE_PLAYING &&
+                                    *start < 0) {
+                                        *start = g_timer_elapsed (timer,
+                                                                  NULL);
+                                }
+                        }
+                        break;
+                case GST_MESSAGE_EOS:
+                        ok = TRUE;
+                        done = TRUE;
+                        break;
+                default:
+                        done = TRUE;
+                        break;
+                }
+                gst_message_unref (msg);
+        }
+
+#ifdef RUSAGE_THREAD
+        /* This waits for the streaming threads, so all of them
+         * have left the pipeline and added their time afterwards */
+        gst_element_set_state (pipeline, GST_STATE_NULL);
+#if GST_CHECK_VERSION(1,0,0)
+        gst_bus_set_sync_handler (bus, NULL, NULL, NULL);
+#else
+        gst_bus_set_sync_handler (bus, NULL, NULL);
+#endif
+        *cpu = c.cpu;
+        g_mutex_free (c.mutex);
+#else
+        *cpu = audio_elem_cpu_time () - *cpu;
+        gst_element_set_state (pipeline, GST_STATE_NULL);
+#endif
+        gst_object_unref (bus);
+        gst_object_unref (pipeline);
+        g_timer_destroy (timer);
+
+        return ok && *start >= 0;
+}
+
+/**
+ * Find the decoder and sink that use less CPU among the ones that
+ * are available. First each decoder decodes a sample as fast as
+ * possible (best of two runs), then the sample is played with each
+ * sink using the best decoder. Each sink opens the audio device (and
+ * the CPU time of the whole process is measured where the time of a
+ * single thread is not available), so nothing else must be playing
+ * meanwhile.
+ * This blocks for several seconds, so it's meant to be used from a
+ * separate thread. GStreamer must have been initialized.
+ * @param decoder Where to store the best decoder
+ * @param sink Where to store the best sink
+ * @param cancel If it becomes nonzero the calibration stops after the
+ *        current measurement
+ * @return TRUE if a decoder and a sink have been found, in that case
+ *         they must be freed with g_free()
+ */
+gboolean
+audio_elem_calibrate                    (char          **decoder,
+                                         char          **sink,
+                                         volatile gint  *cancel)
+{
+        const char *best_decoder = NULL;
+        const char *best_sink = NULL;
+        double best = -1;
+        char *data;
+        gsize size;
+        int i;
+
+        g_return_val_if_fail (decoder && sink && cancel, FALSE);
+
+        /* Nothing to choose if the sink does the decoding */
+        if (calibration_decoders[0] == NULL) return FALSE;
+
+        data = audio_elem_silent_mp3 (calibration_decode_frames, &size);
+        for (i = 0; calibration_decoders[i] != NULL; i++) {
+                const char *name = calibration_decoders[i];
+                double cpu, start, min = -1;
+                int run;
+                for (run = 0; run < 2; run++) {
+                        if (g_atomic_int_get (cancel)) break;
+                        if (!audio_elem_calibrate_run (name, NULL, data, size,
+                                                       &cpu, &start)) {
+                                min = -1;
+                                break;
+                        }
+                        if (min < 0 || cpu < min) min = cpu;
+                }
+                if (min < 0) {
+                        g_debug ("Calibration: decoder %s not available",
+                                 name);
+                } else {
+                        g_debug ("Calibration: decoder %s, %.1f ms of CPU",
+                                 name, min * 1000);
+                        if (best < 0 || min < best) {
+                                best = min;
+                                best_decoder = name;
+                        }
+                }
+        }
+        g_free (data);
+
+        if (best_decoder == NULL || g_atomic_int_get (cancel)) return FALSE;
+
+        best = -1;
+        data = audio_elem_silent_mp3 (calibration_play_frames, &size);
+        for (i = 0; calibration_sinks[i] != NULL; i++) {
+                const char *name = calibration_sinks[i];
+                double cpu, start;
+                if (g_atomic_int_get (cancel)) break;
+                if (!audio_elem_calibrate_run (best_decoder, name, data, size,
+                                               &cpu, &start)) {
+                        g_debug ("Calibration: sink %s not available", name);
+                        continue;
+                }
+                g_debug ("Calibration: sink %s, %.1f ms of CPU, started "
+                         "in %.1f ms", name, cpu * 1000, start * 1000);
+                if (best < 0 || cpu < best) {
+                        best = cpu;
+                        best_sink = name;
+                }
+        }
+        g_free (data);
+
+        if (best_sink == NULL || g_atomic_int_get (cancel)) return FALSE;
+
+        g_debug ("Calibration: selected %s and %s", best_decoder, best_sink);
+        *decoder = g_strdup (best_decoder);
+        *sink = g_strdup (best_sink);
+        return TRUE;
+}
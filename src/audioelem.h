@@ -0,0 +1,63 @@
+/*
+ * audioelem.h -- Creation of the elements of the audio pipeline
+ *
+ * Copyright (C) 2007-2010, 2013 Igalia, S.L.
+ * Authors: Alberto Garcia <berto@igalia.com>
+ *
+ * This file is part of Vagalume and is published under the GNU GPLv3
+ * See the README file for more details.
+ */
+
+#ifndef AUDIOELEM_H
+#define AUDIOELEM_H
+
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+
+GstElement *
+audio_elem_create                       (const char **elem_names,
+                                         const char  *envvar);
+
+GstElement *
+audio_elem_create_source                (GstAppSrcCallbacks *callbacks,
+                                         gpointer            userdata);
+
+GstElement *
+audio_elem_create_decoder               (void);
+
+GstElement *
+audio_elem_create_sink                  (void);
+
+GstBuffer *
+audio_elem_buffer_new                   (const char *data,
+                                         size_t      size);
+
+gboolean
+audio_elem_link_decoder                 (GstElement *decoder,
+                                         GstElement *sink);
+
+const char *
+audio_elem_default_decoder_name         (void);
+
+const char *
+audio_elem_default_sink_name            (void);
+
+gboolean
+audio_elem_set_preferred                (const char *decoder,
+                                         const char *sink);
+
+const char * const *
+audio_elem_get_decoder_candidates       (void);
+
+const char * const *
+audio_elem_get_sink_candidates          (void);
+
+double
+audio_elem_cpu_time                     (void);
+
+gboolean
+audio_elem_calibrate                    (char          **decoder,
+                                         char          **sink,
+                                         volatile gint  *cancel);
+
+#endif
@@ -11,6 +11,7 @@
 #include <glib/gi18n.h>
 #include "connection.h"
 #include "controller.h"
+#include "http.h"
 #include <conicconnection.h>
 #include <conicconnectionevent.h>
 
@@ -39,6 +40,8 @@ con_ic_status_handler                   (ConIcConnection      *conn,
         ConIcConnectionStatus status;
         status = con_ic_connection_event_get_status(event);
  	is_online = (status == CON_IC_STATUS_CONNECTED);
+        /* The proxy may be different in the new network */
+        http_invalidate_proxy_cache();
         if (!is_online) {
                 gdk_threads_enter();
                 controller_disconnect();
@@ -12,7 +12,6 @@
 
 #include <glib/gi18n.h>
 #include <glib.h>
-#include <glib/gstdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <time.h>
@@ -27,6 +26,8 @@
 #include "uimisc.h"
 #include "dlwin.h"
 #include "http.h"
+#include "latency.h"
+#include "streamcache.h"
 #include "globaldefs.h"
 #include "util.h"
 #include "vgl-bookmark-mgr.h"
@@ -81,36 +82,53 @@ static gboolean showing_cover = FALSE;
 static gboolean stop_after_this_track = FALSE;
 static gboolean shutting_down = FALSE;
 
-typedef struct {
-        LastfmWsSession *session;
-        LastfmTrack *track;
-        char *taglist;                /* comma-separated list of tags */
-        LastfmTrackComponent type;
-} TagData;
-
-typedef struct {
-        LastfmWsSession *session;
-        LastfmTrack *track;
-        char *rcpt;                  /* Recipient of the recommendation */
-        char *text;                  /* text of the recommendation */
-        LastfmTrackComponent type;
-} RecommData;
+/* Consumers of the 'playback-progress' signal (owner -> interval in
+ * seconds, see controller_add_progress_interest()). The signal is
+ * emitted by a timer that only runs while a track is playing, the
+ * display is on and there's at least one consumer */
+static GHashTable *progress_interests = NULL;
+static gboolean progress_running = FALSE;
+static gboolean display_on = TRUE;
+static guint progress_id = 0;
+static guint progress_interval = 0;
+static guint prefetch_id = 0;
+
+/* At most one playlist request is in flight. playlist_waiting is set
+ * if the player is waiting for it to play the next track; otherwise
+ * it's a background refill (see controller_check_playlist_level()).
+ * playlist_generation changes when the playlist is discarded, so
+ * the tracks of a request made before that are not added to it */
+static gboolean playlist_request_running = FALSE;
+static gboolean playlist_waiting = FALSE;
+static guint playlist_generation = 0;
+
+/* TRUE while the fastest decoder and sink are being measured */
+static gboolean calibrating_audio = FALSE;
+/* The measurement has to be done once the player stops */
+static gboolean calibration_pending = FALSE;
+/* Set when a track starts during the measurement */
+static volatile gint calibration_cancel = 0;
 
 typedef struct {
         LastfmTrack *track;
         char *dstpath;
+        char *cache_key;
 } DownloadData;
 
 typedef struct {
         LastfmWsSession *session;
         gboolean discovery;
         gboolean lowbitrate;
+        guint generation;
+        LastfmPls *pls;
 } GetPlaylistData;
 
 typedef struct {
-        LastfmWsSession *session;
-        LastfmTrack *track;
-} AddToPlaylistData;
+        char *decoder;
+        char *sink;
+        gboolean success;
+        gboolean cancelled;
+} CalibrateAudioData;
 
 typedef struct {
         LastfmWsSession *session;
@@ -240,32 +258,225 @@ controller_toggle_mainwin_visibility    (void)
 }
 
 /**
- * Calculate the amount of time that a track has been playing and emit
- * the 'playback-progress' signal. To be called using g_timeout_add()
+ * Get the key used to store the stream of a track in the stream
+ * cache. Track IDs are only unique within a server, so the name of
+ * the current server is part of the key.
+ * @param track The track
+ * @return A newly allocated string, or NULL if the track can't be
+ *         cached
+ */
+static char *
+controller_track_cache_key              (const LastfmTrack *track)
+{
+        /* Tracks with no ID have it set to -1 */
+        if (track->id == 0 || track->id == (guint) -1 ||
+            usercfg == NULL || usercfg->server == NULL) {
+                return NULL;
+        }
+        return g_strdup_printf ("%s/track-%u", usercfg->server->name,
+                                track->id);
+}
+
+/**
+ * Start downloading the next track in the playlist so it can start
+ * playing as soon as the current one finishes
+ */
+static void
+controller_prefetch_next_track          (void)
+{
+        LastfmTrack *next;
+        LastfmSession *v1session;
+
+        if (usercfg->prefetch_window <= 0 || stop_after_this_track ||
+            session == NULL) return;
+
+        next = lastfm_pls_peek_track (playlist);
+        if (next != NULL && next->stream_url != NULL) {
+                char *key = controller_track_cache_key (next);
+                v1session = lastfm_ws_session_get_v1_session (session);
+                lastfm_audio_prefetch (next->stream_url,
+                                       v1session ? v1session->id : NULL,
+                                       key);
+                g_free (key);
+        }
+}
+
+/**
+ * Calculate the amount of time that the current track has been
+ * playing and emit the 'playback-progress' signal
+ */
+static void
+controller_emit_progress                (void)
+{
+        int played;
+        g_return_if_fail (nowplaying != NULL);
+        played = lastfm_audio_get_running_time ();
+        if (played != -1) {
+                guint length = nowplaying->duration/1000;
+                g_signal_emit (vgl_controller, signals[PLAYBACK_PROGRESS], 0,
+                               played, length);
+        }
+}
+
+static gboolean
+controller_progress_timeout             (gpointer data)
+{
+        controller_emit_progress ();
+        return TRUE;
+}
+
+static void
+controller_progress_min_interval        (gpointer key,
+                                         gpointer value,
+                                         gpointer userdata)
+{
+        guint *interval = userdata;
+        guint i = GPOINTER_TO_UINT (value);
+        if (*interval == 0 || i < *interval) *interval = i;
+}
+
+/**
+ * Start, stop or change the timer that emits 'playback-progress',
+ * depending on the state of the player and on the consumers
+ * interested in the signal
+ */
+static void
+controller_progress_reschedule          (void)
+{
+        guint interval = 0;
+        if (progress_running && display_on && progress_interests != NULL) {
+                g_hash_table_foreach (progress_interests,
+                                      controller_progress_min_interval,
+                                      &interval);
+        }
+        if (interval == progress_interval) return;
+        if (progress_id != 0) {
+                g_source_remove (progress_id);
+                progress_id = 0;
+        }
+        progress_interval = interval;
+        if (interval > 0) {
+                g_debug ("Updating playback progress every %u seconds",
+                         interval);
+                progress_id = gdk_threads_add_timeout_seconds (
+                        interval, controller_progress_timeout, NULL);
+        }
+}
+
+/**
+ * Register a consumer of the 'playback-progress' signal. The signal
+ * is only emitted periodically while there's at least one consumer,
+ * at the shortest of the requested intervals. Registering the same
+ * consumer again updates its interval.
  *
- * @param data A pointer to the LastfmTrack being played
- * @return TRUE if the track hasn't fininished yet, FALSE otherwise
+ * @param owner An identifier of the consumer (e.g. the object that
+ *              displays the progress)
+ * @param interval The interval between updates, in seconds
  */
+void
+controller_add_progress_interest        (gpointer owner,
+                                         guint    interval)
+{
+        g_return_if_fail (owner != NULL && interval > 0);
+        if (progress_interests == NULL) {
+                progress_interests = g_hash_table_new (NULL, NULL);
+        }
+        g_hash_table_insert (progress_interests, owner,
+                             GUINT_TO_POINTER (interval));
+        controller_progress_reschedule ();
+        /* The new consumer gets an update right away */
+        if (progress_running && display_on) {
+                controller_emit_progress ();
+        }
+}
+
+/**
+ * Unregister a consumer of the 'playback-progress' signal, see
+ * controller_add_progress_interest()
+ *
+ * @param owner The identifier of the consumer
+ */
+void
+controller_remove_progress_interest     (gpointer owner)
+{
+        if (progress_interests != NULL &&
+            g_hash_table_remove (progress_interests, owner)) {
+                controller_progress_reschedule ();
+        }
+}
+
 static gboolean
-controller_update_progress              (gpointer data)
-{
-        LastfmTrack *tr = (LastfmTrack *) data;
-        g_return_val_if_fail(VGL_IS_MAIN_WINDOW(mainwin) && tr, FALSE);
-        if (nowplaying != NULL && tr->id == nowplaying->id) {
-                guint played = lastfm_audio_get_running_time();
-                if (played != -1) {
-                        guint length = nowplaying->duration/1000;
-                        g_signal_emit (vgl_controller,
-                                       signals[PLAYBACK_PROGRESS], 0,
-                                       played, length);
-                }
-                return TRUE;
-        } else {
-                vgl_object_unref(tr);
-                return FALSE;
+controller_prefetch_timeout             (gpointer data)
+{
+        prefetch_id = 0;
+        controller_prefetch_next_track ();
+        return FALSE;
+}
+
+/**
+ * Start reporting the progress of the track that has just started,
+ * and schedule the prefetching of the next one
+ */
+static void
+controller_progress_start               (void)
+{
+        progress_running = TRUE;
+        controller_progress_reschedule ();
+        controller_emit_progress ();
+
+        if (prefetch_id != 0) g_source_remove (prefetch_id);
+        prefetch_id = 0;
+        /* Without a duration there's no way to tell when the track is
+         * about to end (it's (guint) -1 if the playlist had none), so
+         * the next one is not prefetched */
+        if (usercfg->prefetch_window > 0 && nowplaying->duration > 0 &&
+            nowplaying->duration < G_MAXUINT) {
+                int played = MAX (lastfm_audio_get_running_time (), 0);
+                glong left = nowplaying->duration/1000 - played;
+                glong delay = MAX (left - usercfg->prefetch_window, 0);
+                prefetch_id = gdk_threads_add_timeout_seconds (
+                        delay, controller_prefetch_timeout, NULL);
+        }
+}
+
+/**
+ * Stop reporting the progress of the current track
+ */
+static void
+controller_progress_stop                (void)
+{
+        progress_running = FALSE;
+        controller_progress_reschedule ();
+        if (prefetch_id != 0) {
+                g_source_remove (prefetch_id);
+                prefetch_id = 0;
+        }
+}
+
+#ifdef MAEMO
+static gboolean
+controller_display_idle                 (gpointer data)
+{
+        display_on = GPOINTER_TO_INT (data);
+        controller_progress_reschedule ();
+        if (display_on && progress_running) {
+                controller_emit_progress ();
         }
+        return FALSE;
 }
 
+/**
+ * Suspend the progress updates while the display is off
+ */
+static void
+controller_display_event_cb             (osso_display_state_t state,
+                                         gpointer             data)
+{
+        gboolean on = (state != OSSO_DISPLAY_OFF);
+        gdk_threads_add_idle (controller_display_idle, GINT_TO_POINTER (on));
+}
+#endif /* MAEMO */
+
 /**
  * Gets the list of friends
  * @return The list
@@ -415,9 +626,82 @@ apply_usercfg                           (void)
         } else {
                 http_set_proxy (NULL, FALSE);
         }
+        lastfm_audio_set_prefetch_limit (usercfg->prefetch_max_kb * 1024);
+        lastfm_audio_set_buffering (usercfg->buffer_preroll_kb * 1024,
+                                    usercfg->buffer_low_kb * 1024,
+                                    usercfg->buffer_high_kb * 1024);
+        lastfm_audio_set_keep_warm (usercfg->keep_pipeline_warm);
+        stream_cache_set_limit ((guint64) usercfg->stream_cache_mb *
+                                1024 * 1024);
+        lastfm_audio_set_elements (usercfg->audio_decoder,
+                                   usercfg->audio_sink);
         g_signal_emit (vgl_controller, signals[USERCFG_CHANGED], 0, usercfg);
 }
 
+static gboolean
+calibrate_audio_idle                    (gpointer userdata)
+{
+        CalibrateAudioData *d = userdata;
+        calibrating_audio = FALSE;
+        if (d->cancelled) {
+                /* Try again after this playback, see
+                 * controller_stop_playing() */
+                g_debug ("Audio calibration interrupted");
+                calibration_pending = TRUE;
+        } else if (usercfg != NULL) {
+                if (d->success) {
+                        vgl_user_cfg_set_audio_decoder (usercfg, d->decoder);
+                        vgl_user_cfg_set_audio_sink (usercfg, d->sink);
+                }
+                /* Don't try again if nothing could be measured */
+                usercfg->audio_calibrated = TRUE;
+                vgl_user_cfg_write (usercfg);
+                apply_usercfg ();
+        }
+        g_free (d->decoder);
+        g_free (d->sink);
+        g_slice_free (CalibrateAudioData, d);
+        return FALSE;
+}
+
+static gpointer
+calibrate_audio_thread                  (gpointer userdata)
+{
+        CalibrateAudioData *d = g_slice_new0 (CalibrateAudioData);
+        d->success = lastfm_audio_calibrate (&(d->decoder), &(d->sink),
+                                             &calibration_cancel);
+        d->cancelled = g_atomic_int_get (&calibration_cancel);
+        gdk_threads_add_idle (calibrate_audio_idle, d);
+        return NULL;
+}
+
+/**
+ * Measure the decoder and sink that use less CPU in background if
+ * it hasn't been done yet (the first time the program runs, or when
+ * the user asks for it in the settings dialog). The result is stored
+ * in the user settings. The audio system must have been initialized.
+ *
+ * The CPU time of the whole process is measured and the sinks open
+ * the audio device, so this is only done while the player is stopped.
+ * Otherwise it's deferred until controller_stop_playing().
+ */
+static void
+check_audio_calibration                 (void)
+{
+        if (usercfg == NULL || usercfg->audio_calibrated ||
+            calibrating_audio) return;
+        if (nowplaying != NULL || playlist_waiting) {
+                calibration_pending = TRUE;
+                return;
+        }
+        calibration_pending = FALSE;
+        calibrating_audio = TRUE;
+        g_atomic_int_set (&calibration_cancel, 0);
+        /* Don't keep the audio device busy */
+        lastfm_audio_release ();
+        g_thread_create (calibrate_audio_thread, NULL, FALSE, NULL);
+}
+
 /**
  * Open the user settings dialog and save the new settings to the
  * configuration file. If the username or password have been modified,
@@ -449,6 +733,7 @@ controller_open_usercfg                 (void)
                 srvchanged = oldsrv != usercfg->server;
                 bitratechanged = oldbitrate != usercfg->low_bitrate;
                 apply_usercfg();
+                check_audio_calibration();
         }
         if (userchanged || pwchanged || srvchanged || bitratechanged) {
                 if (userchanged || srvchanged) {
@@ -561,6 +846,7 @@ check_session_idle                      (gpointer userdata)
         }
 
         /* Call the callback */
+        if (success) latency_trace_mark (LATENCY_STAGE_SESSION);
         if (success && data->success_cb != NULL) {
                 (*(data->success_cb)) (data->cbdata);
         } else if (!success && data->failure_cb != NULL) {
@@ -632,6 +918,7 @@ check_session                           (check_session_cb success_cb,
 {
         /* Then the actual streaming session */
         if (session != NULL) {
+                latency_trace_mark (LATENCY_STAGE_SESSION);
                 if (success_cb != NULL) (*success_cb)(cbdata);
         } else {
                 check_usercfg (TRUE);
@@ -662,64 +949,69 @@ check_session                           (check_session_cb success_cb,
 }
 
 /**
- * Set the album cover image.
- * @param data A pointer to the LastfmTrack
- * @return FALSE (to remove the idle handler)
+ * Set the album cover image once it has been downloaded.
+ * @param track The track whose cover has been downloaded
+ * @param data Not used
  */
-static gboolean
-set_album_cover_idle                    (gpointer data)
+static void
+set_album_cover_cb                      (LastfmTrack *track,
+                                         gpointer     data)
 {
-        LastfmTrack *track = data;
+        if (track->image_data == NULL) {
+                g_warning ("Error getting cover image");
+        }
         if (mainwin && nowplaying == track) {
                 vgl_main_window_set_album_cover (mainwin,
                                                  track->image_data,
                                                  track->image_data_size);
         }
-        return FALSE;
 }
 
 /**
- * Retrieve the album cover image. This must be done in a thread to
- * avoid freezing the UI.
- * @param data A pointer to the LastfmTrack
- * @return NULL (not used)
- */
-static gpointer
-set_album_cover_thread                  (gpointer data)
-{
-        LastfmTrack *track = data;
-        g_return_val_if_fail (track != NULL && track->image_url != NULL, NULL);
-
-        lastfm_get_track_cover_image (track);
-        if (track->image_data == NULL) {
-                g_warning ("Error getting cover image");
-        }
-
-        gdk_threads_add_idle_full (G_PRIORITY_DEFAULT, set_album_cover_idle,
-                                   track, vgl_object_unref);
-        return NULL;
-}
-
-/**
- * Get a new playlist and append it to the end of the current
- * one. Show an error if no playlist is found, start playing
- * otherwise.
+ * Add the tracks of a new playlist to the current one, and play the
+ * next track if the player was waiting for them. If the request was
+ * a background refill, errors are ignored: the playlist will be
+ * requested again when needed.
  *
- * @param data A pointer to the new playlist, or NULL
+ * @param data A pointer to a GetPlaylistData struct
  * @return FALSE (to remove the idle handler)
  */
 static gboolean
 start_playing_get_pls_idle              (gpointer data)
 {
-        LastfmPls *pls = data;
-        if (pls == NULL) {
-                controller_stop_playing ();
-                controller_show_info (_("No more content to play"));
-        } else {
-                lastfm_pls_merge (playlist, pls);
-                lastfm_pls_destroy (pls);
-                controller_start_playing ();
+        GetPlaylistData *d = data;
+        gboolean waiting = playlist_waiting;
+
+        /* Discard the tracks if the playlist has been cleared since
+         * the request was made */
+        if (d->generation == playlist_generation) {
+                playlist_request_running = FALSE;
+                playlist_waiting = FALSE;
+                if (d->pls != NULL) {
+                        lastfm_pls_merge (playlist, d->pls);
+                }
+                if (!waiting) {
+                        if (d->pls == NULL) {
+                                g_debug ("Error refilling the playlist");
+                        }
+                } else {
+                        /* The player is waiting for it, even if the
+                         * request started as a background refill */
+                        latency_trace_mark (LATENCY_STAGE_PLAYLIST);
+                        if (d->pls == NULL) {
+                                controller_stop_playing ();
+                                controller_show_info (
+                                        _("No more content to play"));
+                        } else {
+                                controller_start_playing ();
+                        }
+                }
+        }
+
+        if (d->pls != NULL) {
+                lastfm_pls_destroy (d->pls);
         }
+        g_slice_free (GetPlaylistData, d);
         return FALSE;
 }
 
@@ -727,30 +1019,76 @@ start_playing_get_pls_idle              (gpointer data)
  * Get a new playlist. This can take a bit, so it is done in a
  * separate thread to avoid freezing the UI.
  *
- * @param data A pointer to the LastfmWsSession used to get the new
- *             playlist.
+ * @param data A pointer to a GetPlaylistData struct
  * @return NULL (not used)
  */
 static gpointer
 start_playing_get_pls_thread            (gpointer data)
 {
         GetPlaylistData *d = data;
-        LastfmPls *pls;
         g_return_val_if_fail (d != NULL && d->session != NULL, NULL);
 
-        pls = lastfm_ws_radio_get_playlist (d->session, d->discovery,
-                                            d->lowbitrate, TRUE);
-        gdk_threads_add_idle (start_playing_get_pls_idle, pls);
+        d->pls = lastfm_ws_radio_get_playlist (d->session, d->discovery,
+                                               d->lowbitrate, TRUE);
 
         vgl_object_unref (d->session);
-        g_slice_free (GetPlaylistData, d);
+        d->session = NULL;
+        gdk_threads_add_idle (start_playing_get_pls_idle, d);
 
         return NULL;
 }
 
+/**
+ * Request a new playlist in a separate thread, unless there's one
+ * request running already. The tracks are added to the current
+ * playlist in start_playing_get_pls_idle()
+ */
+static void
+controller_request_playlist             (void)
+{
+        GetPlaylistData *data;
+        g_return_if_fail (session != NULL && usercfg != NULL);
+        if (playlist_request_running) return;
+
+        playlist_request_running = TRUE;
+        data = g_slice_new0 (GetPlaylistData);
+        data->session = vgl_object_ref (session);
+        data->discovery = usercfg->discovery_mode;
+        data->lowbitrate = usercfg->low_bitrate;
+        data->generation = playlist_generation;
+        g_thread_create (start_playing_get_pls_thread, data, FALSE, NULL);
+}
+
+/**
+ * Refill the playlist in background if it has less tracks than the
+ * low watermark set by the user, so the next track doesn't have to
+ * wait for the whole request
+ */
+static void
+controller_check_playlist_level         (void)
+{
+        if (session != NULL && usercfg != NULL &&
+            lastfm_pls_size (playlist) < usercfg->playlist_low_watermark) {
+                controller_request_playlist ();
+        }
+}
+
+/**
+ * Discard all tracks from the playlist, and the results of the
+ * requests that are still running
+ */
+static void
+controller_clear_playlist               (void)
+{
+        lastfm_pls_clear (playlist);
+        playlist_generation++;
+        playlist_request_running = FALSE;
+        playlist_waiting = FALSE;
+}
+
 /**
  * Download the cover of the track being played and show it in the
- * main window. This will create a thread to avoid freezing the UI.
+ * main window. The download is asynchronous to avoid freezing the UI.
  * If the window is not visible or if the cover is already displayed
  * (or about to be displayed) this will do nothing so this function
  * can be called several times.
@@ -763,8 +1101,8 @@ controller_show_cover                   (void)
             vgl_main_window_is_hidden(mainwin)) return;
         showing_cover = TRUE;
         if (nowplaying->image_url != NULL && nowplaying->image_data == NULL) {
-                g_thread_create (set_album_cover_thread,
-                                 vgl_object_ref (nowplaying), FALSE, NULL);
+                lastfm_get_track_cover_image_async (nowplaying,
+                                                    set_album_cover_cb, NULL);
         } else {
                 vgl_main_window_set_album_cover (mainwin,
                                                  nowplaying->image_data,
@@ -780,14 +1118,13 @@ static void
 controller_audio_started_cb             (void)
 {
         g_return_if_fail(VGL_IS_MAIN_WINDOW(mainwin) && nowplaying);
-        LastfmTrack *track;
+        latency_trace_end ();
         vgl_main_window_set_state (mainwin, VGL_MAIN_WINDOW_STATE_PLAYING,
                                    nowplaying, current_radio_url);
-        track = vgl_object_ref (nowplaying);
-        controller_update_progress (track);
+        controller_progress_start ();
+        controller_check_playlist_level ();
         showing_cover = FALSE;
         controller_show_cover();
-        gdk_threads_add_timeout_seconds (1, controller_update_progress, track);
         g_signal_emit (vgl_controller, signals[TRACK_STARTED], 0, nowplaying);
 }
 
@@ -804,30 +1141,36 @@ controller_start_playing_cb             (gpointer userdata)
 {
         LastfmTrack *track = NULL;
         LastfmSession *v1session;
+        char *key;
         g_return_if_fail(mainwin && playlist && nowplaying == NULL);
         vgl_main_window_set_state (mainwin, VGL_MAIN_WINDOW_STATE_CONNECTING,
                                    NULL, NULL);
+        if (calibrating_audio) {
+                g_atomic_int_set (&calibration_cancel, 1);
+        }
         if (lastfm_pls_size(playlist) == 0) {
-                GetPlaylistData *data = g_slice_new (GetPlaylistData);
-                data->session = vgl_object_ref (session);
-                data->discovery = usercfg->discovery_mode;
-                data->lowbitrate = usercfg->low_bitrate;
-                g_thread_create (start_playing_get_pls_thread,
-                                 data, FALSE, NULL);
+                /* Wait for the request, it may be running already */
+                playlist_waiting = TRUE;
+                controller_request_playlist ();
                 return;
         }
         track = lastfm_pls_get_track(playlist);
         controller_set_nowplaying(track);
 
-        if (usercfg->autodl_free_tracks) {
+        /* If the stream is being cached, the track is downloaded
+         * when it finishes (see finish_playing_track()) so it can
+         * be copied from the cache */
+        if (usercfg->autodl_free_tracks && !stream_cache_is_enabled ()) {
                 controller_download_track (TRUE);
         }
 
         v1session = lastfm_ws_session_get_v1_session (session);
 
+        key = controller_track_cache_key (track);
         lastfm_audio_play(track->stream_url,
                           (GCallback) controller_audio_started_cb,
-                          v1session ? v1session->id : NULL);
+                          v1session ? v1session->id : NULL, key);
+        g_free (key);
 }
 
 /**
@@ -858,6 +1201,13 @@ finish_playing_track                    (void)
 {
         if (nowplaying != NULL) {
                 RspRating rating = nowplaying_rating;
+                /* Deferred download, see controller_start_playing_cb() */
+                if (!shutting_down && usercfg->autodl_free_tracks &&
+                    nowplaying->free_track_url != NULL &&
+                    stream_cache_is_enabled ()) {
+                        controller_download_track (TRUE);
+                }
+                controller_progress_stop ();
                 controller_set_nowplaying(NULL);
                 lastfm_audio_stop ();
                 g_signal_emit (vgl_controller, signals[TRACK_STOPPED], 0,
@@ -883,6 +1233,12 @@ controller_stop_playing                 (void)
 
         finish_playing_track();
         stop_after_this_track = FALSE;
+        playlist_waiting = FALSE;
+        latency_trace_cancel ();
+
+        if (calibration_pending && !shutting_down) {
+                check_audio_calibration ();
+        }
 
         g_signal_emit (vgl_controller, signals[PLAYER_STOPPED], 0);
 }
@@ -894,6 +1250,7 @@ void
 controller_skip_track                   (void)
 {
         g_return_if_fail(VGL_IS_MAIN_WINDOW(mainwin));
+        latency_trace_begin ("skip");
         finish_playing_track();
         controller_start_playing();
 }
@@ -909,7 +1266,7 @@ controller_disconnect                   (void)
                 vgl_object_unref (session);
                 session = NULL;
         }
-        lastfm_pls_clear(playlist);
+        controller_clear_playlist();
         controller_stop_playing();
         g_signal_emit (vgl_controller, signals[DISCONNECTED], 0);
 }
@@ -936,16 +1293,24 @@ static gpointer
 download_track_thread                   (gpointer userdata)
 {
         DownloadData *d = (DownloadData *) userdata;
-        gboolean success;
+        gboolean success = FALSE;
         char *text;
 
-        success = http_download_file (d->track->free_track_url, d->dstpath,
-                                      NULL, NULL);
+        if (d->cache_key != NULL) {
+                success = stream_cache_copy (d->cache_key,
+                                             d->track->free_track_url,
+                                             d->dstpath);
+        }
+        if (!success) {
+                success = http_download_file (d->track->free_track_url,
+                                              d->dstpath, NULL, NULL);
+        }
         if (success) {
                 text = g_strdup_printf (_("Downloaded %s - %s"),
                                         d->track->artist, d->track->title);
         } else {
-                g_unlink (d->dstpath);
+                /* The partial file is kept, so the download will
+                 * be resumed if it's tried again */
                 text = g_strdup_printf (_("Error downloading %s - %s"),
                                         d->track->artist, d->track->title);
         }
@@ -956,6 +1321,7 @@ download_track_thread                   (gpointer userdata)
 
         vgl_object_unref (d->track);
         g_free (d->dstpath);
+        g_free (d->cache_key);
         g_slice_free (DownloadData, d);
 
         return NULL;
@@ -1017,6 +1383,8 @@ controller_download_track               (gboolean background)
                                 dldata = g_slice_new (DownloadData);
                                 dldata->track = vgl_object_ref (t);
                                 dldata->dstpath = g_strdup (dstpath);
+                                dldata->cache_key =
+                                        controller_track_cache_key (t);
                                 g_thread_create (download_track_thread,
                                                  dldata, FALSE, NULL);
                                 banner = g_strdup_printf (
@@ -1025,10 +1393,12 @@ controller_download_track               (gboolean background)
                                 controller_show_banner (banner);
                                 g_free (banner);
                         } else {
+                                char *key = controller_track_cache_key (t);
                                 dlwin_download_file (t->free_track_url,
-                                                     filename, dstpath,
+                                                     filename, dstpath, key,
                                                      download_track_dlwin_cb,
                                                      vgl_object_ref (t));
+                                g_free (key);
                         }
                 }
                 g_free(filename);
@@ -1192,43 +1562,20 @@ controller_ban_track                    (gboolean interactive)
 }
 
 /**
- * Tag a track. This can take some seconds, so it must be called using
- * g_thread_create() to avoid freezing the UI.
+ * Show the result of tagging a track.
  *
- * @param data Pointer to TagData, with info about the track to be
- *             tagged. This data must be freed here
- * @return NULL (this value is not used)
+ * @param tagged Whether the track was tagged or not
+ * @param data Not used
  */
-static gpointer
-tag_track_thread                        (gpointer data)
+static void
+tag_track_cb                            (gboolean tagged,
+                                         gpointer data)
 {
-        TagData *d = (TagData *) data;
-        const char *text;
-        gboolean tagged;
-        GSList *list = NULL;
-        char **tags;
-        int i;
-
-        g_return_val_if_fail (d && d->track && d->taglist, NULL);
-
-        tags = g_strsplit(d->taglist, ",", 0);
-        for (i = 0; tags[i] != NULL; i++) {
-                list = g_slist_append(list, g_strstrip(tags[i]));
+        if (mainwin) {
+                controller_show_banner (tagged ?
+                                        _("Tags set correctly") :
+                                        _("Error tagging"));
         }
-        tagged = lastfm_ws_tag_track (d->session, d->track, d->type, list);
-
-        /* Cleanup */
-        g_strfreev(tags);
-        g_slist_free(list);
-        vgl_object_unref(d->session);
-        vgl_object_unref(d->track);
-        g_free(d->taglist);
-        g_slice_free(TagData, d);
-
-        text = tagged ? _("Tags set correctly") : _("Error tagging");
-        gdk_threads_add_idle (show_banner_idle, (char *) text);
-
-        return NULL;
 }
 
 /**
@@ -1258,57 +1605,42 @@ controller_tag_track                    (void)
                             usercfg->username, &tags,
                             usertags, sess, track, &type);
         if (accept) {
-                TagData *d = g_slice_new (TagData);
-                if (tags == NULL) {
-                        tags = g_strdup("");
+                GSList *list = NULL;
+                char **taglist;
+                int i;
+                taglist = g_strsplit(tags ? tags : "", ",", 0);
+                for (i = 0; taglist[i] != NULL; i++) {
+                        list = g_slist_append(list, g_strstrip(taglist[i]));
                 }
-                d->session = sess;
-                d->track = track;
-                d->taglist = tags;
-                d->type = type;
-                g_thread_create(tag_track_thread,d,FALSE,NULL);
+                lastfm_ws_tag_track_async (sess, track, type, list,
+                                           tag_track_cb, NULL);
+                g_strfreev(taglist);
+                g_slist_free(list);
         } else {
                 if (accept) {
                         controller_show_info(_("You must type a list of tags"));
                 }
-                vgl_object_unref(sess);
-                vgl_object_unref(track);
         }
+        vgl_object_unref(sess);
+        vgl_object_unref(track);
+        g_free(tags);
 }
 
 /**
- * Recommend a track. This can take some seconds, so it must be called
- * using g_thread_create() to avoid freezing the UI.
+ * Show the result of recommending a track.
  *
- * @param data Pointer to RecommData, with info about the track to be
- *             recommended. This data must be freed here
- * @return NULL (this value is not used)
+ * @param sent Whether the recommendation was sent or not
+ * @param data Not used
  */
-static gpointer
-recomm_track_thread                     (gpointer data)
+static void
+recomm_track_cb                         (gboolean sent,
+                                         gpointer data)
 {
-        RecommData *d = (RecommData *) data;
-        const char *text;
-        gboolean retval;
-
-        g_return_val_if_fail (d && d->session && d->track &&
-                              d->rcpt && d->text, NULL);
-
-        retval = lastfm_ws_share_track (d->session, d->track, d->text,
-                                        d->type, d->rcpt);
-
-        text = retval ?
-                _("Recommendation sent") :
-                _("Error sending recommendation");
-        gdk_threads_add_idle (show_banner_idle, (char *) text);
-
-        vgl_object_unref(d->track);
-        vgl_object_unref(d->session);
-        g_free(d->rcpt);
-        g_free(d->text);
-        g_slice_free(RecommData, d);
-
-        return NULL;
+        if (mainwin) {
+                controller_show_banner (sent ?
+                                        _("Recommendation sent") :
+                                        _("Error sending recommendation"));
+        }
 }
 
 /**
@@ -1334,69 +1666,37 @@ controller_recomm_track                 (void)
                                &rcpt, &body, friends, track, &type);
         if (accept && rcpt && body && rcpt[0] && body[0]) {
                 g_strstrip(rcpt);
-                RecommData *d = g_slice_new (RecommData);
-                d->session = sess;
-                d->track = track;
-                d->rcpt = rcpt;
-                d->text = body;
-                d->type = type;
-                g_thread_create(recomm_track_thread,d,FALSE,NULL);
+                lastfm_ws_share_track_async (sess, track, body, type, rcpt,
+                                             recomm_track_cb, NULL);
         } else {
                 if (accept) {
                         controller_show_info(_("You must type a user name\n"
                                                "and a recommendation message."));
                 }
-                vgl_object_unref(track);
-                vgl_object_unref(sess);
-                g_free(rcpt);
-                g_free(body);
         }
+        vgl_object_unref(track);
+        vgl_object_unref(sess);
+        g_free(rcpt);
+        g_free(body);
 }
 
 /**
- * Idle handler to update the UI after adding a track to the user's
- * playlist.
+ * Update the UI after adding a track to the user's playlist.
  *
- * @param data Boolean to tell whether the track was added or not
- * @return FALSE (to remove the idle handler)
+ * @param added Whether the track was added or not
+ * @param data Not used
  */
-static gboolean
-add_to_playlist_idle                    (gpointer data)
+static void
+add_to_playlist_cb                      (gboolean added,
+                                         gpointer data)
 {
         if (mainwin) {
-                gboolean added = GPOINTER_TO_INT (data);
                 controller_show_banner (added ?
                                         _("Track added to playlist") :
                                         _("Error adding track to playlist"));
                 vgl_main_window_set_track_as_added_to_playlist (mainwin,
                                                                 added);
         }
-        return FALSE;
-}
-
-/**
- * Add a track to the user's playlist. This can take some seconds, so
- * it must be called using g_thread_create() to avoid freezing the UI.
- *
- * @param data Pointer to an AddToPlaylistData structure.
- * @return NULL (this value is not used)
- */
-static gpointer
-add_to_playlist_thread                  (gpointer data)
-{
-        AddToPlaylistData *d = (AddToPlaylistData *) data;
-        gboolean added;
-
-        g_return_val_if_fail (d && d->session && d->track, NULL);
-
-        added = lastfm_ws_add_to_playlist (d->session, d->track);
-        gdk_threads_add_idle (add_to_playlist_idle, GINT_TO_POINTER (added));
-
-        vgl_object_unref (d->session);
-        vgl_object_unref (d->track);
-        g_slice_free (AddToPlaylistData, d);
-
-        return NULL;
 }
 
 /**
@@ -1416,15 +1716,13 @@ controller_add_to_playlist              (void)
 
         if (controller_confirm_dialog(
                     _("Really add this track to the playlist?"), FALSE)) {
-                AddToPlaylistData *data = g_slice_new (AddToPlaylistData);
-                data->session = session;
-                data->track = track;
                 vgl_main_window_set_track_as_added_to_playlist (mainwin, TRUE);
-                g_thread_create (add_to_playlist_thread, data, FALSE, NULL);
-        } else {
-                vgl_object_unref (track);
-                vgl_object_unref (sess);
+                lastfm_ws_add_to_playlist_async (sess, track,
+                                                 add_to_playlist_cb, NULL);
         }
+
+        vgl_object_unref (track);
+        vgl_object_unref (sess);
 }
 
 /**
@@ -1443,8 +1741,12 @@ controller_play_radio_by_url_idle       (gpointer data)
         case LASTFM_OK:
                 g_free (current_radio_url);
                 current_radio_url = d->url;
-                lastfm_pls_clear (playlist);
-                controller_skip_track ();
+                controller_clear_playlist ();
+                latency_trace_mark (LATENCY_STAGE_TUNE);
+                /* Not controller_skip_track(), that would start a
+                 * new latency trace */
+                finish_playing_track ();
+                controller_start_playing ();
                 break;
         case LASTFM_GEO_RESTRICTED:
                 error_msg = _("This radio is not available\n"
@@ -1507,6 +1809,10 @@ controller_play_radio_by_url_cb         (char *url)
                 controller_stop_playing ();
         } else {
                 PlayRadioByUrlData *data = g_slice_new (PlayRadioByUrlData);
+                /* Refills made while tuning may get tracks from
+                 * either station, so don't use them */
+                playlist_generation++;
+                playlist_request_running = FALSE;
                 data->session = vgl_object_ref (session);
                 data->url = url;
                 g_thread_create (controller_play_radio_by_url_thread,
@@ -1526,6 +1832,7 @@ void
 controller_play_radio_by_url            (const char *url)
 {
         check_session_cb cb;
+        latency_trace_begin ("station");
         finish_playing_track();
         vgl_main_window_set_state (mainwin, VGL_MAIN_WINDOW_STATE_CONNECTING,
                                    NULL, NULL);
@@ -1921,6 +2228,10 @@ controller_run_app                      (const char *radio_url)
                 return;
         }
 
+        if (!errmsg) {
+                check_audio_calibration();
+        }
+
 #ifdef MAEMO
         /* Initialize osso context */
         if (!errmsg) {
@@ -1928,6 +2239,10 @@ controller_run_app                      (const char *radio_url)
                                                 APP_VERSION, FALSE, NULL);
                 if (!osso_context) {
                         errmsg = _("Unable to initialize OSSO context");
+                } else {
+                        osso_hw_set_display_event_cb (
+                                osso_context, controller_display_event_cb,
+                                NULL);
                 }
         }
 #endif
@@ -1963,6 +2278,8 @@ controller_run_app                      (const char *radio_url)
                 usercfg = NULL;
         }
         lastfm_audio_clear();
+        stream_cache_flush();
+        http_cleanup();
         vgl_server_list_finalize ();
         vgl_bookmark_mgr_save_to_disk (vgl_bookmark_mgr_get_instance (), FALSE);
 
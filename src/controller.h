@@ -180,6 +180,13 @@ controller_set_volume                   (int vol);
 void
 controller_show_cover                   (void);
 
+void
+controller_add_progress_interest        (gpointer owner,
+                                         guint    interval);
+
+void
+controller_remove_progress_interest     (gpointer owner);
+
 LastfmTrack *
 controller_get_current_track            (void);
 
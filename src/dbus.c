@@ -10,6 +10,9 @@
  */
 
 #include "dbus.h"
+#include "httpstats.h"
+#include "latency.h"
+#include "strpool.h"
 #include "compat.h"
 
 #include <glib/gi18n.h>
@@ -316,6 +319,7 @@ dbus_req_handler                        (DBusConnection *connection,
                                          gpointer        user_data)
 {
         DBusHandlerResult result = DBUS_HANDLER_RESULT_HANDLED;
+        char *stats = NULL;
 
         /* Check calls to Vagalume D-Bus methods */
         if (dbus_message_is_method_call(message, APP_DBUS_IFACE,
@@ -395,6 +399,16 @@ dbus_req_handler                        (DBusConnection *connection,
         } else if (dbus_message_is_method_call(message, APP_DBUS_IFACE,
                                                APP_DBUS_METHOD_REQUEST_STATUS)) {
                 gdk_threads_add_idle (requeststatus_handler_idle, NULL);
+        } else if (dbus_message_is_method_call(message, APP_DBUS_IFACE,
+                                               APP_DBUS_METHOD_REQUEST_STATS)) {
+                /* The statistics are returned in the reply */
+                char *http = http_stats_dump ();
+                char *latency = latency_dump ();
+                char *strpool = str_pool_dump ();
+                stats = g_strconcat (http, latency, strpool, NULL);
+                g_free (http);
+                g_free (latency);
+                g_free (strpool);
         } else {
                 result = DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
         }
@@ -424,9 +438,15 @@ dbus_req_handler                        (DBusConnection *connection,
         if (result == DBUS_HANDLER_RESULT_HANDLED &&
             !dbus_message_get_no_reply(message)) {
                 DBusMessage *reply  = dbus_message_new_method_return(message);
+                if (stats != NULL) {
+                        dbus_message_append_args (reply,
+                                                  DBUS_TYPE_STRING, &stats,
+                                                  DBUS_TYPE_INVALID);
+                }
                 dbus_connection_send(connection, reply, NULL);
                 dbus_message_unref(reply);
         }
+        g_free (stats);
 
         return result;
 }
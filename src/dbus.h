@@ -35,6 +35,7 @@
 #define APP_DBUS_METHOD_SETVOLUME "SetVolume"
 #define APP_DBUS_METHOD_TOPAPP "top_application"
 #define APP_DBUS_METHOD_REQUEST_STATUS "request_status"
+#define APP_DBUS_METHOD_REQUEST_STATS "request_stats"
 
 /* D-Bus signals */
 #define APP_DBUS_SIGNAL_NOTIFY "notify"
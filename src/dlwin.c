@@ -12,6 +12,7 @@
 #include "globaldefs.h"
 #include "dlwin.h"
 #include "http.h"
+#include "streamcache.h"
 #include "vgl-object.h"
 #include "compat.h"
 
@@ -27,6 +28,7 @@ typedef struct {
         GtkProgressBar *progressbar;
         char *url;
         char *dstpath;
+        char *cache_key;
         double dlnow;
         double dltotal;
         gboolean win_needs_update;
@@ -75,6 +77,7 @@ dlwin_destroy                           (gpointer data)
         dlwin *w = data;
         g_free (w->url);
         g_free (w->dstpath);
+        g_free (w->cache_key);
 }
 
 static gboolean
@@ -109,14 +112,16 @@ dlwin_download_file_thread              (gpointer data)
 {
         dlwin *w = (dlwin *) data;
 
-        /* Remove the file if it exists and then download it */
+        /* Remove the file if it exists and then download it. If
+         * the download fails the partial file is kept and will be
+         * resumed next time */
         g_unlink (w->dstpath);
-        w->success = http_download_file (w->url, w->dstpath,
-                                         dlwin_progress_cb, w);
-
-        /* Remove if the download was unsuccessful */
-        if (!w->success)
-                g_unlink (w->dstpath);
+        w->success = w->cache_key != NULL &&
+                stream_cache_copy (w->cache_key, w->url, w->dstpath);
+        if (!w->success) {
+                w->success = http_download_file (w->url, w->dstpath,
+                                                 dlwin_progress_cb, w);
+        }
 
         gdk_threads_add_idle (dlwin_download_file_idle, w);
 
@@ -127,6 +132,7 @@ void
 dlwin_download_file                     (const char *url,
                                          const char *filename,
                                          const char *dstpath,
+                                         const char *cache_key,
                                          dlwin_cb    cb,
                                          gpointer    cbdata)
 {
@@ -141,6 +147,7 @@ dlwin_download_file                     (const char *url,
         w = vgl_object_new (dlwin, dlwin_destroy);
         w->url = g_strdup(url);
         w->dstpath = g_strdup(dstpath);
+        w->cache_key = g_strdup(cache_key);
         w->dlnow = 0.0;
         w->dltotal = 0.0;
         w->success = FALSE;
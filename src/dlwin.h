@@ -19,6 +19,7 @@ void
 dlwin_download_file                     (const char *url,
                                          const char *filename,
                                          const char *dstpath,
+                                         const char *cache_key,
                                          dlwin_cb    cb,
                                          gpointer    cbdata);
 
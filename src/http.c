@@ -9,20 +9,36 @@
  */
 
 #include "http.h"
+#include "httpstats.h"
+#include "latency.h"
 #include "globaldefs.h"
 #include "util.h"
 #include "compat.h"
 #include <curl/curl.h>
+#include <glib/gstdio.h>
+#include <libxml/parser.h>
 #include <string.h>
+#include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <time.h>
 
 #ifdef HAVE_LIBPROXY
 #    include <proxy.h>
 
 static pxProxyFactory *proxy_factory = NULL;
 static gboolean use_global_proxy = FALSE;
+
+/* Proxies returned by libproxy, cached per host (the keys are the
+ * same as in the handle pool). Protected by proxy_lock */
+static GHashTable *proxy_cache = NULL;
+static const int proxy_cache_ttl = 300;
+
+typedef struct {
+        char *proxy;
+        time_t expires;
+} http_proxy_cache_entry;
 #endif
 
 static GStaticRWLock proxy_lock = G_STATIC_RW_LOCK_INIT;
@@ -31,15 +47,106 @@ static char *proxy_url = NULL;
 /* HTTP connections will abort after this time */
 static const int http_timeout = 20;
 
+/* Streams that don't receive data for this long are considered
+ * stalled, so they can be reconnected before the audio runs out.
+ * This must be clearly shorter than the prefetch window (10 seconds
+ * by default, see controller_progress_start()): a stall near the end
+ * of a track has to be detected, and the stream reconnected, before
+ * the next track starts to be downloaded */
+static const int http_stream_stall_timeout = 4;
+
+/* Idle curl handles are kept in a pool (one queue per host) so their
+ * connections can be reused. These are the maximum number of idle
+ * handles per host and the time (in seconds) after which an idle
+ * handle is discarded */
+static const guint http_pool_max_per_host = 4;
+static const int http_pool_idle_timeout = 60;
+
+static GStaticMutex pool_mutex = G_STATIC_MUTEX_INIT;
+static GHashTable *handle_pool = NULL;
+
+typedef struct {
+        CURL *handle;
+        time_t last_used;
+} http_pool_entry;
+
+/* DNS cache and TLS sessions are shared by all handles. libcurl
+ * needs a lock for each kind of shared data since handles are used
+ * from several threads. Connections are not shared: libcurl doesn't
+ * support sharing them between threads, and the handle pool already
+ * keeps them alive */
+static CURLSH *share_handle = NULL;
+static GStaticMutex share_locks[CURL_LOCK_DATA_LAST];
+
+/* Statistics about the connection reuse, updated atomically. libcurl
+ * doesn't tell whether a DNS lookup was served from the shared cache,
+ * so there are no statistics about that */
+static gint stats_requests = 0;
+static gint stats_conn_reused = 0;
+
+/* Bytes received for compressed-capable requests: as they came
+ * through the network and after decompression */
+static GStaticMutex transfer_stats_mutex = G_STATIC_MUTEX_INIT;
+static guint64 stats_wire_bytes = 0;
+static guint64 stats_decoded_bytes = 0;
+
+/* Tag of the next request made by each thread, used to group the
+ * timing statistics. See http_set_request_tag() */
+static GStaticPrivate request_tag = G_STATIC_PRIVATE_INIT;
+
+/* Buffers are preallocated using the Content-Length of the response,
+ * but never more than this (to protect against bogus headers) */
+static const gsize http_max_prealloc = 8 * 1024 * 1024;
+
+/* Growable buffer to store the body of a response. The GString is
+ * created when the first chunk arrives, and the handle is used to
+ * get its Content-Length */
 typedef struct {
-        char *buffer;
-        size_t size;
+        GString *str;
+        CURL *handle;
 } curl_buffer;
 
+/* Failed downloads are resumed this number of times, waiting a few
+ * seconds between attempts */
+static const int http_download_retries = 3;
+static const int http_download_retry_delay = 2;
+
+/* State of a download made with http_download_file(). The size and
+ * ETag of the file are saved in a separate file (infopath) so the
+ * download can be resumed later */
 typedef struct {
+        FILE *f;
+        char *infopath;
+        curl_off_t offset;
+        long status;
+        gint64 range_start;
+        gint64 total;
+        char *etag;
+        gint64 saved_total;
+        char *saved_etag;
+        gboolean checked;
         http_download_progress_cb cb;
         gpointer userdata;
-} http_dl_progress_wrapper_data;
+} http_download_data;
+
+/* Asynchronous requests are all driven by a single curl multi handle
+ * whose sockets and timeouts are watched from the GLib main loop */
+static CURLM *multi_handle = NULL;
+static guint multi_timeout_id = 0;
+static GSList *async_requests = NULL;
+
+typedef struct {
+        CURL *handle;
+        char *url;
+        char *postdata;
+        struct curl_slist *hdrs;
+        curl_buffer dstbuf;
+        http_request_cb cb;
+        gpointer userdata;
+        const char *tag;
+        gboolean cancelled; /* http_cleanup() was called while the
+                             * proxy was being resolved */
+} http_async_request;
 
 static void
 update_proxy_url                        (const char *proxy)
@@ -50,6 +157,27 @@ update_proxy_url                        (const char *proxy)
         }
 }
 
+#ifdef HAVE_LIBPROXY
+static void
+http_proxy_cache_entry_destroy          (http_proxy_cache_entry *entry)
+{
+        g_free (entry->proxy);
+        g_slice_free (http_proxy_cache_entry, entry);
+}
+#endif
+
+void
+http_invalidate_proxy_cache             (void)
+{
+#ifdef HAVE_LIBPROXY
+        g_static_rw_lock_writer_lock (&proxy_lock);
+        if (proxy_cache != NULL) {
+                g_hash_table_remove_all (proxy_cache);
+        }
+        g_static_rw_lock_writer_unlock (&proxy_lock);
+#endif
+}
+
 void
 http_set_proxy                          (const char *proxy,
                                          gboolean    use_system_proxy)
@@ -58,179 +186,1156 @@ http_set_proxy                          (const char *proxy,
 #ifdef HAVE_LIBPROXY
         use_global_proxy = use_system_proxy;
         if (!use_global_proxy) update_proxy_url (proxy);
+        if (proxy_cache != NULL) g_hash_table_remove_all (proxy_cache);
 #else
         update_proxy_url (proxy);
 #endif
         g_static_rw_lock_writer_unlock (&proxy_lock);
 }
 
+static void
+http_pool_queue_destroy                 (GQueue *queue)
+{
+        http_pool_entry *entry;
+        while ((entry = g_queue_pop_head (queue)) != NULL) {
+                curl_easy_cleanup (entry->handle);
+                g_slice_free (http_pool_entry, entry);
+        }
+        g_queue_free (queue);
+}
+
+static void
+http_share_lock                         (CURL              *handle,
+                                         curl_lock_data     data,
+                                         curl_lock_access   access,
+                                         void              *userp)
+{
+        g_static_mutex_lock (&share_locks[data]);
+}
+
+static void
+http_share_unlock                       (CURL              *handle,
+                                         curl_lock_data     data,
+                                         void              *userp)
+{
+        g_static_mutex_unlock (&share_locks[data]);
+}
+
 void
 http_init                               (void)
 {
+        int i;
         curl_global_init(CURL_GLOBAL_ALL);
 #ifdef HAVE_LIBPROXY
         proxy_factory = px_proxy_factory_new ();
+        proxy_cache = g_hash_table_new_full (
+                g_str_hash, g_str_equal, g_free,
+                (GDestroyNotify) http_proxy_cache_entry_destroy);
+#endif
+        for (i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+                g_static_mutex_init (&share_locks[i]);
+        }
+        share_handle = curl_share_init ();
+        curl_share_setopt (share_handle, CURLSHOPT_LOCKFUNC, http_share_lock);
+        curl_share_setopt (share_handle, CURLSHOPT_UNLOCKFUNC,
+                           http_share_unlock);
+        curl_share_setopt (share_handle, CURLSHOPT_SHARE,
+                           CURL_LOCK_DATA_DNS);
+#if LIBCURL_VERSION_NUM >= 0x071700
+        curl_share_setopt (share_handle, CURLSHOPT_SHARE,
+                           CURL_LOCK_DATA_SSL_SESSION);
+#endif
+        g_static_mutex_lock (&pool_mutex);
+        if (handle_pool == NULL) {
+                handle_pool = g_hash_table_new_full (
+                        g_str_hash, g_str_equal, g_free,
+                        (GDestroyNotify) http_pool_queue_destroy);
+        }
+        g_static_mutex_unlock (&pool_mutex);
+}
+
+char *
+escape_url                              (const char *url,
+                                         gboolean    escape)
+{
+        g_return_val_if_fail(url != NULL, NULL);
+        GString *str = g_string_sized_new(strlen(url) * (escape ? 3 : 1));
+        if (escape) {
+                url_escape_gstr(str, url);
+        } else {
+                url_unescape_gstr(str, url);
+        }
+        return g_string_free(str, FALSE);
+}
+
+static size_t
+http_copy_buffer                        (void   *src,
+                                         size_t  size,
+                                         size_t  nmemb,
+                                         void   *dest)
+{
+        curl_buffer *dstbuf = (curl_buffer *) dest;
+        size_t datasize = size*nmemb;
+        if (datasize == 0 || src == NULL) return 0;
+        if (dstbuf->str == NULL) {
+                double length = -1;
+                gsize prealloc = datasize;
+                curl_easy_getinfo(dstbuf->handle,
+                                  CURLINFO_CONTENT_LENGTH_DOWNLOAD, &length);
+                if (length > datasize && length <= http_max_prealloc) {
+                        prealloc = (gsize) length;
+                }
+                dstbuf->str = g_string_sized_new(prealloc);
+        }
+        /* GString grows geometrically and keeps the final \0 */
+        g_string_append_len(dstbuf->str, src, datasize);
+        return datasize;
+}
+
+/* State of a response being parsed while it's downloaded */
+typedef struct {
+        xmlParserCtxt *ctxt;
+        http_xml_root_cb root_cb;
+        gpointer root_cb_data;
+        gboolean root_checked;
+        gboolean aborted;
+        size_t received;
+} http_xml_parser;
+
+/* Feed a libxml2 push parser with the chunks of the response as soon
+ * as they arrive. The root element is checked as soon as it has been
+ * parsed, and the download is aborted if it's not valid */
+static size_t
+http_parse_xml                          (void   *src,
+                                         size_t  size,
+                                         size_t  nmemb,
+                                         void   *dest)
+{
+        http_xml_parser *parser = (http_xml_parser *) dest;
+        const char *data = src;
+        size_t datasize = size*nmemb;
+        size_t initial = 0;
+
+        if (datasize == 0 || src == NULL) return 0;
+        parser->received += datasize;
+
+        /* Give the first 4 bytes to the parser when creating it so
+         * it can detect the encoding */
+        if (parser->ctxt == NULL) {
+                initial = MIN (datasize, 4);
+                parser->ctxt = xmlCreatePushParserCtxt (NULL, NULL, data,
+                                                        initial, NULL);
+                if (parser->ctxt == NULL) {
+                        parser->aborted = TRUE;
+                        return 0;
+                }
+        }
+
+        xmlParseChunk (parser->ctxt, data + initial, datasize - initial, 0);
+
+        if (!parser->ctxt->wellFormed) {
+                g_warning ("Response is not a well-formed XML document");
+                parser->aborted = TRUE;
+                return 0;
+        }
+
+        if (!parser->root_checked && parser->ctxt->myDoc != NULL) {
+                xmlNode *root = xmlDocGetRootElement (parser->ctxt->myDoc);
+                if (root != NULL) {
+                        parser->root_checked = TRUE;
+                        if (parser->root_cb != NULL &&
+                            !(*(parser->root_cb)) (root,
+                                                   parser->root_cb_data)) {
+                                g_warning ("Unexpected XML root element: "
+                                           "%s", root->name);
+                                parser->aborted = TRUE;
+                                return 0;
+                        }
+                }
+        }
+
+        return datasize;
+}
+
+/**
+ * Finish parsing the XML document and free the parser
+ * @param parser The parser
+ * @param success Whether the download was successful
+ * @return The XML document, or NULL if it couldn't be parsed
+ */
+static xmlDoc *
+http_xml_parser_finish                  (http_xml_parser *parser,
+                                         gboolean         success)
+{
+        xmlDoc *doc = NULL;
+        if (parser->ctxt != NULL) {
+                if (success && !parser->aborted) {
+                        xmlParseChunk (parser->ctxt, NULL, 0, 1);
+                }
+                if (success && !parser->aborted &&
+                    parser->ctxt->wellFormed) {
+                        doc = parser->ctxt->myDoc;
+                } else if (parser->ctxt->myDoc != NULL) {
+                        xmlFreeDoc (parser->ctxt->myDoc);
+                }
+                parser->ctxt->myDoc = NULL;
+                xmlFreeParserCtxt (parser->ctxt);
+                parser->ctxt = NULL;
+        }
+        return doc;
+}
+
+static void
+http_buffer_free                        (curl_buffer *dstbuf)
+{
+        if (dstbuf->str != NULL) {
+                g_string_free(dstbuf->str, TRUE);
+                dstbuf->str = NULL;
+        }
+}
+
+/**
+ * Take the contents of a buffer without copying them.
+ * @param dstbuf The buffer. It will be empty after this call
+ * @param size Where the size of the data will be stored, or NULL
+ * @return The data (nul-terminated), or NULL if there's nothing
+ */
+static char *
+http_buffer_steal                       (curl_buffer *dstbuf,
+                                         size_t      *size)
+{
+        char *retval = NULL;
+        size_t len = 0;
+        if (dstbuf->str != NULL) {
+                len = dstbuf->str->len;
+                retval = g_string_free(dstbuf->str, FALSE);
+                dstbuf->str = NULL;
+        }
+        if (size != NULL) {
+                *size = len;
+        }
+        return retval;
+}
+
+/**
+ * Get the key used to store the curl handles for a URL in the pool.
+ * That's the scheme, host and port, e.g. "http://ws.audioscrobbler.com"
+ * @param url The URL
+ * @return A newly allocated string
+ */
+static char *
+http_pool_key                           (const char *url)
+{
+        const char *host = strstr (url, "://");
+        size_t len;
+        host = host ? host + 3 : url;
+        len = strcspn (host, "/?#");
+        return g_strndup (url, (host - url) + len);
+}
+
+/* Discard the handles that have been idle for too long. Call with
+ * pool_mutex held. Handles are pushed to the head of each queue, so
+ * the oldest ones are always at the tail */
+static gboolean
+http_pool_expire_queue                  (gpointer key,
+                                         gpointer value,
+                                         gpointer data)
+{
+        GQueue *queue = value;
+        time_t now = *((time_t *) data);
+        http_pool_entry *entry;
+        while ((entry = g_queue_peek_tail (queue)) != NULL &&
+               now - entry->last_used > http_pool_idle_timeout) {
+                g_queue_pop_tail (queue);
+                curl_easy_cleanup (entry->handle);
+                g_slice_free (http_pool_entry, entry);
+        }
+        return g_queue_is_empty (queue);
+}
+
+/**
+ * Configure a curl handle to use a proxy
+ * @param handle The handle
+ * @param proxy The proxy URL, "direct://" or NULL to use the default
+ */
+static void
+http_set_handle_proxy                   (CURL       *handle,
+                                         const char *proxy)
+{
+        if (proxy != NULL) {
+                curl_easy_setopt (handle, CURLOPT_PROXY, proxy);
+                if (!g_str_equal (proxy, "direct://")) {
+                        curl_proxytype type = CURLPROXY_HTTP;
+                        if (g_str_has_prefix (proxy, "socks://") ||
+                            g_str_has_prefix (proxy, "socks5://")) {
+                                /* TODO: make socks:// fall back to Socks 4 */
+                                type = CURLPROXY_SOCKS5;
+                        } else if (g_str_has_prefix (proxy, "socks4://")) {
+                                type = CURLPROXY_SOCKS4;
+                        }
+                        curl_easy_setopt (handle, CURLOPT_PROXYTYPE, type);
+                }
+        }
+}
+
+#ifdef HAVE_LIBPROXY
+/**
+ * Look for the system proxy of a URL in the proxy cache
+ * @param url The URL
+ * @param proxy Where to store the proxy (to be freed with g_free()),
+ *              or NULL to only check if it's there
+ * @return Whether the cache has a valid entry for that URL
+ */
+static gboolean
+http_lookup_system_proxy                (const char  *url,
+                                         char       **proxy)
+{
+        char *key = http_pool_key (url);
+        gboolean cached = FALSE;
+        http_proxy_cache_entry *entry;
+
+        g_static_rw_lock_reader_lock (&proxy_lock);
+        entry = g_hash_table_lookup (proxy_cache, key);
+        if (entry != NULL && entry->expires > time (NULL)) {
+                if (proxy != NULL) *proxy = g_strdup (entry->proxy);
+                cached = TRUE;
+        }
+        g_static_rw_lock_reader_unlock (&proxy_lock);
+
+        g_free (key);
+        return cached;
+}
+
+/**
+ * Ask libproxy for the system proxy of a URL and store it in the
+ * proxy cache. This can be slow (it may need to evaluate PAC files)
+ * so it must not be called from the main loop.
+ * @param url The URL
+ * @return The proxy, or NULL to use the default. Free with g_free()
+ */
+static char *
+http_resolve_system_proxy               (const char *url)
+{
+        char *proxy = NULL;
+        char **proxies;
+        http_proxy_cache_entry *entry;
+
+        proxies = px_proxy_factory_get_proxies (proxy_factory, (char *) url);
+        if (proxies != NULL) {
+                char **p;
+                for (p = proxies; proxy == NULL && *p != NULL; p++) {
+                        if (g_str_has_prefix (*p, "direct://") ||
+                            g_str_has_prefix (*p, "http://") ||
+                            g_str_has_prefix (*p, "socks://") ||
+                            g_str_has_prefix (*p, "socks4://") ||
+                            g_str_has_prefix (*p, "socks5://")) {
+                                proxy = g_strdup (*p);
+                        }
+                }
+        }
+        g_strfreev (proxies);
+
+        entry = g_slice_new (http_proxy_cache_entry);
+        entry->proxy = g_strdup (proxy);
+        entry->expires = time (NULL) + proxy_cache_ttl;
+        g_static_rw_lock_writer_lock (&proxy_lock);
+        g_hash_table_replace (proxy_cache, http_pool_key (url), entry);
+        g_static_rw_lock_writer_unlock (&proxy_lock);
+
+        return proxy;
+}
+
+/**
+ * Configure a curl handle to use the system proxy for a URL. Asking
+ * libproxy can be slow so the result is cached for each host. The
+ * cache is invalidated after some time, when the proxy settings
+ * change and when the network connection changes, see
+ * http_invalidate_proxy_cache().
+ * @param handle The handle
+ * @param url The URL that is going to be requested
+ */
+static void
+http_set_handle_system_proxy            (CURL       *handle,
+                                         const char *url)
+{
+        char *proxy = NULL;
+
+        /* Common case: the proxy is in the cache */
+        if (!http_lookup_system_proxy (url, &proxy)) {
+                proxy = http_resolve_system_proxy (url);
+        }
+
+        http_set_handle_proxy (handle, proxy);
+
+        g_free (proxy);
+}
 #endif
+
+/**
+ * Check whether get_curl_handle() would need to ask libproxy for the
+ * proxy of a URL, which can block for a long time
+ * @param url The URL
+ * @return TRUE if the system proxy is used and it's not in the cache
+ */
+static gboolean
+http_system_proxy_is_stale              (const char *url)
+{
+#ifdef HAVE_LIBPROXY
+        gboolean system_proxy;
+        g_static_rw_lock_reader_lock (&proxy_lock);
+        system_proxy = use_global_proxy;
+        g_static_rw_lock_reader_unlock (&proxy_lock);
+        return system_proxy && !http_lookup_system_proxy (url, NULL);
+#else
+        return FALSE;
+#endif
+}
+
+/**
+ * Get a curl handle to perform a request to a URL. If there's an idle
+ * handle in the pool for the same host it will be reused, together
+ * with its open connections. Return it with release_curl_handle()
+ * @param url The URL that is going to be requested
+ * @return A curl handle with all common options set
+ */
+static CURL *
+get_curl_handle                         (const char *url)
+{
+        CURL *handle = NULL;
+        char *key = http_pool_key (url);
+        time_t now = time (NULL);
+
+        g_static_mutex_lock (&pool_mutex);
+        if (handle_pool != NULL) {
+                GQueue *queue;
+                g_hash_table_foreach_remove (handle_pool,
+                                             http_pool_expire_queue, &now);
+                queue = g_hash_table_lookup (handle_pool, key);
+                if (queue != NULL) {
+                        http_pool_entry *entry = g_queue_pop_head (queue);
+                        if (entry != NULL) {
+                                handle = entry->handle;
+                                g_slice_free (http_pool_entry, entry);
+                        }
+                }
+        }
+        g_static_mutex_unlock (&pool_mutex);
+        g_free (key);
+
+        if (handle == NULL) {
+                handle = curl_easy_init ();
+        }
+
+        curl_easy_setopt (handle, CURLOPT_NOSIGNAL, 1);
+        curl_easy_setopt (handle, CURLOPT_FOLLOWLOCATION, 1);
+        curl_easy_setopt (handle, CURLOPT_LOW_SPEED_LIMIT, 1);
+        curl_easy_setopt (handle, CURLOPT_LOW_SPEED_TIME, http_timeout);
+        curl_easy_setopt (handle, CURLOPT_CONNECTTIMEOUT, http_timeout);
+#if LIBCURL_VERSION_NUM >= 0x071900
+        curl_easy_setopt (handle, CURLOPT_TCP_KEEPALIVE, 1L);
+#endif
+        if (share_handle != NULL) {
+                curl_easy_setopt (handle, CURLOPT_SHARE, share_handle);
+        }
+
+#ifdef HAVE_LIBPROXY
+        g_static_rw_lock_reader_lock (&proxy_lock);
+        if (use_global_proxy) {
+                g_static_rw_lock_reader_unlock (&proxy_lock);
+                http_set_handle_system_proxy (handle, url);
+                return handle;
+        }
+        g_static_rw_lock_reader_unlock (&proxy_lock);
+#endif
+
+        g_static_rw_lock_reader_lock (&proxy_lock);
+        http_set_handle_proxy (handle, proxy_url);
+        g_static_rw_lock_reader_unlock (&proxy_lock);
+
+        return handle;
+}
+
+/**
+ * Give back a handle obtained with get_curl_handle(). It will be
+ * kept in the pool for later reuse unless the pool for that host is
+ * already full.
+ * @param url The same URL that was passed to get_curl_handle()
+ * @param handle The handle
+ */
+static void
+release_curl_handle                     (const char *url,
+                                         CURL       *handle)
+{
+        GQueue *queue = NULL;
+        char *key = http_pool_key (url);
+        long num_connects = 0;
+
+        /* Update the cache statistics */
+        curl_easy_getinfo (handle, CURLINFO_NUM_CONNECTS, &num_connects);
+        g_atomic_int_inc (&stats_requests);
+        if (num_connects == 0) {
+                g_atomic_int_inc (&stats_conn_reused);
+        }
+
+        /* Clear all options (callbacks, pointers to the caller's
+         * data...) but keep the connections alive */
+        curl_easy_reset (handle);
+
+        g_static_mutex_lock (&pool_mutex);
+        if (handle_pool != NULL) {
+                queue = g_hash_table_lookup (handle_pool, key);
+                if (queue == NULL) {
+                        queue = g_queue_new ();
+                        g_hash_table_insert (handle_pool, key, queue);
+                        key = NULL;
+                }
+        }
+        if (queue != NULL &&
+            g_queue_get_length (queue) < http_pool_max_per_host) {
+                http_pool_entry *entry = g_slice_new (http_pool_entry);
+                entry->handle = handle;
+                entry->last_used = time (NULL);
+                g_queue_push_head (queue, entry);
+                handle = NULL;
+        }
+        g_static_mutex_unlock (&pool_mutex);
+
+        if (handle != NULL) {
+                curl_easy_cleanup (handle);
+        }
+        g_free (key);
+}
+
+/**
+ * Ask the server to send the response compressed (gzip or deflate,
+ * depending on what libcurl supports). Decompression is done by
+ * libcurl on the fly, so the write callback receives the decoded
+ * data. This must not be used for the audio stream, which is already
+ * compressed and is read by the decoder as it arrives.
+ * @param handle The curl handle
+ */
+static void
+http_enable_compression                 (CURL *handle)
+{
+#if LIBCURL_VERSION_NUM >= 0x071506
+        curl_easy_setopt (handle, CURLOPT_ACCEPT_ENCODING, "");
+#else
+        curl_easy_setopt (handle, CURLOPT_ENCODING, "");
+#endif
+}
+
+/**
+ * Update the counters of bytes received for a finished request that
+ * used http_enable_compression()
+ * @param handle The curl handle
+ * @param decoded Number of bytes received after decompression
+ */
+static void
+http_count_transfer                     (CURL   *handle,
+                                         size_t  decoded)
+{
+        double wire = 0;
+        curl_easy_getinfo (handle, CURLINFO_SIZE_DOWNLOAD, &wire);
+        g_static_mutex_lock (&transfer_stats_mutex);
+        stats_wire_bytes += (guint64) wire;
+        stats_decoded_bytes += decoded;
+        g_static_mutex_unlock (&transfer_stats_mutex);
+}
+
+/**
+ * Set the tag of the next request made by the calling thread. It's
+ * used to group the timing statistics by logical operation, and it
+ * only applies to one request. Requests without a tag are recorded
+ * as "other".
+ * @param tag The tag, or NULL to remove it
+ */
+void
+http_set_request_tag                    (const char *tag)
+{
+        g_static_private_set (&request_tag,
+                              (gpointer) g_intern_string (tag), NULL);
+}
+
+/**
+ * Get (and clear) the tag set with http_set_request_tag()
+ * @return The tag, which is an interned string
+ */
+static const char *
+http_take_request_tag                   (void)
+{
+        const char *tag = g_static_private_get (&request_tag);
+        if (tag != NULL) {
+                g_static_private_set (&request_tag, NULL, NULL);
+        } else {
+                tag = "other";
+        }
+        return tag;
+}
+
+/**
+ * Record the timings of a finished request
+ * @param handle The curl handle
+ * @param tag The tag of the request
+ * @param retcode The result of the request
+ */
+static void
+http_record_timing                      (CURL       *handle,
+                                         const char *tag,
+                                         CURLcode    retcode)
+{
+        http_timing t;
+        double namelookup = 0, connect = 0, appconnect = 0;
+        double down = 0, up = 0;
+
+        curl_easy_getinfo (handle, CURLINFO_NAMELOOKUP_TIME, &namelookup);
+        curl_easy_getinfo (handle, CURLINFO_CONNECT_TIME, &connect);
+#if LIBCURL_VERSION_NUM >= 0x071300
+        curl_easy_getinfo (handle, CURLINFO_APPCONNECT_TIME, &appconnect);
+#endif
+        curl_easy_getinfo (handle, CURLINFO_STARTTRANSFER_TIME, &t.ttfb);
+        curl_easy_getinfo (handle, CURLINFO_TOTAL_TIME, &t.total);
+        curl_easy_getinfo (handle, CURLINFO_SIZE_DOWNLOAD, &down);
+        curl_easy_getinfo (handle, CURLINFO_SIZE_UPLOAD, &up);
+
+        /* curl gives the time elapsed since the start of the request
+         * until the end of each phase. Phases not performed (e.g. if
+         * the connection was reused) are reported as 0 */
+        t.dns = namelookup;
+        t.connect = connect > namelookup ? connect - namelookup : 0;
+        t.tls = appconnect > connect ? appconnect - connect : 0;
+        t.bytes = (guint64) (down + up);
+        t.success = (retcode == CURLE_OK);
+
+        http_stats_add (tag, &t);
+}
+
+/**
+ * Perform a blocking request and record its timings using the tag
+ * set by the calling thread
+ * @param handle The curl handle
+ * @return The result of curl_easy_perform()
+ */
+static CURLcode
+http_perform                            (CURL *handle)
+{
+        const char *tag = http_take_request_tag ();
+        CURLcode retcode = curl_easy_perform (handle);
+        http_record_timing (handle, tag, retcode);
+        return retcode;
+}
+
+typedef struct {
+        http_stream_cb cb;
+        gpointer userdata;
+        CURL *handle;
+        guint64 offset;
+        guint64 skip;
+        gboolean connected;
+        gboolean rejected;
+} http_stream_data;
+
+static size_t
+http_stream_write                       (void   *ptr,
+                                         size_t  size,
+                                         size_t  nmemb,
+                                         void   *data)
+{
+        http_stream_data *d = data;
+        size_t len = size * nmemb;
+        size_t skipped = 0;
+        if (!d->connected) {
+                /* The connection was established (start - connect)
+                 * seconds before the first byte arrived, i.e. now */
+                double connect = 0, start = 0;
+                long code = 0;
+                curl_easy_getinfo (d->handle, CURLINFO_CONNECT_TIME,
+                                   &connect);
+                curl_easy_getinfo (d->handle, CURLINFO_STARTTRANSFER_TIME,
+                                   &start);
+                curl_easy_getinfo (d->handle, CURLINFO_RESPONSE_CODE, &code);
+                latency_trace_mark_ago (LATENCY_STAGE_CONNECT,
+                                        MAX (start - connect, 0));
+                if (d->offset > 0 && code == 200) {
+                        /* The range was ignored, so the data that
+                         * has already been received must be skipped */
+                        g_debug ("Server doesn't support ranges, "
+                                 "skipping %" G_GUINT64_FORMAT " bytes",
+                                 d->offset);
+                        d->skip = d->offset;
+                } else if (code >= 300 || (d->offset > 0 && code != 206)) {
+                        g_warning ("Unexpected HTTP response: %ld", code);
+                        d->rejected = TRUE;
+                        return 0;
+                }
+                d->connected = TRUE;
+        }
+        if (d->skip > 0) {
+                skipped = MIN (d->skip, len);
+                d->skip -= skipped;
+                if (skipped == len) return len;
+        }
+        return (*(d->cb)) ((char *) ptr + skipped, len - skipped,
+                           d->userdata) ? len : 0;
+}
+
+/**
+ * Download a stream, passing the data to a callback as it arrives.
+ * This is a blocking function.
+ * @param url The URL of the stream
+ * @param headers Additional HTTP headers, or NULL
+ * @param offset Number of bytes to skip from the beginning of the
+ *               stream (used to resume a previous transfer)
+ * @param cb Callback called for each chunk of data
+ * @param userdata Data passed to @cb
+ * @return The result of the transfer
+ */
+http_stream_result
+http_get_stream                         (const char     *url,
+                                         const GSList   *headers,
+                                         guint64         offset,
+                                         http_stream_cb  cb,
+                                         gpointer        userdata)
+{
+        g_return_val_if_fail(url != NULL && cb != NULL, HTTP_STREAM_FAILED);
+        http_stream_data d = { cb, userdata, NULL, offset, 0, FALSE, FALSE };
+        CURLcode retcode;
+        CURL *handle;
+        struct curl_slist *hdrs = NULL;
+
+        g_debug("Requesting URL %s", url);
+        hdrs = curl_slist_append(hdrs, "User-Agent: " APP_FULLNAME);
+        if (headers != NULL) {
+                const GSList *iter = headers;
+                for (; iter != NULL; iter = g_slist_next(iter)) {
+                        hdrs = curl_slist_append(hdrs, iter->data);
+                }
+        }
+        handle = get_curl_handle (url);
+        d.handle = handle;
+        curl_easy_setopt(handle, CURLOPT_URL, url);
+        curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, http_stream_write);
+        curl_easy_setopt(handle, CURLOPT_WRITEDATA, &d);
+        curl_easy_setopt(handle, CURLOPT_HTTPHEADER, hdrs);
+        curl_easy_setopt(handle, CURLOPT_LOW_SPEED_TIME,
+                         http_stream_stall_timeout);
+        if (offset > 0) {
+                curl_easy_setopt(handle, CURLOPT_RESUME_FROM_LARGE,
+                                 (curl_off_t) offset);
+        }
+        retcode = http_perform(handle);
+        release_curl_handle (url, handle);
+        if (hdrs != NULL) curl_slist_free_all(hdrs);
+        if (d.rejected) {
+                return HTTP_STREAM_REJECTED;
+        } else if (retcode == CURLE_OK) {
+                return HTTP_STREAM_DONE;
+        } else if (retcode == CURLE_WRITE_ERROR) {
+                return HTTP_STREAM_CANCELLED;
+        } else {
+                g_warning("Error getting URL %s: %s", url,
+                          curl_easy_strerror (retcode));
+                return HTTP_STREAM_FAILED;
+        }
+}
+
+/**
+ * Get the size of a remote file using a HEAD request
+ * @param url The URL of the file
+ * @return The size in bytes, or -1 if it's unknown or the request
+ *         failed
+ */
+gint64
+http_get_content_length                 (const char *url)
+{
+        g_return_val_if_fail (url != NULL, -1);
+        double length = -1;
+        long code = 0;
+        CURLcode retcode;
+        CURL *handle;
+        struct curl_slist *hdrs = NULL;
+
+        g_debug ("Requesting headers of URL %s", url);
+        hdrs = curl_slist_append (hdrs, "User-Agent: " APP_FULLNAME);
+        handle = get_curl_handle (url);
+        curl_easy_setopt (handle, CURLOPT_URL, url);
+        curl_easy_setopt (handle, CURLOPT_NOBODY, 1);
+        curl_easy_setopt (handle, CURLOPT_HTTPHEADER, hdrs);
+        retcode = http_perform (handle);
+        if (retcode == CURLE_OK) {
+                curl_easy_getinfo (handle, CURLINFO_RESPONSE_CODE, &code);
+                curl_easy_getinfo (handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD,
+                                   &length);
+        }
+        release_curl_handle (url, handle);
+        curl_slist_free_all (hdrs);
+
+        return (code == 200 && length >= 0) ? (gint64) length : -1;
+}
+
+typedef struct {
+        char *buf;
+        size_t len;
+        size_t max;
+} http_range_data;
+
+static size_t
+http_copy_range                         (void   *src,
+                                         size_t  size,
+                                         size_t  nmemb,
+                                         void   *dest)
+{
+        http_range_data *d = dest;
+        size_t datasize = size*nmemb;
+        /* Abort if the server sends more than what was requested */
+        if (datasize > d->max - d->len) return 0;
+        memcpy (d->buf + d->len, src, datasize);
+        d->len += datasize;
+        return datasize;
+}
+
+/**
+ * Download part of a remote file. This fails if the server doesn't
+ * support byte ranges.
+ * @param url The URL of the file
+ * @param offset The position of the first byte
+ * @param buffer Where to store the data
+ * @param length The number of bytes to get
+ * @return TRUE if exactly @length bytes were received
+ */
+gboolean
+http_get_range                          (const char *url,
+                                         guint64     offset,
+                                         char       *buffer,
+                                         size_t      length)
+{
+        g_return_val_if_fail (url && buffer && length > 0, FALSE);
+        http_range_data d;
+        long code = 0;
+        CURLcode retcode;
+        CURL *handle;
+        struct curl_slist *hdrs = NULL;
+        char *range;
+
+        d.buf = buffer;
+        d.len = 0;
+        d.max = length;
+        range = g_strdup_printf ("%" G_GUINT64_FORMAT "-%" G_GUINT64_FORMAT,
+                                 offset, offset + length - 1);
+
+        g_debug ("Requesting bytes %s of URL %s", range, url);
+        hdrs = curl_slist_append (hdrs, "User-Agent: " APP_FULLNAME);
+        handle = get_curl_handle (url);
+        curl_easy_setopt (handle, CURLOPT_URL, url);
+        curl_easy_setopt (handle, CURLOPT_RANGE, range);
+        curl_easy_setopt (handle, CURLOPT_HTTPHEADER, hdrs);
+        curl_easy_setopt (handle, CURLOPT_WRITEFUNCTION, http_copy_range);
+        curl_easy_setopt (handle, CURLOPT_WRITEDATA, &d);
+        retcode = http_perform (handle);
+        if (retcode == CURLE_OK) {
+                curl_easy_getinfo (handle, CURLINFO_RESPONSE_CODE, &code);
+        }
+        release_curl_handle (url, handle);
+        curl_slist_free_all (hdrs);
+        g_free (range);
+
+        return (code == 206 && d.len == length);
+}
+
+/**
+ * Read the size and ETag of the file being downloaded, saved by
+ * http_download_save_info()
+ * @param d The download data
+ */
+static void
+http_download_load_info                 (http_download_data *d)
+{
+        char *contents = NULL;
+
+        g_free (d->saved_etag);
+        d->saved_etag = NULL;
+        d->saved_total = -1;
+
+        if (g_file_get_contents (d->infopath, &contents, NULL, NULL)) {
+                char **lines = g_strsplit (contents, "\n", 3);
+                if (lines[0] != NULL && lines[0][0] != '\0') {
+                        d->saved_total = g_ascii_strtoll (lines[0], NULL, 10);
+                        if (lines[1] != NULL && lines[1][0] != '\0') {
+                                d->saved_etag = g_strdup (lines[1]);
+                        }
+                }
+                g_strfreev (lines);
+                g_free (contents);
+        }
+}
+
+/**
+ * Save the size and ETag of the file being downloaded next to the
+ * partial file, so the download can be resumed later
+ * @param d The download data
+ */
+static void
+http_download_save_info                 (http_download_data *d)
+{
+        char *contents;
+        contents = g_strdup_printf ("%" G_GINT64_FORMAT "\n%s\n", d->total,
+                                    d->etag ? d->etag : "");
+        if (!g_file_set_contents (d->infopath, contents, -1, NULL)) {
+                g_warning ("Unable to write %s", d->infopath);
+        }
+        g_free (contents);
 }
 
-char *
-escape_url                              (const char *url,
-                                         gboolean    escape)
+/**
+ * Discard the contents of the partial file
+ * @param d The download data
+ * @return TRUE on success, FALSE otherwise
+ */
+static gboolean
+http_download_truncate                  (http_download_data *d)
 {
-        g_return_val_if_fail(url != NULL, NULL);
-        CURL *handle;
-        char *str, *curl_str;
-        handle = curl_easy_init();
-        if (escape) {
-#ifdef HAVE_CURL_EASY_ESCAPE
-                curl_str = curl_easy_escape(handle, url, 0);
-        } else {
-                curl_str = curl_easy_unescape(handle, url, 0, NULL);
-#else
-                curl_str = curl_escape(url, 0);
-        } else {
-                curl_str = curl_unescape(url, 0);
-#endif
+        g_unlink (d->infopath);
+        if (ftruncate (fileno (d->f), 0) != 0) {
+                g_warning ("Unable to truncate partial download file");
+                return FALSE;
         }
-        str = g_strdup(curl_str);
-        curl_free(curl_str);
-        curl_easy_cleanup(handle);
-        return str;
+        d->offset = 0;
+        return TRUE;
 }
 
 static size_t
-http_copy_buffer                        (void   *src,
+http_download_header                    (void   *ptr,
                                          size_t  size,
                                          size_t  nmemb,
-                                         void   *dest)
-{
-        curl_buffer *dstbuf = (curl_buffer *) dest;
-        size_t datasize = size*nmemb;
-        size_t writefrom = dstbuf->size;
-        if (datasize == 0 || src == NULL) return 0;
-        dstbuf->size += datasize;
-        /* Allocate an extra byte to place the final \0 */
-        dstbuf->buffer = g_realloc(dstbuf->buffer, dstbuf->size + 1);
-        memcpy(dstbuf->buffer + writefrom, src, datasize);
-        return datasize;
-}
-
-static CURL *
-create_curl_handle                      (const char *url)
+                                         void   *data)
 {
-        CURL *handle = curl_easy_init ();
-        curl_easy_setopt (handle, CURLOPT_NOSIGNAL, 1);
-        curl_easy_setopt (handle, CURLOPT_FOLLOWLOCATION, 1);
-        curl_easy_setopt (handle, CURLOPT_LOW_SPEED_LIMIT, 1);
-        curl_easy_setopt (handle, CURLOPT_LOW_SPEED_TIME, http_timeout);
-        curl_easy_setopt (handle, CURLOPT_CONNECTTIMEOUT, http_timeout);
+        http_download_data *d = data;
+        size_t len = size * nmemb;
+        char *line = g_strchomp (g_strndup (ptr, len));
 
-#ifdef HAVE_LIBPROXY
-        if (use_global_proxy) {
-                char **proxies;
-                const char *found = NULL;
-                proxies = px_proxy_factory_get_proxies (proxy_factory,
-                                                        (char *) url);
-                if (proxies != NULL) {
-                        char **p;
-                        for (p = proxies; found == NULL && *p != NULL; p++) {
-                                if (g_str_has_prefix (*p, "direct://") ||
-                                    g_str_has_prefix (*p, "http://") ||
-                                    g_str_has_prefix (*p, "socks://") ||
-                                    g_str_has_prefix (*p, "socks4://") ||
-                                    g_str_has_prefix (*p, "socks5://")) {
-                                        found = *p;
-                                }
-                        }
+        if (g_str_has_prefix (line, "HTTP/")) {
+                /* Start of a new response (there can be
+                 * several if there are redirections) */
+                const char *code = strchr (line, ' ');
+                d->status = code ? strtol (code + 1, NULL, 10) : 0;
+                d->range_start = -1;
+                d->total = -1;
+                g_free (d->etag);
+                d->etag = NULL;
+        } else if (!g_ascii_strncasecmp (line, "ETag:", 5)) {
+                g_free (d->etag);
+                d->etag = g_strdup (g_strstrip (line + 5));
+        } else if (!g_ascii_strncasecmp (line, "Content-Range:", 14)) {
+                /* Content-Range: bytes <start>-<end>/<total> */
+                const char *start = strstr (line, "bytes ");
+                const char *total = strrchr (line, '/');
+                if (start != NULL) {
+                        d->range_start = g_ascii_strtoll (start + 6, NULL, 10);
                 }
-
-                g_static_rw_lock_writer_lock (&proxy_lock);
-                if (use_global_proxy) update_proxy_url (found);
-                g_static_rw_lock_writer_unlock (&proxy_lock);
-
-                g_strfreev (proxies);
-        }
-#endif
-
-        g_static_rw_lock_reader_lock (&proxy_lock);
-        if (proxy_url != NULL) {
-                curl_easy_setopt (handle, CURLOPT_PROXY, proxy_url);
-                if (!g_str_equal (proxy_url, "direct://")) {
-                        curl_proxytype type = CURLPROXY_HTTP;
-                        if (g_str_has_prefix (proxy_url, "socks://") ||
-                            g_str_has_prefix (proxy_url, "socks5://")) {
-                                /* TODO: make socks:// fall back to Socks 4 */
-                                type = CURLPROXY_SOCKS5;
-                        } else if (g_str_has_prefix (proxy_url, "socks4://")) {
-                                type = CURLPROXY_SOCKS4;
-                        }
-                        curl_easy_setopt (handle, CURLOPT_PROXYTYPE, type);
+                if (total != NULL && total[1] != '*') {
+                        d->total = g_ascii_strtoll (total + 1, NULL, 10);
                 }
+        } else if (d->status == 200 &&
+                   !g_ascii_strncasecmp (line, "Content-Length:", 15)) {
+                d->total = g_ascii_strtoll (line + 15, NULL, 10);
         }
-        g_static_rw_lock_reader_unlock (&proxy_lock);
 
-        return handle;
+        g_free (line);
+        return len;
 }
 
-gboolean
-http_get_to_fd                          (const char   *url,
-                                         int           fd,
-                                         const GSList *headers)
+static size_t
+http_download_write                     (void   *ptr,
+                                         size_t  size,
+                                         size_t  nmemb,
+                                         void   *data)
 {
-        g_return_val_if_fail(url != NULL && fd > 0, FALSE);
-        CURLcode retcode;
-        CURL *handle;
-        FILE *f = fdopen(fd, "w");
-        struct curl_slist *hdrs = NULL;
+        http_download_data *d = data;
 
-        if (f == NULL) {
-                g_warning("Unable to fdopen() fd %d", fd);
-                close(fd);
-                return FALSE;
-        }
-        g_debug("Requesting URL %s", url);
-        hdrs = curl_slist_append(hdrs, "User-Agent: " APP_FULLNAME);
-        if (headers != NULL) {
-                const GSList *iter = headers;
-                for (; iter != NULL; iter = g_slist_next(iter)) {
-                        hdrs = curl_slist_append(hdrs, iter->data);
+        /* Check the response before writing anything to the file.
+         * Returning 0 aborts the transfer */
+        if (!d->checked) {
+                d->checked = TRUE;
+                if (d->status == 206) {
+                        if (d->range_start != d->offset ||
+                            (d->saved_total >= 0 &&
+                             d->total != d->saved_total)) {
+                                g_warning ("Server returned an unexpected "
+                                           "range, restarting download");
+                                http_download_truncate (d);
+                                return 0;
+                        }
+                } else if (d->status == 200) {
+                        /* Either the server doesn't support ranges
+                         * or the file has changed (If-Range) */
+                        if (d->offset > 0) {
+                                g_debug ("Unable to resume download, "
+                                         "starting from the beginning");
+                                if (!http_download_truncate (d)) return 0;
+                        }
+                } else {
+                        g_warning ("Unexpected HTTP status %ld", d->status);
+                        return 0;
                 }
+                http_download_save_info (d);
         }
-        handle = create_curl_handle (url);
-        curl_easy_setopt(handle, CURLOPT_URL, url);
-        curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, NULL);
-        curl_easy_setopt(handle, CURLOPT_WRITEDATA, f);
-        curl_easy_setopt(handle, CURLOPT_HTTPHEADER, hdrs);
-        retcode = curl_easy_perform(handle);
-        curl_easy_cleanup(handle);
-        if (hdrs != NULL) curl_slist_free_all(hdrs);
-        fclose(f);
-        /* We only return false for _read_ errors */
-        if (retcode == CURLE_OK || retcode == CURLE_WRITE_ERROR) {
-                return TRUE;
-        } else {
-                g_warning("Error getting URL %s", url);
-                return FALSE;
-        }
+
+        return fwrite (ptr, size, nmemb, d->f);
 }
 
 static int
-http_dl_progress_wrapper                (void   *data,
+http_download_progress                  (void   *data,
                                          double  dltotal,
                                          double  dlnow,
                                          double  ultotal,
                                          double  ulnow)
 {
-        http_dl_progress_wrapper_data *wrapdata;
-        wrapdata = (http_dl_progress_wrapper_data *) data;
-        g_return_val_if_fail(wrapdata != NULL && wrapdata->cb != NULL, -1);
-        if ((*(wrapdata->cb))(wrapdata->userdata, dltotal, dlnow)) {
+        http_download_data *d = data;
+        g_return_val_if_fail(d != NULL && d->cb != NULL, -1);
+        /* curl only counts the bytes of the current request */
+        if (dltotal > 0) {
+                dltotal += d->offset;
+        }
+        dlnow += d->offset;
+        if ((*(d->cb))(d->userdata, dltotal, dlnow)) {
                 return 0;
         } else {
                 return -1;
         }
 }
 
+/**
+ * Make one attempt to download a file, resuming from the data
+ * already present in the partial file
+ * @param url The URL to download
+ * @param partpath The partial file
+ * @param d The download data
+ * @param retry Set to FALSE if the download mustn't be retried
+ * @return TRUE if the partial file is complete, FALSE otherwise
+ */
+static gboolean
+http_download_attempt                   (const char         *url,
+                                         const char         *partpath,
+                                         http_download_data *d,
+                                         gboolean           *retry)
+{
+        struct curl_slist *hdrs = NULL;
+        struct stat st;
+        gboolean success = FALSE;
+        CURLcode retcode;
+        CURL *handle;
+
+        d->f = fopen (partpath, "ab");
+        if (d->f == NULL) {
+                g_warning ("Unable to open %s for writing", partpath);
+                *retry = FALSE;
+                return FALSE;
+        }
+        d->offset = (fstat (fileno (d->f), &st) == 0) ? st.st_size : 0;
+        http_download_load_info (d);
+
+        /* Data that can't be validated against the size of the file
+         * on the server is discarded */
+        if (d->offset > 0 && (d->saved_total < 0 ||
+                              d->offset > d->saved_total)) {
+                if (!http_download_truncate (d)) {
+                        fclose (d->f);
+                        *retry = FALSE;
+                        return FALSE;
+                }
+        } else if (d->offset > 0 && d->offset == d->saved_total) {
+                g_debug ("%s is already complete", partpath);
+                fclose (d->f);
+                return TRUE;
+        }
+
+        handle = get_curl_handle (url);
+        hdrs = curl_slist_append (hdrs, "User-Agent: " APP_FULLNAME);
+        if (d->offset > 0) {
+                g_debug ("Resuming download of %s at byte %" G_GINT64_FORMAT,
+                         url, (gint64) d->offset);
+                curl_easy_setopt (handle, CURLOPT_RESUME_FROM_LARGE,
+                                  d->offset);
+                /* Weak validators can't be used in If-Range */
+                if (d->saved_etag != NULL &&
+                    !g_str_has_prefix (d->saved_etag, "W/")) {
+                        char *ifrange;
+                        ifrange = g_strconcat ("If-Range: ",
+                                               d->saved_etag, NULL);
+                        hdrs = curl_slist_append (hdrs, ifrange);
+                        g_free (ifrange);
+                }
+        }
+        curl_easy_setopt (handle, CURLOPT_URL, url);
+        curl_easy_setopt (handle, CURLOPT_HTTPHEADER, hdrs);
+        curl_easy_setopt (handle, CURLOPT_HEADERFUNCTION,
+                          http_download_header);
+        curl_easy_setopt (handle, CURLOPT_HEADERDATA, d);
+        curl_easy_setopt (handle, CURLOPT_WRITEFUNCTION,
+                          http_download_write);
+        curl_easy_setopt (handle, CURLOPT_WRITEDATA, d);
+        if (d->cb != NULL) {
+                curl_easy_setopt (handle, CURLOPT_PROGRESSFUNCTION,
+                                  http_download_progress);
+                curl_easy_setopt (handle, CURLOPT_PROGRESSDATA, d);
+                curl_easy_setopt (handle, CURLOPT_NOPROGRESS, FALSE);
+        }
+
+        d->status = 0;
+        d->checked = FALSE;
+        http_set_request_tag ("download");
+        retcode = http_perform (handle);
+        release_curl_handle (url, handle);
+        curl_slist_free_all (hdrs);
+        if (fclose (d->f) != 0 && retcode == CURLE_OK) {
+                retcode = CURLE_WRITE_ERROR;
+        }
+        d->f = NULL;
+
+        if (retcode == CURLE_ABORTED_BY_CALLBACK) {
+                /* Cancelled by the user, don't keep anything */
+                g_unlink (partpath);
+                g_unlink (d->infopath);
+                *retry = FALSE;
+        } else if (d->status == 416) {
+                /* Range not satisfiable: the partial file doesn't
+                 * match the one in the server, so start again */
+                g_unlink (partpath);
+                g_unlink (d->infopath);
+        } else if (d->status >= 400 && d->status < 500) {
+                *retry = FALSE;
+        } else if (retcode == CURLE_OK && d->checked) {
+                gint64 size = (g_stat (partpath, &st) == 0) ?
+                        st.st_size : -1;
+                if (d->total < 0 || size == d->total) {
+                        success = TRUE;
+                } else {
+                        g_warning ("Got %" G_GINT64_FORMAT " bytes of %s, "
+                                   "expected %" G_GINT64_FORMAT,
+                                   size, url, d->total);
+                        if (size > d->total) {
+                                g_unlink (partpath);
+                                g_unlink (d->infopath);
+                        }
+                }
+        }
+
+        return success;
+}
+
+/**
+ * Download a file. Data is written to a temporary file (the name of
+ * the destination file plus ".part") which is renamed when the
+ * download is complete. If the transfer fails it's resumed a few
+ * times using HTTP ranges. The partial file is also kept after a
+ * failure, so the download can be resumed if this function is called
+ * again with the same destination file. Downloads cancelled by the
+ * progress callback are not resumed.
+ * @param url The URL to download
+ * @param filename The destination file, which must not exist
+ * @param cb Progress callback, or NULL
+ * @param userdata Data passed to @cb
+ * @return TRUE if the file was downloaded, FALSE otherwise
+ */
 gboolean
 http_download_file                      (const char                *url,
                                          const char                *filename,
@@ -238,45 +1343,48 @@ http_download_file                      (const char                *url,
                                          gpointer                   userdata)
 {
         g_return_val_if_fail(url != NULL && filename != NULL, FALSE);
-        http_dl_progress_wrapper_data *wrapdata = NULL;
-        CURLcode retcode;
-        CURL *handle;
-        FILE *f = NULL;
-        if (!file_exists(filename)) {
-                f = fopen(filename, "wb");
-        } else {
+        http_download_data d;
+        gboolean success = FALSE, retry = TRUE;
+        char *partpath;
+        int attempt;
+
+        if (file_exists(filename)) {
                 g_warning("File %s already exists", filename);
-        }
-        if (f == NULL) {
-                g_warning("Unable to open %s for writing", filename);
                 return FALSE;
         }
 
-        handle = create_curl_handle (url);
-        curl_easy_setopt(handle, CURLOPT_URL, url);
-        curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, NULL);
-        curl_easy_setopt(handle, CURLOPT_WRITEDATA, f);
-        if (cb != NULL) {
-                wrapdata = g_slice_new(http_dl_progress_wrapper_data);
-                wrapdata->cb = cb;
-                wrapdata->userdata = userdata;
-                curl_easy_setopt(handle, CURLOPT_PROGRESSFUNCTION,
-                                 http_dl_progress_wrapper);
-                curl_easy_setopt(handle, CURLOPT_PROGRESSDATA, wrapdata);
-                curl_easy_setopt(handle, CURLOPT_NOPROGRESS, FALSE);
-        }
-        retcode = curl_easy_perform(handle);
-        curl_easy_cleanup(handle);
-        fclose(f);
-        if (wrapdata != NULL) {
-                g_slice_free(http_dl_progress_wrapper_data, wrapdata);
+        memset (&d, 0, sizeof (d));
+        d.cb = cb;
+        d.userdata = userdata;
+        partpath = g_strconcat (filename, ".part", NULL);
+        d.infopath = g_strconcat (filename, ".part.info", NULL);
+
+        for (attempt = 0; !success && retry &&
+                     attempt <= http_download_retries; attempt++) {
+                if (attempt > 0) {
+                        g_debug ("Retrying download of %s", url);
+                        g_usleep (http_download_retry_delay *
+                                  G_USEC_PER_SEC);
+                }
+                success = http_download_attempt (url, partpath, &d, &retry);
         }
-        if (retcode == CURLE_OK) {
-                return TRUE;
+
+        if (success) {
+                if (g_rename (partpath, filename) == 0) {
+                        g_unlink (d.infopath);
+                } else {
+                        g_warning ("Unable to rename %s", partpath);
+                        success = FALSE;
+                }
         } else {
                 g_warning("Error downloading URL %s", url);
-                return FALSE;
         }
+
+        g_free (d.etag);
+        g_free (d.saved_etag);
+        g_free (d.infopath);
+        g_free (partpath);
+        return success;
 }
 
 gboolean
@@ -285,7 +1393,7 @@ http_get_buffer                         (const char  *url,
                                          size_t      *bufsize)
 {
         g_return_val_if_fail(url != NULL && buffer != NULL, FALSE);
-        curl_buffer dstbuf = { NULL, 0 };
+        curl_buffer dstbuf = { NULL, NULL };
         CURLcode retcode;
         CURL *handle;
         const char *pwpos = strstr(url, "passwordmd5=");
@@ -298,29 +1406,25 @@ http_get_buffer                         (const char  *url,
                 g_debug("Requesting URL %spasswordmd5=<hidden>", newurl);
                 g_free(newurl);
         }
-        handle = create_curl_handle (url);
+        handle = get_curl_handle (url);
+        dstbuf.handle = handle;
         curl_easy_setopt(handle, CURLOPT_URL, url);
         curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, http_copy_buffer);
         curl_easy_setopt(handle, CURLOPT_WRITEDATA, &dstbuf);
         hdrs = curl_slist_append(hdrs, "User-Agent: " APP_FULLNAME);
         curl_easy_setopt(handle, CURLOPT_HTTPHEADER, hdrs);
-        retcode = curl_easy_perform(handle);
-        curl_easy_cleanup(handle);
+        http_enable_compression(handle);
+        retcode = http_perform(handle);
+        http_count_transfer(handle, dstbuf.str ? dstbuf.str->len : 0);
+        release_curl_handle (url, handle);
         if (hdrs != NULL) curl_slist_free_all(hdrs);
 
         if (retcode != CURLE_OK) {
                 g_warning("Error getting URL %s", url);
-                g_free(dstbuf.buffer);
-                dstbuf.buffer = NULL;
+                http_buffer_free(&dstbuf);
         }
 
-        if (dstbuf.buffer != NULL) {
-                dstbuf.buffer[dstbuf.size] = '\0';
-        }
-        *buffer = dstbuf.buffer;
-        if (bufsize != NULL) {
-                *bufsize = dstbuf.size;
-        }
+        *buffer = http_buffer_steal(&dstbuf, bufsize);
         return (retcode == CURLE_OK);
 }
 
@@ -332,11 +1436,12 @@ http_post_buffer                        (const char    *url,
                                          const GSList  *headers)
 {
         g_return_val_if_fail(url != NULL && postdata != NULL, FALSE);
-        curl_buffer dstbuf = { NULL, 0 };
+        curl_buffer dstbuf = { NULL, NULL };
         CURLcode retcode;
         CURL *handle;
         struct curl_slist *hdrs = NULL;
-        handle = create_curl_handle (url);
+        handle = get_curl_handle (url);
+        dstbuf.handle = handle;
 
         if (retbuf != NULL) {
                 curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION,
@@ -356,24 +1461,444 @@ http_post_buffer                        (const char    *url,
         curl_easy_setopt(handle, CURLOPT_URL, url);
         curl_easy_setopt(handle, CURLOPT_POSTFIELDS, postdata);
         curl_easy_setopt(handle, CURLOPT_HTTPHEADER, hdrs);
-        retcode = curl_easy_perform(handle);
-        curl_easy_cleanup(handle);
+        http_enable_compression(handle);
+        retcode = http_perform(handle);
+        http_count_transfer(handle, dstbuf.str ? dstbuf.str->len : 0);
+        release_curl_handle (url, handle);
         if (hdrs != NULL) curl_slist_free_all(hdrs);
 
         if (retcode != CURLE_OK) {
                 g_warning("Error posting to URL %s", url);
-                g_free(dstbuf.buffer);
-                dstbuf.buffer = NULL;
+                http_buffer_free(&dstbuf);
         }
 
         if (retbuf != NULL) {
-                if (dstbuf.buffer != NULL) {
-                        dstbuf.buffer[dstbuf.size] = '\0';
+                *retbuf = http_buffer_steal(&dstbuf, retbufsize);
+        }
+        return (retcode == CURLE_OK);
+}
+
+static xmlDoc *
+http_request_xml                        (const char       *url,
+                                         const char       *postdata,
+                                         const GSList     *headers,
+                                         http_xml_root_cb  root_cb,
+                                         gpointer          root_cb_data)
+{
+        http_xml_parser parser = { NULL, root_cb, root_cb_data,
+                                   FALSE, FALSE, 0 };
+        CURLcode retcode;
+        CURL *handle;
+        struct curl_slist *hdrs = NULL;
+        const GSList *iter;
+
+        hdrs = curl_slist_append(hdrs, "User-Agent: " APP_FULLNAME);
+        for (iter = headers; iter != NULL; iter = g_slist_next(iter)) {
+                hdrs = curl_slist_append(hdrs, iter->data);
+        }
+
+        handle = get_curl_handle (url);
+        curl_easy_setopt(handle, CURLOPT_URL, url);
+        curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, http_parse_xml);
+        curl_easy_setopt(handle, CURLOPT_WRITEDATA, &parser);
+        curl_easy_setopt(handle, CURLOPT_HTTPHEADER, hdrs);
+        if (postdata != NULL) {
+                curl_easy_setopt(handle, CURLOPT_POSTFIELDS, postdata);
+        }
+        http_enable_compression(handle);
+        retcode = http_perform(handle);
+        http_count_transfer(handle, parser.received);
+        release_curl_handle (url, handle);
+        if (hdrs != NULL) curl_slist_free_all(hdrs);
+
+        if (retcode != CURLE_OK && !parser.aborted) {
+                g_warning("Error in request to URL %s", url);
+        }
+
+        return http_xml_parser_finish (&parser, retcode == CURLE_OK);
+}
+
+gboolean
+http_get_xml                            (const char        *url,
+                                         http_xml_root_cb   root_cb,
+                                         gpointer           root_cb_data,
+                                         xmlDoc           **doc)
+{
+        g_return_val_if_fail(url != NULL && doc != NULL, FALSE);
+        const char *pwpos = strstr(url, "passwordmd5=");
+        if (pwpos == NULL) {
+                g_debug("Requesting URL %s", url);
+        } else {
+                char *newurl = g_strndup(url, pwpos - url);
+                g_debug("Requesting URL %spasswordmd5=<hidden>", newurl);
+                g_free(newurl);
+        }
+        *doc = http_request_xml (url, NULL, NULL, root_cb, root_cb_data);
+        return (*doc != NULL);
+}
+
+gboolean
+http_post_xml                           (const char        *url,
+                                         const char        *postdata,
+                                         const GSList      *headers,
+                                         http_xml_root_cb   root_cb,
+                                         gpointer           root_cb_data,
+                                         xmlDoc           **doc)
+{
+        g_return_val_if_fail(url && postdata && doc, FALSE);
+        g_debug("Posting to URL %s\n%s", url, postdata);
+        *doc = http_request_xml (url, postdata, headers,
+                                 root_cb, root_cb_data);
+        return (*doc != NULL);
+}
+
+static void
+http_async_request_destroy              (http_async_request *req)
+{
+        if (req->handle != NULL) {
+                release_curl_handle (req->url, req->handle);
+        }
+        if (req->hdrs != NULL) curl_slist_free_all (req->hdrs);
+        http_buffer_free (&(req->dstbuf));
+        g_free (req->url);
+        g_free (req->postdata);
+        g_slice_free (http_async_request, req);
+}
+
+/* Run the callback of a finished request. This is an idle handler so
+ * the callback is called with the GDK lock held, same as the rest of
+ * the code that updates the UI after a network operation */
+static gboolean
+http_async_request_done_idle            (gpointer data)
+{
+        http_async_request *req = data;
+        if (req->cb != NULL) {
+                size_t bufsize;
+                char *buffer = http_buffer_steal (&(req->dstbuf), &bufsize);
+                (*(req->cb)) (buffer, bufsize, req->userdata);
+        }
+        http_async_request_destroy (req);
+        return FALSE;
+}
+
+static void
+http_multi_check_done                   (void)
+{
+        CURLMsg *msg;
+        int pending;
+        while ((msg = curl_multi_info_read (multi_handle, &pending))) {
+                if (msg->msg == CURLMSG_DONE) {
+                        CURL *handle = msg->easy_handle;
+                        CURLcode retcode = msg->data.result;
+                        http_async_request *req = NULL;
+                        curl_easy_getinfo (handle, CURLINFO_PRIVATE, &req);
+                        curl_multi_remove_handle (multi_handle, handle);
+                        async_requests = g_slist_remove (async_requests, req);
+                        http_count_transfer (handle, req->dstbuf.str ?
+                                             req->dstbuf.str->len : 0);
+                        http_record_timing (handle, req->tag, retcode);
+                        release_curl_handle (req->url, handle);
+                        req->handle = NULL;
+                        if (retcode != CURLE_OK) {
+                                g_warning ("Error in request to URL %s: %s",
+                                           req->url,
+                                           curl_easy_strerror (retcode));
+                                http_buffer_free (&(req->dstbuf));
+                        }
+                        gdk_threads_add_idle (http_async_request_done_idle,
+                                              req);
+                }
+        }
+}
+
+static gboolean
+http_multi_timeout_cb                   (gpointer data)
+{
+        int running;
+        multi_timeout_id = 0;
+        curl_multi_socket_action (multi_handle, CURL_SOCKET_TIMEOUT, 0,
+                                  &running);
+        http_multi_check_done ();
+        return FALSE;
+}
+
+static int
+http_multi_timer_cb                     (CURLM *multi,
+                                         long   timeout_ms,
+                                         void  *userp)
+{
+        if (multi_timeout_id != 0) {
+                g_source_remove (multi_timeout_id);
+                multi_timeout_id = 0;
+        }
+        if (timeout_ms >= 0) {
+                multi_timeout_id = g_timeout_add (timeout_ms,
+                                                  http_multi_timeout_cb,
+                                                  NULL);
+        }
+        return 0;
+}
+
+static gboolean
+http_multi_io_cb                        (GIOChannel   *channel,
+                                         GIOCondition  cond,
+                                         gpointer      data)
+{
+        int running, action = 0;
+        if (cond & (G_IO_IN | G_IO_HUP)) action |= CURL_CSELECT_IN;
+        if (cond & G_IO_OUT) action |= CURL_CSELECT_OUT;
+        if (cond & G_IO_ERR) action |= CURL_CSELECT_ERR;
+        curl_multi_socket_action (multi_handle,
+                                  g_io_channel_unix_get_fd (channel),
+                                  action, &running);
+        http_multi_check_done ();
+        return TRUE;
+}
+
+/* Called by curl to tell which sockets must be watched. The ID of the
+ * GSource watching each socket is stored using curl_multi_assign() */
+static int
+http_multi_socket_cb                    (CURL          *easy,
+                                         curl_socket_t  s,
+                                         int            what,
+                                         void          *userp,
+                                         void          *socketp)
+{
+        guint *watch_id = socketp;
+
+        if (watch_id != NULL) {
+                g_source_remove (*watch_id);
+        }
+
+        if (what == CURL_POLL_REMOVE) {
+                if (watch_id != NULL) {
+                        curl_multi_assign (multi_handle, s, NULL);
+                        g_slice_free (guint, watch_id);
                 }
-                *retbuf = dstbuf.buffer;
-                if (retbufsize != NULL) {
-                        *retbufsize = dstbuf.size;
+        } else {
+                GIOChannel *channel = g_io_channel_unix_new (s);
+                GIOCondition cond = G_IO_ERR;
+                if (what & CURL_POLL_IN) cond |= G_IO_IN | G_IO_HUP;
+                if (what & CURL_POLL_OUT) cond |= G_IO_OUT;
+                if (watch_id == NULL) {
+                        watch_id = g_slice_new (guint);
+                        curl_multi_assign (multi_handle, s, watch_id);
                 }
+                *watch_id = g_io_add_watch (channel, cond,
+                                            http_multi_io_cb, NULL);
+                g_io_channel_unref (channel);
         }
-        return (retcode == CURLE_OK);
+
+        return 0;
+}
+
+/* Add a request to the multi handle. Its proxy must be known
+ * already, see http_async_request_start() */
+static void
+http_async_request_add                  (http_async_request *req)
+{
+        req->handle = get_curl_handle (req->url);
+        curl_easy_setopt (req->handle, CURLOPT_URL, req->url);
+        curl_easy_setopt (req->handle, CURLOPT_PRIVATE, req);
+        curl_easy_setopt (req->handle, CURLOPT_WRITEFUNCTION,
+                          http_copy_buffer);
+        req->dstbuf.handle = req->handle;
+        curl_easy_setopt (req->handle, CURLOPT_WRITEDATA, &(req->dstbuf));
+        curl_easy_setopt (req->handle, CURLOPT_HTTPHEADER, req->hdrs);
+        http_enable_compression (req->handle);
+        if (req->postdata != NULL) {
+                curl_easy_setopt (req->handle, CURLOPT_POSTFIELDS,
+                                  req->postdata);
+        }
+
+        /* This will call http_multi_timer_cb() and the request
+         * will start as soon as the main loop runs */
+        curl_multi_add_handle (multi_handle, req->handle);
+}
+
+static gboolean
+http_async_resolve_proxy_idle           (gpointer data)
+{
+        http_async_request *req = data;
+        if (req->cancelled) {
+                http_async_request_destroy (req);
+        } else {
+                http_async_request_add (req);
+        }
+        return FALSE;
+}
+
+static gpointer
+http_async_resolve_proxy_thread         (gpointer data)
+{
+#ifdef HAVE_LIBPROXY
+        http_async_request *req = data;
+        g_free (http_resolve_system_proxy (req->url));
+#endif
+        gdk_threads_add_idle (http_async_resolve_proxy_idle, data);
+        return NULL;
+}
+
+static void
+http_async_request_start                (http_async_request *req)
+{
+        if (G_UNLIKELY (multi_handle == NULL)) {
+                multi_handle = curl_multi_init ();
+                curl_multi_setopt (multi_handle, CURLMOPT_SOCKETFUNCTION,
+                                   http_multi_socket_cb);
+                curl_multi_setopt (multi_handle, CURLMOPT_TIMERFUNCTION,
+                                   http_multi_timer_cb);
+        }
+
+        async_requests = g_slist_prepend (async_requests, req);
+
+        /* libproxy can block for a long time, so if the proxy is not
+         * in the cache it is resolved in a separate thread first */
+        if (http_system_proxy_is_stale (req->url)) {
+                g_thread_create (http_async_resolve_proxy_thread, req,
+                                 FALSE, NULL);
+        } else {
+                http_async_request_add (req);
+        }
+}
+
+static http_async_request *
+http_async_request_new                  (const char      *url,
+                                         const char      *postdata,
+                                         const GSList    *headers,
+                                         http_request_cb  cb,
+                                         gpointer         userdata)
+{
+        const GSList *iter;
+        http_async_request *req = g_slice_new0 (http_async_request);
+        req->url = g_strdup (url);
+        req->postdata = g_strdup (postdata);
+        req->cb = cb;
+        req->userdata = userdata;
+        req->tag = http_take_request_tag ();
+        req->hdrs = curl_slist_append (NULL, "User-Agent: " APP_FULLNAME);
+        for (iter = headers; iter != NULL; iter = g_slist_next (iter)) {
+                req->hdrs = curl_slist_append (req->hdrs, iter->data);
+        }
+        return req;
+}
+
+void
+http_get_buffer_async                   (const char      *url,
+                                         http_request_cb  cb,
+                                         gpointer         userdata)
+{
+        http_async_request *req;
+        const char *pwpos;
+
+        g_return_if_fail (url != NULL);
+        /* The async requests are not protected by any lock */
+        g_return_if_fail (g_main_context_is_owner (NULL));
+
+        pwpos = strstr (url, "passwordmd5=");
+        if (pwpos == NULL) {
+                g_debug ("Requesting URL %s (async)", url);
+        } else {
+                char *newurl = g_strndup (url, pwpos - url);
+                g_debug ("Requesting URL %spasswordmd5=<hidden> (async)",
+                         newurl);
+                g_free (newurl);
+        }
+
+        req = http_async_request_new (url, NULL, NULL, cb, userdata);
+        http_async_request_start (req);
+}
+
+void
+http_post_buffer_async                  (const char      *url,
+                                         const char      *postdata,
+                                         const GSList    *headers,
+                                         http_request_cb  cb,
+                                         gpointer         userdata)
+{
+        http_async_request *req;
+
+        g_return_if_fail (url != NULL && postdata != NULL);
+        /* The async requests are not protected by any lock */
+        g_return_if_fail (g_main_context_is_owner (NULL));
+
+        g_debug ("Posting to URL %s (async)\n%s", url, postdata);
+        req = http_async_request_new (url, postdata, headers, cb, userdata);
+        http_async_request_start (req);
+}
+
+void
+http_cleanup                            (void)
+{
+        /* Requests still in progress are cancelled without
+         * calling their callbacks */
+        if (multi_handle != NULL) {
+                while (async_requests != NULL) {
+                        http_async_request *req = async_requests->data;
+                        if (req->handle != NULL) {
+                                curl_multi_remove_handle (multi_handle,
+                                                          req->handle);
+                                http_async_request_destroy (req);
+                        } else {
+                                /* Freed once its proxy is resolved, see
+                                 * http_async_resolve_proxy_idle() */
+                                req->cancelled = TRUE;
+                        }
+                        async_requests = g_slist_delete_link (async_requests,
+                                                              async_requests);
+                }
+                if (multi_timeout_id != 0) {
+                        g_source_remove (multi_timeout_id);
+                        multi_timeout_id = 0;
+                }
+                curl_multi_cleanup (multi_handle);
+                multi_handle = NULL;
+        }
+        g_static_mutex_lock (&pool_mutex);
+        if (handle_pool != NULL) {
+                g_hash_table_destroy (handle_pool);
+                handle_pool = NULL;
+        }
+        g_static_mutex_unlock (&pool_mutex);
+
+        /* All handles are gone now, so the share can be destroyed */
+        if (share_handle != NULL) {
+                guint requests, conn_reused;
+                guint64 wire, decoded;
+                http_get_cache_stats (&requests, &conn_reused);
+                http_get_transfer_stats (&wire, &decoded);
+                g_debug ("HTTP cache: %u requests, %u reused connections",
+                         requests, conn_reused);
+                g_debug ("HTTP transfers: %" G_GUINT64_FORMAT " bytes "
+                         "received, %" G_GUINT64_FORMAT " after "
+                         "decompression", wire, decoded);
+                curl_share_cleanup (share_handle);
+                share_handle = NULL;
+        }
+}
+
+void
+http_get_cache_stats                    (guint *requests,
+                                         guint *conn_reused)
+{
+        if (requests != NULL) {
+                *requests = g_atomic_int_get (&stats_requests);
+        }
+        if (conn_reused != NULL) {
+                *conn_reused = g_atomic_int_get (&stats_conn_reused);
+        }
+}
+
+void
+http_get_transfer_stats                 (guint64 *wire_bytes,
+                                         guint64 *decoded_bytes)
+{
+        g_static_mutex_lock (&transfer_stats_mutex);
+        if (wire_bytes != NULL) {
+                *wire_bytes = stats_wire_bytes;
+        }
+        if (decoded_bytes != NULL) {
+                *decoded_bytes = stats_decoded_bytes;
+        }
+        g_static_mutex_unlock (&transfer_stats_mutex);
 }
@@ -12,16 +12,54 @@
 #define HTTP_H
 
 #include <glib.h>
+#include <libxml/tree.h>
 
 typedef gboolean
 (*http_download_progress_cb)            (gpointer userdata,
                                          double   dltotal,
                                          double   dlnow);
 
+/* Callback for asynchronous requests, called from the main loop with
+ * the GDK lock held. buffer is NULL if the request failed, otherwise
+ * it's owned by the callback and must be freed with g_free(). The
+ * *_async() functions must be called from the main thread */
+typedef void
+(*http_request_cb)                      (char     *buffer,
+                                         size_t    bufsize,
+                                         gpointer  userdata);
+
+/* Called by http_get_stream() for each chunk of data received.
+ * Return FALSE to abort the download */
+typedef gboolean
+(*http_stream_cb)                       (const char *data,
+                                         size_t      size,
+                                         gpointer    userdata);
+
+/* Result of http_get_stream(). HTTP_STREAM_FAILED means that the
+ * connection failed, stalled or was closed too early (so it makes
+ * sense to try again), HTTP_STREAM_REJECTED that the server replied
+ * with an error */
+typedef enum {
+        HTTP_STREAM_DONE,
+        HTTP_STREAM_CANCELLED,
+        HTTP_STREAM_FAILED,
+        HTTP_STREAM_REJECTED
+} http_stream_result;
+
+/* Called by http_get_xml() and http_post_xml() as soon as the root
+ * element of the document has been parsed (its children are not
+ * available yet). Return FALSE to abort the download */
+typedef gboolean
+(*http_xml_root_cb)                     (const xmlNode *root,
+                                         gpointer       userdata);
+
 void
 http_set_proxy                          (const char *proxy,
                                          gboolean    use_system_proxy);
 
+void
+http_invalidate_proxy_cache             (void);
+
 char *
 escape_url                              (const char *url,
                                          gboolean    escape);
@@ -32,9 +70,34 @@ http_get_buffer                         (const char  *url,
                                          size_t      *bufsize);
 
 gboolean
-http_get_to_fd                          (const char   *url,
-                                         int           fd,
-                                         const GSList *headers);
+http_get_xml                            (const char        *url,
+                                         http_xml_root_cb   root_cb,
+                                         gpointer           root_cb_data,
+                                         xmlDoc           **doc);
+
+gboolean
+http_post_xml                           (const char        *url,
+                                         const char        *postdata,
+                                         const GSList      *headers,
+                                         http_xml_root_cb   root_cb,
+                                         gpointer           root_cb_data,
+                                         xmlDoc           **doc);
+
+http_stream_result
+http_get_stream                         (const char     *url,
+                                         const GSList   *headers,
+                                         guint64         offset,
+                                         http_stream_cb  cb,
+                                         gpointer        userdata);
+
+gint64
+http_get_content_length                 (const char *url);
+
+gboolean
+http_get_range                          (const char *url,
+                                         guint64     offset,
+                                         char       *buffer,
+                                         size_t      length);
 
 gboolean
 http_download_file                      (const char                *url,
@@ -49,7 +112,33 @@ http_post_buffer                        (const char    *url,
                                          size_t        *retbufsize,
                                          const GSList  *headers);
 
+void
+http_get_buffer_async                   (const char      *url,
+                                         http_request_cb  cb,
+                                         gpointer         userdata);
+
+void
+http_post_buffer_async                  (const char      *url,
+                                         const char      *postdata,
+                                         const GSList    *headers,
+                                         http_request_cb  cb,
+                                         gpointer         userdata);
+
+void
+http_set_request_tag                    (const char *tag);
+
 void
 http_init                               (void);
 
+void
+http_cleanup                            (void);
+
+void
+http_get_cache_stats                    (guint *requests,
+                                         guint *conn_reused);
+
+void
+http_get_transfer_stats                 (guint64 *wire_bytes,
+                                         guint64 *decoded_bytes);
+
 #endif
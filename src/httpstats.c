@@ -0,0 +1,168 @@
+/*
+ * httpstats.c -- Timing statistics of HTTP requests
+ *
+ * Copyright (C) 2007-2008 Igalia, S.L.
+ * Authors: Alberto Garcia <berto@igalia.com>
+ *
+ * This file is part of Vagalume and is published under the GNU GPLv3
+ * See the README file for more details.
+ */
+
+#include "httpstats.h"
+
+#include <string.h>
+
+/* Number of recent requests of each kind used for the histograms */
+#define HTTP_STATS_WINDOW 64
+
+/* Upper limits (in seconds) of the buckets of the histograms. There's
+ * an additional bucket for requests slower than the last limit */
+static const double bucket_limits[] = {
+        0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+};
+#define HTTP_STATS_BUCKETS (G_N_ELEMENTS (bucket_limits) + 1)
+
+typedef struct {
+        guint count;
+        guint errors;
+        guint64 bytes;
+        http_timing window[HTTP_STATS_WINDOW];
+        guint window_pos;
+        guint window_len;
+} http_stats_entry;
+
+/* Interned tag -> http_stats_entry. Protected by stats_mutex */
+static GStaticMutex stats_mutex = G_STATIC_MUTEX_INIT;
+static GHashTable *stats_table = NULL;
+
+static void
+http_stats_entry_destroy                (http_stats_entry *entry)
+{
+        g_slice_free (http_stats_entry, entry);
+}
+
+/**
+ * Record the timings of a finished request. Only the last
+ * HTTP_STATS_WINDOW requests with the same tag are kept, but the
+ * request and byte counters are never reset. Thread-safe.
+ * @param tag The logical operation the request belongs to
+ * @param timing The timings of the request
+ */
+void
+http_stats_add                          (const char        *tag,
+                                         const http_timing *timing)
+{
+        http_stats_entry *entry;
+
+        g_return_if_fail (tag != NULL && timing != NULL);
+
+        tag = g_intern_string (tag);
+
+        g_static_mutex_lock (&stats_mutex);
+        if (G_UNLIKELY (stats_table == NULL)) {
+                stats_table = g_hash_table_new_full (
+                        g_direct_hash, g_direct_equal, NULL,
+                        (GDestroyNotify) http_stats_entry_destroy);
+        }
+        entry = g_hash_table_lookup (stats_table, tag);
+        if (entry == NULL) {
+                entry = g_slice_new0 (http_stats_entry);
+                g_hash_table_insert (stats_table, (gpointer) tag, entry);
+        }
+        entry->count++;
+        if (!timing->success) entry->errors++;
+        entry->bytes += timing->bytes;
+        entry->window[entry->window_pos] = *timing;
+        entry->window_pos = (entry->window_pos + 1) % HTTP_STATS_WINDOW;
+        if (entry->window_len < HTTP_STATS_WINDOW) entry->window_len++;
+        g_static_mutex_unlock (&stats_mutex);
+}
+
+static void
+http_stats_dump_entry                   (GString                *str,
+                                         const char             *tag,
+                                         const http_stats_entry *entry)
+{
+        guint histogram[HTTP_STATS_BUCKETS] = { 0 };
+        double dns = 0, connect = 0, tls = 0, ttfb = 0, total = 0;
+        double max_total = 0;
+        guint i, j;
+
+        for (i = 0; i < entry->window_len; i++) {
+                const http_timing *t = &(entry->window[i]);
+                dns += t->dns;
+                connect += t->connect;
+                tls += t->tls;
+                ttfb += t->ttfb;
+                total += t->total;
+                if (t->total > max_total) max_total = t->total;
+                for (j = 0; j < G_N_ELEMENTS (bucket_limits); j++) {
+                        if (t->total < bucket_limits[j]) break;
+                }
+                histogram[j]++;
+        }
+
+        g_string_append_printf (str, "%s: %u requests (%u failed), "
+                                "%" G_GUINT64_FORMAT " bytes\n",
+                                tag, entry->count, entry->errors,
+                                entry->bytes);
+
+        if (entry->window_len == 0) return;
+
+        /* Averages in milliseconds */
+        g_string_append_printf (str, "  avg ms: dns %.1f, connect %.1f, "
+                                "tls %.1f, ttfb %.1f, total %.1f "
+                                "(max %.1f)\n",
+                                dns * 1000 / entry->window_len,
+                                connect * 1000 / entry->window_len,
+                                tls * 1000 / entry->window_len,
+                                ttfb * 1000 / entry->window_len,
+                                total * 1000 / entry->window_len,
+                                max_total * 1000);
+
+        g_string_append (str, "  total:");
+        for (j = 0; j < G_N_ELEMENTS (bucket_limits); j++) {
+                g_string_append_printf (str, " <%gs:%u",
+                                        bucket_limits[j], histogram[j]);
+        }
+        g_string_append_printf (str, " >=%gs:%u\n",
+                                bucket_limits[j - 1], histogram[j]);
+}
+
+static gint
+http_stats_compare_tags                 (gconstpointer a,
+                                         gconstpointer b)
+{
+        return strcmp (a, b);
+}
+
+/**
+ * Write a human-readable report of the statistics, with one section
+ * per tag (sorted by name) containing the averages and a histogram
+ * of the total time of the last HTTP_STATS_WINDOW requests.
+ * @return A newly allocated string, to be freed with g_free()
+ */
+char *
+http_stats_dump                         (void)
+{
+        GString *str = g_string_new (NULL);
+        GList *tags, *iter;
+
+        g_string_append_printf (str, "HTTP requests (timings of the last "
+                                "%d of each kind):\n", HTTP_STATS_WINDOW);
+
+        g_static_mutex_lock (&stats_mutex);
+        if (stats_table != NULL) {
+                tags = g_hash_table_get_keys (stats_table);
+                tags = g_list_sort (tags, http_stats_compare_tags);
+                for (iter = tags; iter != NULL; iter = iter->next) {
+                        http_stats_entry *entry;
+                        entry = g_hash_table_lookup (stats_table, iter->data);
+                        http_stats_dump_entry (str, iter->data, entry);
+                }
+                g_list_free (tags);
+        }
+        g_static_mutex_unlock (&stats_mutex);
+
+        return g_string_free (str, FALSE);
+}
@@ -0,0 +1,37 @@
+/*
+ * httpstats.h -- Timing statistics of HTTP requests
+ *
+ * Copyright (C) 2007-2008 Igalia, S.L.
+ * Authors: Alberto Garcia <berto@igalia.com>
+ *
+ * This file is part of Vagalume and is published under the GNU GPLv3
+ * See the README file for more details.
+ */
+
+#ifndef HTTPSTATS_H
+#define HTTPSTATS_H
+
+#include <glib.h>
+
+/* Timings of a finished request, in seconds. dns, connect and tls are
+ * the time spent in each of those phases (0 if the phase was skipped
+ * because of a cached lookup or a reused connection), ttfb and total
+ * are measured from the start of the request */
+typedef struct {
+        double dns;
+        double connect;
+        double tls;
+        double ttfb;
+        double total;
+        guint64 bytes;
+        gboolean success;
+} http_timing;
+
+void
+http_stats_add                          (const char        *tag,
+                                         const http_timing *timing);
+
+char *
+http_stats_dump                         (void);
+
+#endif
@@ -16,6 +16,7 @@
 
 #include <string.h>
 #include <stdarg.h>
+#include <stdlib.h>
 
 /* Uncomment this to use the new album.getInfo() web service to obtain
  * album tags. Note that it gives less results than the old method */
@@ -38,35 +39,23 @@ struct _LastfmWsSession {
         GMutex *mutex;
 };
 
-/* Name/value pairs for URL parameters */
+/* Number of parameters preallocated for a method call, including
+ * 'method' and 'api_key'. No method needs more than this */
+#define LASTFM_WS_PREALLOC_PARAMS 16
+
+/* Name/value pairs for URL parameters. They point to the strings
+ * passed by the caller, which are valid while the URL is built */
 typedef struct {
-        char *name;
-        char *value;
+        const char *name;
+        const char *value;
 } LastfmWsParameter;
 
-static LastfmWsParameter *
-lastfm_ws_parameter_new                 (const char *name,
-                                         const char *value)
-{
-        LastfmWsParameter *p = g_slice_new (LastfmWsParameter);
-        p->name  = g_strdup (name);
-        p->value = g_strdup (value);
-        return p;
-}
-
 static int
-lastfm_ws_parameter_compare             (const LastfmWsParameter *a,
-                                         const LastfmWsParameter *b)
+lastfm_ws_parameter_compare             (const void *a,
+                                         const void *b)
 {
-        return strcmp (a->name, b->name);
-}
-
-static void
-lastfm_ws_parameter_destroy             (LastfmWsParameter *param)
-{
-        g_free (param->name);
-        g_free (param->value);
-        g_slice_free (LastfmWsParameter, param);
+        return strcmp (((const LastfmWsParameter *) a)->name,
+                       ((const LastfmWsParameter *) b)->name);
 }
 
 static void
@@ -117,17 +106,18 @@ lastfm_ws_session_get_v1_session        (LastfmWsSession *session)
 }
 
 static void
-lastfm_ws_sign_url                      (GString     *url,
-                                         const GList *params,
-                                         const char  *api_secret)
+lastfm_ws_sign_url                      (GString                 *url,
+                                         const LastfmWsParameter *params,
+                                         guint                    n_params,
+                                         const char              *api_secret)
 {
-        const GList *iter;
+        guint i;
         char *md5;
         GString *sig = g_string_sized_new (200);
 
-        for (iter = params; iter != NULL; iter = iter->next) {
-                LastfmWsParameter *p = (LastfmWsParameter *) iter->data;
-                g_string_append_printf (sig, "%s%s", p->name, p->value);
+        for (i = 0; i < n_params; i++) {
+                g_string_append (sig, params[i].name);
+                g_string_append (sig, params[i].value);
         }
 
         g_string_append (sig, api_secret);
@@ -140,13 +130,14 @@ lastfm_ws_sign_url                      (GString     *url,
 }
 
 static char *
-lastfm_ws_format_params                 (const VglServer *srv,
-                                         HttpRequestType  type,
-                                         gboolean         add_api_sig,
-                                         const GList     *params)
+lastfm_ws_format_params                 (const VglServer         *srv,
+                                         HttpRequestType          type,
+                                         gboolean                 add_api_sig,
+                                         const LastfmWsParameter *params,
+                                         guint                    n_params)
 {
         GString *url;
-        const GList *iter;
+        guint i;
 
         g_return_val_if_fail (srv != NULL, NULL);
 
@@ -158,26 +149,160 @@ lastfm_ws_format_params                 (const VglServer *srv,
                 g_string_append_c (url, '?');
         }
 
-        for (iter = params; iter != NULL; iter = iter->next) {
-                LastfmWsParameter *p = (LastfmWsParameter *) iter->data;
-                char *encvalue = escape_url (p->value, TRUE);
-                g_string_append_printf (url, "%s=%s", p->name, encvalue);
-                g_free (encvalue);
+        for (i = 0; i < n_params; i++) {
+                g_string_append (url, params[i].name);
+                g_string_append_c (url, '=');
+                url_escape_gstr (url, params[i].value);
 
-                if (iter->next != NULL) {
+                if (i + 1 < n_params) {
                         g_string_append_c (url, '&');
                 }
         }
 
         if (add_api_sig) {
                 /* Compute and append API signature */
-                lastfm_ws_sign_url (url, params, srv->api_secret);
+                lastfm_ws_sign_url (url, params, n_params, srv->api_secret);
         }
 
         /* Return */
         return g_string_free (url, FALSE);
 }
 
+/**
+ * Create the URL (for GET) or the POST data of a web service request
+ * @param srv The server
+ * @param method The web service method
+ * @param type Whether this is a GET or a POST request
+ * @param add_api_sig Whether to sign the request
+ * @param args NULL-terminated list of name/value pairs
+ * @return A newly allocated string
+ */
+static char *
+lastfm_ws_build_request                 (const VglServer  *srv,
+                                         const char       *method,
+                                         HttpRequestType   type,
+                                         gboolean          add_api_sig,
+                                         va_list           args)
+{
+        GArray *params;
+        LastfmWsParameter p;
+        char *retvalue;
+
+        params = g_array_sized_new (FALSE, FALSE, sizeof (LastfmWsParameter),
+                                    LASTFM_WS_PREALLOC_PARAMS);
+
+        /* Add 'method' and 'api_key' parameters */
+        p.name = "method";
+        p.value = method;
+        g_array_append_val (params, p);
+        p.name = "api_key";
+        p.value = srv->api_key;
+        g_array_append_val (params, p);
+
+        /* Add all other parameters. The array grows if needed, every
+         * parameter must be signed and sent */
+        p.name = va_arg (args, char *);
+        while (p.name != NULL) {
+                p.value = va_arg (args, char *);
+                g_array_append_val (params, p);
+                p.name = va_arg (args, char *);
+        }
+
+        /* Sort parameters alphabetically */
+        g_array_sort (params, lastfm_ws_parameter_compare);
+
+        retvalue = lastfm_ws_format_params (srv, type, add_api_sig,
+                                            (LastfmWsParameter *) params->data,
+                                            params->len);
+        g_array_free (params, TRUE);
+        return retvalue;
+}
+
+/**
+ * Check the root element of a web service response as soon as it
+ * has been parsed, so the download can be aborted if the server
+ * returns something unexpected (e.g. an HTML error page).
+ * @param root The root element
+ * @param data Not used
+ * @return Whether the root element is <lfm status="...">
+ */
+static gboolean
+lastfm_ws_check_root                    (const xmlNode *root,
+                                         gpointer       data)
+{
+        gboolean retvalue = FALSE;
+        if (xmlStrEqual (root->name, (xmlChar *) "lfm")) {
+                xmlChar *status = xmlGetProp ((xmlNode *) root,
+                                              (xmlChar *) "status");
+                if (status) {
+                        retvalue = TRUE;
+                        /* The <error> element comes later, so failed
+                         * responses still need to be fully parsed */
+                        if (!xmlStrEqual (status, (xmlChar *) "ok")) {
+                                g_debug ("Web service returned status %s",
+                                         (char *) status);
+                        }
+                        xmlFree (status);
+                }
+        }
+        return retvalue;
+}
+
+/**
+ * Validate the <lfm> root node of a web service response
+ * @param doc The XML doc, or NULL. It will be freed if the response
+ *            is not valid
+ * @param error_code Where the Last.fm error code will be stored, or NULL
+ * @param node Where the first child of the root node will be stored
+ * @return Whether the response is valid and has status="ok"
+ */
+static gboolean
+lastfm_ws_check_response                (xmlDoc        **doc,
+                                         gint           *error_code,
+                                         const xmlNode **node)
+{
+        gboolean retvalue = FALSE;
+
+        *node = NULL;
+        if (error_code != NULL) {
+                *error_code = 0;
+        }
+
+        if (*doc != NULL) {
+                xmlNode *n = xmlDocGetRootElement (*doc);
+                if ((n = (xmlNode *) xml_find_node (n, "lfm"))) {
+                        xmlChar *status;
+                        status = xmlGetProp (n, (xmlChar *) "status");
+                        if (status) {
+                                retvalue = xmlStrEqual (
+                                        status, (xmlChar *) "ok");
+                                xmlFree (status);
+                        }
+                        n = n->xmlChildrenNode;
+                        if (retvalue) {
+                                *node = n;
+                        }
+                }
+                if (!retvalue && error_code != NULL) {
+                        n = (xmlNode *) xml_find_node (n, "error");
+                        if (n != NULL) {
+                                xmlChar *err;
+                                err = xmlGetProp (n, (xmlChar *) "code");
+                                if (err) {
+                                        *error_code = atol ((char *) err);
+                                        xmlFree (err);
+                                }
+                        }
+                }
+                if (!retvalue) {
+                        xmlFreeDoc (*doc);
+                        *doc = NULL;
+                }
+        }
+
+        return retvalue;
+}
+
 static gboolean
 lastfm_ws_http_request                  (const VglServer  *srv,
                                          const char       *method,
@@ -188,92 +313,139 @@ lastfm_ws_http_request                  (const VglServer  *srv,
                                          const xmlNode   **node,
                                          ...)
 {
-        gboolean retvalue = FALSE;
-        const char *name;
-        char *buffer, *url;
-        size_t bufsize;
-        GList *l = NULL;
+        char *url;
         va_list args;
 
         g_return_val_if_fail (srv && method && doc && node, FALSE);
 
-        *doc  = NULL;
-        *node = NULL;
-        if (error_code != NULL) {
-                *error_code = 0;
-        }
-
-        /* Add all parameters to a list */
+        /* Create URL and make HTTP request. The response is parsed
+         * while it's being downloaded */
         va_start (args, node);
-        name = va_arg (args, char *);
-        while (name != NULL) {
-                const char *value = va_arg (args, char *);
-                l = g_list_prepend (l, lastfm_ws_parameter_new (name, value));
-                name = va_arg (args, char *);
-        }
+        url = lastfm_ws_build_request (srv, method, type, add_api_sig, args);
         va_end (args);
 
-        /* Add 'method' and 'api_key' parameters */
-        l = g_list_prepend (l, lastfm_ws_parameter_new ("method", method));
-        l = g_list_prepend (l, lastfm_ws_parameter_new ("api_key",
-                                                        srv->api_key));
-
-        /* Sort list alphabetically */
-        l = g_list_sort (l, (GCompareFunc) lastfm_ws_parameter_compare);
-
-        /* Create URL and make HTTP request */
-        url = lastfm_ws_format_params (srv, type, add_api_sig, l);
+        http_set_request_tag (method);
         if (type == HTTP_REQUEST_GET) {
-                http_get_buffer (url, &buffer, &bufsize);
+                http_get_xml (url, lastfm_ws_check_root, NULL, doc);
         } else {
-                http_post_buffer (srv->ws_base_url, url,
-                                  &buffer, &bufsize, NULL);
+                http_post_xml (srv->ws_base_url, url, NULL,
+                               lastfm_ws_check_root, NULL, doc);
         }
         g_free (url);
 
-        /* Parse response, create XML doc and validate the <lfm> root node */
+        return lastfm_ws_check_response (doc, error_code, node);
+}
+
+/**
+ * Make a GET request to the web service, returning the response
+ * without parsing it
+ * @param srv The server
+ * @param method The method to call
+ * @param add_api_sig Whether to sign the request
+ * @param buffer Where the response will be stored (NULL on failure)
+ * @param bufsize Where the size of the response will be stored
+ * @return Whether the request was successful
+ */
+static gboolean
+lastfm_ws_http_get_buffer               (const VglServer  *srv,
+                                         const char       *method,
+                                         gboolean          add_api_sig,
+                                         char            **buffer,
+                                         size_t           *bufsize,
+                                         ...)
+{
+        char *url;
+        va_list args;
+
+        g_return_val_if_fail (srv && method && buffer && bufsize, FALSE);
+
+        va_start (args, bufsize);
+        url = lastfm_ws_build_request (srv, method, HTTP_REQUEST_GET,
+                                       add_api_sig, args);
+        va_end (args);
+
+        http_set_request_tag (method);
+        http_get_buffer (url, buffer, bufsize);
+        g_free (url);
+
+        return (*buffer != NULL);
+}
+
+typedef struct {
+        lastfm_ws_cb cb;
+        gpointer userdata;
+} LastfmWsAsyncData;
+
+static void
+lastfm_ws_http_request_async_cb         (char     *buffer,
+                                         size_t    bufsize,
+                                         gpointer  userdata)
+{
+        LastfmWsAsyncData *d = userdata;
+        xmlDoc *doc = NULL;
+        const xmlNode *node;
+        gboolean retvalue;
+
         if (buffer != NULL) {
-                *doc = xmlParseMemory (buffer, bufsize);
-                if (*doc != NULL) {
-                        xmlNode *n = xmlDocGetRootElement (*doc);
-                        if ((n = (xmlNode *) xml_find_node (n, "lfm"))) {
-                                xmlChar *status;
-                                status = xmlGetProp (n, (xmlChar *) "status");
-                                if (status) {
-                                        retvalue = xmlStrEqual (
-                                                status, (xmlChar *) "ok");
-                                        xmlFree (status);
-                                }
-                                n = n->xmlChildrenNode;
-                                if (retvalue) {
-                                        *node = n;
-                                }
-                        }
-                        if (!retvalue && error_code != NULL) {
-                                n = (xmlNode *) xml_find_node (n, "error");
-                                if (n != NULL) {
-                                        xmlChar *err;
-                                        err = xmlGetProp (n,(xmlChar *)"code");
-                                        if (err) {
-                                                *error_code =
-                                                        atol ((char *) err);
-                                                xmlFree (err);
-                                        }
-                                }
-                        }
-                        if (!retvalue) {
-                                xmlFreeDoc (*doc);
-                                *doc = NULL;
-                        }
-                }
+                doc = xmlParseMemory (buffer, bufsize);
+        }
+        retvalue = lastfm_ws_check_response (&doc, NULL, &node);
+        if (doc != NULL) {
+                xmlFreeDoc (doc);
+        }
+        if (d->cb != NULL) {
+                (*(d->cb)) (retvalue, d->userdata);
         }
 
-        /* Cleanup */
-        g_list_foreach (l, (GFunc) lastfm_ws_parameter_destroy, NULL);
-        g_list_free (l);
         g_free (buffer);
+        g_slice_free (LastfmWsAsyncData, d);
+}
 
-        return retvalue;
+/**
+ * Make a web service request without blocking. This is meant for
+ * methods whose response has no data other than the status. Must be
+ * called from the main thread.
+ * @param srv The server
+ * @param method The web service method
+ * @param type Whether this is a GET or a POST request
+ * @param add_api_sig Whether to sign the request
+ * @param cb Function to call when the request is finished
+ * @param userdata Data passed to @cb
+ * @param ... NULL-terminated list of name/value pairs
+ */
+static void
+lastfm_ws_http_request_async            (const VglServer  *srv,
+                                         const char       *method,
+                                         HttpRequestType   type,
+                                         gboolean          add_api_sig,
+                                         lastfm_ws_cb      cb,
+                                         gpointer          userdata,
+                                         ...)
+{
+        LastfmWsAsyncData *d;
+        char *url;
+        va_list args;
+
+        g_return_if_fail (srv && method);
+
+        va_start (args, userdata);
+        url = lastfm_ws_build_request (srv, method, type, add_api_sig, args);
+        va_end (args);
+
+        d = g_slice_new (LastfmWsAsyncData);
+        d->cb = cb;
+        d->userdata = userdata;
+
+        http_set_request_tag (method);
+        if (type == HTTP_REQUEST_GET) {
+                http_get_buffer_async (url, lastfm_ws_http_request_async_cb,
+                                       d);
+        } else {
+                http_post_buffer_async (srv->ws_base_url, url, NULL,
+                                        lastfm_ws_http_request_async_cb, d);
+        }
+
+        g_free (url);
 }
 
 char *
@@ -484,8 +656,9 @@ lastfm_ws_radio_get_playlist            (const LastfmWsSession *session,
                                          gboolean               scrobbling)
 {
         LastfmPls *pls = NULL;
-        xmlDoc *doc;
-        const xmlNode *node;
+        char *buffer = NULL;
+        size_t bufsize;
+        gboolean ws_ok = FALSE;
 
         g_return_val_if_fail (session, NULL);
 
@@ -506,21 +679,26 @@ lastfm_ws_radio_get_playlist            (const LastfmWsSession *session,
                 }
         }
 
-        lastfm_ws_http_request (session->srv, "radio.getPlaylist",
-                                HTTP_REQUEST_GET, TRUE, NULL, &doc, &node,
-                                "discovery", discovery ? "1" : "0",
-                                "rtp", scrobbling ? "1" : "0",
-                                "sk", session->key,
-                                low_bitrate ? "bitrate" : NULL, "64",
-                                NULL);
+        /* The playlist is parsed with a streaming reader, so it's
+         * downloaded as a buffer instead of as an XML document */
+        lastfm_ws_http_get_buffer (session->srv, "radio.getPlaylist",
+                                   TRUE, &buffer, &bufsize,
+                                   "discovery", discovery ? "1" : "0",
+                                   "rtp", scrobbling ? "1" : "0",
+                                   "sk", session->key,
+                                   low_bitrate ? "bitrate" : NULL, "64",
+                                   NULL);
 
-        if (doc != NULL) {
+        if (buffer != NULL) {
                 g_mutex_lock (session->mutex);
-                pls = lastfm_parse_playlist (doc, session->radio_name,
-                                             session->srv->free_streams);
+                pls = lastfm_parse_playlist_buffer (
+                        buffer, bufsize, session->radio_name,
+                        session->srv->free_streams, &ws_ok);
                 g_mutex_unlock (session->mutex);
-                xmlFreeDoc (doc);
-        } else {
+                g_free (buffer);
+        }
+
+        if (!ws_ok) {
                 /* Fall back to the old streaming API if the new one
                  * doesn't work */
                 if (session->v1sess && !session->subscriber) {
@@ -533,6 +711,14 @@ lastfm_ws_radio_get_playlist            (const LastfmWsSession *session,
         return pls;
 }
 
+/* The <name> of a <user> or a <tag>, stored in a char * */
+static const XmlField name_fields[] = {
+        { "name", XML_FIELD_STRING, 0 },
+        { NULL }
+};
+
+static XmlFieldTable name_table = XML_FIELD_TABLE_INIT (name_fields);
+
 gboolean
 lastfm_ws_get_friends                   (const VglServer  *srv,
                                          const char       *user,
@@ -559,9 +745,9 @@ lastfm_ws_get_friends                   (const VglServer  *srv,
                         retvalue = TRUE;
                 }
                 while ((node = xml_find_node (node, "user"))) {
-                        char *name;
-                        xml_get_string (doc, node->xmlChildrenNode,
-                                        "name", &name);
+                        char *name = NULL;
+                        xml_parse_fields (doc, node->xmlChildrenNode,
+                                          &name_table, &name);
                         if (name) {
                                 list = g_list_append (list, name);
                         }
@@ -601,8 +787,9 @@ parse_xml_tags                          (xmlDoc         *doc,
         }
 
         while (iter != NULL) {
-                char *tag;
-                xml_get_string (doc, iter->xmlChildrenNode, "name", &tag);
+                char *tag = NULL;
+                xml_parse_fields (doc, iter->xmlChildrenNode,
+                                  &name_table, &tag);
                 if (tag != NULL && tag[0] != '\0') {
                         *list = g_list_prepend (*list, tag);
                 } else {
@@ -706,28 +893,24 @@ lastfm_ws_old_get_album_tags            (const LastfmTrack     *track,
 {
         const char album_tags_url[] =
                 "http://ws.audioscrobbler.com/1.0/album/%s/%s/toptags.xml";
-        char *artist, *album, *url, *buffer;
-        size_t bufsize;
+        char *artist, *album, *url;
+        xmlDoc *doc;
         gboolean found = FALSE;
 
         artist = lastfm_url_encode (track->album_artist);
         album = lastfm_url_encode (track->album);
         url = g_strdup_printf (album_tags_url, artist, album);
-        http_get_buffer (url, &buffer, &bufsize);
+        http_get_xml (url, NULL, NULL, &doc);
 
-        if (buffer != NULL) {
-                xmlDoc *doc = xmlParseMemory (buffer, bufsize);
-                if (doc != NULL) {
-                        xmlNode *node = xmlDocGetRootElement (doc);
-                        found = parse_xml_tags (doc, node, "toptags", taglist);
-                        xmlFreeDoc (doc);
-                }
+        if (doc != NULL) {
+                xmlNode *node = xmlDocGetRootElement (doc);
+                found = parse_xml_tags (doc, node, "toptags", taglist);
+                xmlFreeDoc (doc);
         }
 
         g_free (artist);
         g_free (album);
         g_free (url);
-        g_free (buffer);
 
         return found;
 }
@@ -905,6 +1088,44 @@ lastfm_ws_remove_tag                    (const LastfmWsSession *session,
         }
 }
 
+/**
+ * Get the web service method used to share a component of a track
+ * @param track The track
+ * @param type What to share
+ * @param method Where to store the method, or NULL if the v1 API
+ *               must be used instead (sharing albums is not
+ *               supported in v2)
+ * @param extraparam Where to store the name of the extra parameter of
+ *                   the method, or NULL if it has none
+ * @param extraparamvalue Where to store the value of that parameter
+ * @return FALSE if that component can't be shared
+ */
+static gboolean
+lastfm_ws_share_track_method            (const LastfmTrack     *track,
+                                         LastfmTrackComponent   type,
+                                         const char           **method,
+                                         const char           **extraparam,
+                                         const char           **extraparamvalue)
+{
+        *method = *extraparam = *extraparamvalue = NULL;
+
+        switch (type) {
+        case LASTFM_TRACK_COMPONENT_ARTIST:
+                *method = "artist.share";
+                return TRUE;
+        case LASTFM_TRACK_COMPONENT_TRACK:
+                *method = "track.share";
+                *extraparam = "track";
+                *extraparamvalue = track->title;
+                return TRUE;
+        case LASTFM_TRACK_COMPONENT_ALBUM:
+                g_return_val_if_fail (track->album[0] != '\0', FALSE);
+                return TRUE;
+        default:
+                g_return_val_if_reached (FALSE);
+        }
+}
+
 gboolean
 lastfm_ws_share_track                   (const LastfmWsSession *session,
                                          const LastfmTrack     *track,
@@ -918,23 +1139,14 @@ lastfm_ws_share_track                   (const LastfmWsSession *session,
 
         g_return_val_if_fail (session && track && text && rcpt, FALSE);
 
-        switch (type) {
-        case LASTFM_TRACK_COMPONENT_ARTIST:
-                method = "artist.share";
-                extraparam = extraparamvalue = NULL;
-                break;
-        case LASTFM_TRACK_COMPONENT_TRACK:
-                method = "track.share";
-                extraparam = "track";
-                extraparamvalue = track->title;
-                break;
-        case LASTFM_TRACK_COMPONENT_ALBUM:
-                g_return_val_if_fail (track->album[0] != '\0', FALSE);
-                /* Use v1 API: sharing albums is not supported in v2 */
+        if (!lastfm_ws_share_track_method (track, type, &method,
+                                           &extraparam, &extraparamvalue)) {
+                return FALSE;
+        }
+
+        if (method == NULL) {
                 return recommend_track (session->username, session->password,
                                         track, text, type, rcpt);
-        default:
-                g_return_val_if_reached (FALSE);
         }
 
         lastfm_ws_http_request (session->srv, method, HTTP_REQUEST_POST,
@@ -954,6 +1166,43 @@ lastfm_ws_share_track                   (const LastfmWsSession *session,
         }
 }
 
+void
+lastfm_ws_share_track_async             (const LastfmWsSession *session,
+                                         const LastfmTrack     *track,
+                                         const char            *text,
+                                         LastfmTrackComponent   type,
+                                         const char            *rcpt,
+                                         lastfm_ws_cb           cb,
+                                         gpointer               userdata)
+{
+        const char *method, *extraparam, *extraparamvalue;
+
+        g_return_if_fail (session && track && text && rcpt);
+
+        if (!lastfm_ws_share_track_method (track, type, &method,
+                                           &extraparam, &extraparamvalue)) {
+                /* The callback is always called */
+                if (cb != NULL) (*cb) (FALSE, userdata);
+                return;
+        }
+
+        if (method == NULL) {
+                recommend_track_async (session->username, session->password,
+                                       track, text, type, rcpt,
+                                       cb, userdata);
+                return;
+        }
+
+        lastfm_ws_http_request_async (session->srv, method, HTTP_REQUEST_POST,
+                                      TRUE, cb, userdata,
+                                      "artist", track->artist,
+                                      "message", text,
+                                      "recipient", rcpt,
+                                      "sk", session->key,
+                                      extraparam, extraparamvalue,
+                                      NULL);
+}
+
 gboolean
 lastfm_ws_love_track                    (const LastfmWsSession *session,
                                          const LastfmTrack     *track)
@@ -1015,6 +1264,21 @@ lastfm_ws_tag_track                     (const LastfmWsSession *session,
                           track, type, tags);
 }
 
+void
+lastfm_ws_tag_track_async               (const LastfmWsSession *session,
+                                         const LastfmTrack     *track,
+                                         LastfmTrackComponent   type,
+                                         GSList                *tags,
+                                         lastfm_ws_cb           cb,
+                                         gpointer               userdata)
+{
+        g_return_if_fail (session && track);
+
+        /* Fall back to the old API while the new one isn't implemented */
+        tag_track_async (session->username, session->password,
+                         track, type, tags, cb, userdata);
+}
+
 gboolean
 lastfm_ws_add_to_playlist               (const LastfmWsSession *session,
                                          const LastfmTrack     *track)
@@ -1024,3 +1288,16 @@ lastfm_ws_add_to_playlist               (const LastfmWsSession *session,
         /* Fall back to the old API while the new one isn't implemented */
         return add_to_playlist (session->username, session->password, track);
 }
+
+void
+lastfm_ws_add_to_playlist_async         (const LastfmWsSession *session,
+                                         const LastfmTrack     *track,
+                                         lastfm_ws_cb           cb,
+                                         gpointer               userdata)
+{
+        g_return_if_fail (session && track);
+
+        /* Fall back to the old API while the new one isn't implemented */
+        add_to_playlist_async (session->username, session->password,
+                               track, cb, userdata);
+}
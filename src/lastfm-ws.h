@@ -28,6 +28,12 @@ typedef enum {
 /* Opaque type that represents a Last.fm Web Services session */
 typedef struct _LastfmWsSession         LastfmWsSession;
 
+/* Callback for the asynchronous versions of the functions, which
+ * must be called from the main thread */
+typedef void
+(*lastfm_ws_cb)                         (gboolean success,
+                                         gpointer userdata);
+
 LastfmSession *
 lastfm_ws_session_get_v1_session        (LastfmWsSession *session);
 
@@ -97,6 +103,15 @@ lastfm_ws_share_track                   (const LastfmWsSession *session,
                                          LastfmTrackComponent   type,
                                          const char            *rcpt);
 
+void
+lastfm_ws_share_track_async             (const LastfmWsSession *session,
+                                         const LastfmTrack     *track,
+                                         const char            *text,
+                                         LastfmTrackComponent   type,
+                                         const char            *rcpt,
+                                         lastfm_ws_cb           cb,
+                                         gpointer               userdata);
+
 gboolean
 lastfm_ws_love_track                    (const LastfmWsSession *session,
                                          const LastfmTrack     *track);
@@ -111,10 +126,24 @@ lastfm_ws_tag_track                     (const LastfmWsSession *session,
                                          LastfmTrackComponent   type,
                                          GSList                *tags);
 
+void
+lastfm_ws_tag_track_async               (const LastfmWsSession *session,
+                                         const LastfmTrack     *track,
+                                         LastfmTrackComponent   type,
+                                         GSList                *tags,
+                                         lastfm_ws_cb           cb,
+                                         gpointer               userdata);
+
 gboolean
 lastfm_ws_add_to_playlist               (const LastfmWsSession *session,
                                          const LastfmTrack     *track);
 
+void
+lastfm_ws_add_to_playlist_async         (const LastfmWsSession *session,
+                                         const LastfmTrack     *track,
+                                         lastfm_ws_cb           cb,
+                                         gpointer               userdata);
+
 G_END_DECLS
 
 #endif /* LASTFM_WS_H */
@@ -0,0 +1,218 @@
+/*
+ * latency.c -- Tracing of the time to first audio
+ *
+ * Copyright (C) 2007-2008 Igalia, S.L.
+ * Authors: Alberto Garcia <berto@igalia.com>
+ *
+ * This file is part of Vagalume and is published under the GNU GPLv3
+ * See the README file for more details.
+ */
+
+#include "latency.h"
+
+#include <string.h>
+
+static const char *stage_names[LATENCY_N_STAGES] = {
+        "session", "tune", "playlist", "connect", "first byte",
+        "first sample", "playing", "started"
+};
+
+/* The trace being recorded. Only one action can be traced at a
+ * time: starting a new one discards the previous one. marks[] are
+ * the seconds since the start of the action */
+typedef struct {
+        const char *action;
+        GTimer *timer;
+        gboolean active;
+        gboolean marked[LATENCY_N_STAGES];
+        double marks[LATENCY_N_STAGES];
+} latency_trace;
+
+/* Aggregated traces of one kind of action. The time of each stage is
+ * measured from the previous stage that was present in the trace */
+typedef struct {
+        guint count;
+        double total;
+        double max_total;
+        guint stage_count[LATENCY_N_STAGES];
+        double stage_total[LATENCY_N_STAGES];
+        double stage_max[LATENCY_N_STAGES];
+} latency_stats_entry;
+
+/* Both the trace and the statistics are protected by latency_mutex,
+ * since stages are marked from several threads */
+static GStaticMutex latency_mutex = G_STATIC_MUTEX_INIT;
+static latency_trace trace = { NULL, NULL, FALSE };
+static GHashTable *stats_table = NULL;
+
+/**
+ * Start tracing a user action, discarding the previous trace if it
+ * hadn't finished yet
+ * @param action The name of the action
+ */
+void
+latency_trace_begin                     (const char *action)
+{
+        g_return_if_fail (action != NULL);
+
+        g_static_mutex_lock (&latency_mutex);
+        if (trace.active) {
+                g_debug ("Discarding unfinished latency trace (%s)",
+                         trace.action);
+        }
+        if (trace.timer == NULL) {
+                trace.timer = g_timer_new ();
+        }
+        g_timer_start (trace.timer);
+        trace.action = g_intern_string (action);
+        trace.active = TRUE;
+        memset (trace.marked, 0, sizeof (trace.marked));
+        g_static_mutex_unlock (&latency_mutex);
+}
+
+/**
+ * Record that a stage finished some time ago. Only the first time
+ * a stage is marked counts, and nothing is done if no action is
+ * being traced. Thread-safe.
+ * @param stage The stage
+ * @param seconds How long ago the stage finished
+ */
+void
+latency_trace_mark_ago                  (LatencyStage stage,
+                                         double       seconds)
+{
+        g_return_if_fail (stage < LATENCY_N_STAGES);
+
+        g_static_mutex_lock (&latency_mutex);
+        if (trace.active && !trace.marked[stage]) {
+                double t = g_timer_elapsed (trace.timer, NULL) - seconds;
+                trace.marks[stage] = MAX (t, 0);
+                trace.marked[stage] = TRUE;
+        }
+        g_static_mutex_unlock (&latency_mutex);
+}
+
+/**
+ * Record that a stage has just finished, see latency_trace_mark_ago()
+ * @param stage The stage
+ */
+void
+latency_trace_mark                      (LatencyStage stage)
+{
+        latency_trace_mark_ago (stage, 0);
+}
+
+/**
+ * Finish the trace (the audio has started playing), log it and add
+ * it to the statistics of its action
+ */
+void
+latency_trace_end                       (void)
+{
+        latency_stats_entry *entry;
+        GString *str;
+        double last = 0;
+        int i;
+
+        g_static_mutex_lock (&latency_mutex);
+        if (!trace.active) {
+                g_static_mutex_unlock (&latency_mutex);
+                return;
+        }
+        trace.active = FALSE;
+        trace.marks[LATENCY_STAGE_STARTED] = g_timer_elapsed (trace.timer,
+                                                              NULL);
+        trace.marked[LATENCY_STAGE_STARTED] = TRUE;
+
+        if (G_UNLIKELY (stats_table == NULL)) {
+                stats_table = g_hash_table_new (g_direct_hash,
+                                                g_direct_equal);
+        }
+        entry = g_hash_table_lookup (stats_table, trace.action);
+        if (entry == NULL) {
+                entry = g_slice_new0 (latency_stats_entry);
+                g_hash_table_insert (stats_table,
+                                     (gpointer) trace.action, entry);
+        }
+
+        str = g_string_new (NULL);
+        for (i = 0; i < LATENCY_N_STAGES; i++) {
+                double delta;
+                if (!trace.marked[i]) continue;
+                /* Stages may overlap (e.g. the first sample reaches
+                 * the sink before the pipeline is playing) */
+                delta = MAX (trace.marks[i] - last, 0);
+                last = MAX (trace.marks[i], last);
+                entry->stage_count[i]++;
+                entry->stage_total[i] += delta;
+                if (delta > entry->stage_max[i]) {
+                        entry->stage_max[i] = delta;
+                }
+                g_string_append_printf (str, "%s +%.0f ms, ",
+                                        stage_names[i], delta * 1000);
+        }
+        entry->count++;
+        entry->total += last;
+        if (last > entry->max_total) entry->max_total = last;
+
+        g_debug ("Time to first audio (%s): %stotal %.0f ms",
+                 trace.action, str->str, last * 1000);
+        g_string_free (str, TRUE);
+        g_static_mutex_unlock (&latency_mutex);
+}
+
+/**
+ * Stop tracing without recording anything, e.g. if playback has been
+ * stopped before the audio could start
+ */
+void
+latency_trace_cancel                    (void)
+{
+        g_static_mutex_lock (&latency_mutex);
+        trace.active = FALSE;
+        g_static_mutex_unlock (&latency_mutex);
+}
+
+static void
+latency_dump_entry                      (gpointer key,
+                                         gpointer value,
+                                         gpointer userdata)
+{
+        GString *str = userdata;
+        const latency_stats_entry *entry = value;
+        int i;
+
+        g_string_append_printf (str, "%s: %u traces, avg %.0f ms, "
+                                "max %.0f ms\n", (const char *) key,
+                                entry->count,
+                                entry->total * 1000 / entry->count,
+                                entry->max_total * 1000);
+        for (i = 0; i < LATENCY_N_STAGES; i++) {
+                guint n = entry->stage_count[i];
+                if (n == 0) continue;
+                g_string_append_printf (str, "  %-12s %3u times, "
+                                        "avg %.0f ms, max %.0f ms\n",
+                                        stage_names[i], n,
+                                        entry->stage_total[i] * 1000 / n,
+                                        entry->stage_max[i] * 1000);
+        }
+}
+
+/**
+ * Write a human-readable report of the traces recorded so far, with
+ * the time spent in each stage for each kind of action
+ * @return A newly allocated string, to be freed with g_free()
+ */
+char *
+latency_dump                            (void)
+{
+        GString *str = g_string_new ("Time to first audio:\n");
+
+        g_static_mutex_lock (&latency_mutex);
+        if (stats_table != NULL) {
+                g_hash_table_foreach (stats_table, latency_dump_entry, str);
+        }
+        g_static_mutex_unlock (&latency_mutex);
+
+        return g_string_free (str, FALSE);
+}
@@ -0,0 +1,51 @@
+/*
+ * latency.h -- Tracing of the time to first audio
+ *
+ * Copyright (C) 2007-2008 Igalia, S.L.
+ * Authors: Alberto Garcia <berto@igalia.com>
+ *
+ * This file is part of Vagalume and is published under the GNU GPLv3
+ * See the README file for more details.
+ */
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <glib.h>
+
+/* Stages of the path from a user action to the audio being played,
+ * in the order in which they usually happen. Not all of them are
+ * present in all traces (e.g. the playlist is only requested when
+ * there are no tracks left) */
+typedef enum {
+        LATENCY_STAGE_SESSION,
+        LATENCY_STAGE_TUNE,
+        LATENCY_STAGE_PLAYLIST,
+        LATENCY_STAGE_CONNECT,
+        LATENCY_STAGE_FIRST_BYTE,
+        LATENCY_STAGE_FIRST_SAMPLE,
+        LATENCY_STAGE_PLAYING,
+        LATENCY_STAGE_STARTED,
+        LATENCY_N_STAGES
+} LatencyStage;
+
+void
+latency_trace_begin                     (const char *action);
+
+void
+latency_trace_mark                      (LatencyStage stage);
+
+void
+latency_trace_mark_ago                  (LatencyStage stage,
+                                         double       seconds);
+
+void
+latency_trace_end                       (void);
+
+void
+latency_trace_cancel                    (void);
+
+char *
+latency_dump                            (void);
+
+#endif
@@ -24,10 +24,16 @@
 #include <string.h>
 #include <signal.h>
 #include <unistd.h>
+#ifdef HAVE_GETOPT_LONG
+#   include <getopt.h>
+#endif
 
 #include "controller.h"
 #include "globaldefs.h"
 #include "audio.h"
+#include "httpstats.h"
+#include "latency.h"
+#include "strpool.h"
 
 #ifdef HAVE_DBUS_SUPPORT
 #   include <dbus/dbus-glib.h>
@@ -44,6 +50,7 @@ main                                    (int    argc,
                                          char **argv)
 {
         char *radio = NULL;
+        gboolean dump_stats = FALSE;
 
         signal(SIGPIPE, SIG_IGN);
 #if !GLIB_CHECK_VERSION(2,32,0)
@@ -73,7 +80,16 @@ main                                    (int    argc,
 
 #if defined(HAVE_GETOPT) && !defined(MAEMO)
         int opt;
-        while ((opt = getopt(argc, argv, "d:s:h")) != -1) {
+#ifdef HAVE_GETOPT_LONG
+        static const struct option long_opts[] = {
+                { "stats", no_argument, NULL, 't' },
+                { NULL, 0, NULL, 0 }
+        };
+        while ((opt = getopt_long(argc, argv, "d:s:th",
+                                  long_opts, NULL)) != -1) {
+#else
+        while ((opt = getopt(argc, argv, "d:s:th")) != -1) {
+#endif
                 switch (opt) {
                 case 'd':
                         g_setenv(GST_DECODER_ENVVAR, optarg, TRUE);
@@ -81,13 +97,19 @@ main                                    (int    argc,
                 case 's':
                         g_setenv(GST_SINK_ENVVAR, optarg, TRUE);
                         break;
+                case 't':
+                        dump_stats = TRUE;
+                        break;
                 default:
                         g_print(_("Usage:\n  %s [-d decoder] "
-                                  "[-s sink] [lastfm radio url]\n\n"
+                                  "[-s sink] [-t|--stats] "
+                                  "[lastfm radio url]\n\n"
                                   "  decoder:   GStreamer decoder "
                                   "(default: '%s')\n"
                                   "  sink:      GStreamer sink "
-                                  "(default: '%s')\n"),
+                                  "(default: '%s')\n"
+                                  "  --stats:   print HTTP request "
+                                  "statistics on exit\n"),
                                 argv[0],
                                 lastfm_audio_default_decoder_name(),
                                 lastfm_audio_default_sink_name());
@@ -119,6 +141,37 @@ main                                    (int    argc,
         controller_run_app (radio);
         g_free(radio);
 
+        if (dump_stats) {
+                LastfmAudioFeedStats feed;
+                LastfmAudioTtfaStats ttfa[2];
+                int i;
+                char *stats = http_stats_dump ();
+                g_print ("%s", stats);
+                g_free (stats);
+                stats = latency_dump ();
+                g_print ("%s", stats);
+                g_free (stats);
+                stats = str_pool_dump ();
+                g_print ("%s", stats);
+                g_free (stats);
+                lastfm_audio_get_feed_stats (&feed);
+                g_print ("Audio feed: %" G_GUINT64_FORMAT " bytes in %u "
+                         "buffers, %u underruns (%u ms), buffer full %u "
+                         "times, %u reconnects (%u ms without data)\n",
+                         feed.bytes, feed.buffers, feed.underruns,
+                         feed.underrun_ms, feed.full, feed.reconnects,
+                         feed.dropout_ms);
+                lastfm_audio_get_ttfa_stats (&ttfa[0], &ttfa[1]);
+                for (i = 0; i < 2; i++) {
+                        if (ttfa[i].count == 0) continue;
+                        g_print ("Time to first audio (%s starts): %u "
+                                 "tracks, avg %u ms, min %u ms, max %u ms\n",
+                                 i == 0 ? "cold" : "warm", ttfa[i].count,
+                                 ttfa[i].total_ms / ttfa[i].count,
+                                 ttfa[i].min_ms, ttfa[i].max_ms);
+                }
+        }
+
         gdk_threads_leave ();
 
         return 0;
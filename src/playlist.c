@@ -9,6 +9,9 @@
  */
 
 #include "playlist.h"
+#include "strpool.h"
+
+#include <string.h>
 
 /**
  * Destroy a LastfmTrack object freeing all its allocated memory
@@ -17,32 +20,87 @@
 static void
 lastfm_track_destroy                    (LastfmTrack *track)
 {
-        g_mutex_free(track->mutex);
-        g_free ((gpointer) track->stream_url);
-        g_free ((gpointer) track->title);
-        if (track->album_artist != track->artist) {
-                g_free ((gpointer) track->album_artist);
-        }
-        g_free ((gpointer) track->artist);
-        g_free ((gpointer) track->album);
-        g_free ((gpointer) track->pls_title);
-        g_free ((gpointer) track->image_url);
+        g_static_mutex_free (&(track->mutex));
+        str_pool_unref (track->album_artist);
+        str_pool_unref (track->artist);
+        str_pool_unref (track->album);
+        str_pool_unref (track->pls_title);
+        str_pool_unref (track->image_url);
         g_free ((gpointer) track->image_data);
-        g_free ((gpointer) track->trackauth);
-        g_free ((gpointer) track->free_track_url);
 }
 
+/* Strings owned by each track, stored in the same memory block */
+static const gsize track_strings[] = {
+        G_STRUCT_OFFSET (LastfmTrack, stream_url),
+        G_STRUCT_OFFSET (LastfmTrack, title),
+        G_STRUCT_OFFSET (LastfmTrack, trackauth),
+        G_STRUCT_OFFSET (LastfmTrack, free_track_url)
+};
+
+#define TRACK_STRING(track,i) \
+        G_STRUCT_MEMBER (const char *, track, track_strings[i])
+
 /**
- * Creates a new LastfmTrack object
+ * Creates a new LastfmTrack object with the contents of a temporary
+ * one. The track and its own strings are allocated in a single block
+ * of memory; the strings shared with other tracks are moved to it.
+ * @param parts A track (not created with this function) with the
+ *        strings allocated with g_malloc(), or taken from the string
+ *        pool (see playlist.h). Its free_track_url can be the same
+ *        pointer as its stream_url. It will be emptied.
  * @return The new track
  */
 LastfmTrack *
-lastfm_track_new                        (void)
+lastfm_track_new                        (LastfmTrack *parts)
 {
+        gsize sizes[G_N_ELEMENTS (track_strings)];
+        gsize objsize = sizeof (LastfmTrack);
         LastfmTrack *track;
-        track = vgl_object_new (LastfmTrack,
-                                (GDestroyNotify) lastfm_track_destroy);
-        track->mutex = g_mutex_new();
+        gboolean same_urls;
+        char *pos;
+        guint i;
+
+        g_return_val_if_fail (parts != NULL, NULL);
+
+        /* Keep only one copy of the URL if both are the same */
+        same_urls = parts->free_track_url && parts->stream_url &&
+                g_str_equal (parts->free_track_url, parts->stream_url);
+        if (same_urls) {
+                if (parts->free_track_url != parts->stream_url) {
+                        g_free ((char *) parts->free_track_url);
+                }
+                parts->free_track_url = NULL;
+        }
+
+        for (i = 0; i < G_N_ELEMENTS (track_strings); i++) {
+                const char *str = TRACK_STRING (parts, i);
+                sizes[i] = str ? strlen (str) + 1 : 0;
+                objsize += sizes[i];
+        }
+
+        track = vgl_object_new_with_size (
+                objsize, (GDestroyNotify) lastfm_track_destroy);
+
+        /* Copy everything but the header of the object */
+        memcpy ((char *) track + sizeof (VglObject),
+                (char *) parts + sizeof (VglObject),
+                sizeof (LastfmTrack) - sizeof (VglObject));
+        g_static_mutex_init (&(track->mutex));
+
+        pos = (char *) (track + 1);
+        for (i = 0; i < G_N_ELEMENTS (track_strings); i++) {
+                char *str = (char *) TRACK_STRING (parts, i);
+                if (str != NULL) {
+                        TRACK_STRING (track, i) = memcpy (pos, str, sizes[i]);
+                        pos += sizes[i];
+                        g_free (str);
+                }
+        }
+        if (same_urls) {
+                track->free_track_url = track->stream_url;
+        }
+
+        memset (parts, 0, sizeof (LastfmTrack));
         return track;
 }
 
@@ -60,12 +118,12 @@ lastfm_track_set_cover_image            (LastfmTrack *track,
                                          size_t       size)
 {
         g_return_if_fail(track != NULL);
-        g_mutex_lock(track->mutex);
+        g_static_mutex_lock(&(track->mutex));
         g_free ((gpointer) track->image_data);
         track->image_data = data;
         track->image_data_size = size;
         track->image_data_available = TRUE;
-        g_mutex_unlock(track->mutex);
+        g_static_mutex_unlock(&(track->mutex));
 }
 
 /**
@@ -98,6 +156,19 @@ lastfm_pls_get_track                    (LastfmPls *pls)
         return track;
 }
 
+/**
+ * Get the next track in a playlist without removing it.
+ * @param pls The playlist
+ * @return The next track (or NULL if the list is empty). No new
+ * reference is added.
+ */
+LastfmTrack *
+lastfm_pls_peek_track                   (LastfmPls *pls)
+{
+        g_return_val_if_fail(pls != NULL, NULL);
+        return (LastfmTrack *) g_queue_peek_head(pls->tracks);
+}
+
 /**
  * Append a track to the end of a playlist.
  * @param pls The playlist
@@ -19,6 +19,11 @@ typedef enum {
         LASTFM_TRACK_COMPONENT_ALBUM
 } LastfmTrackComponent;
 
+/* stream_url, title, trackauth and free_track_url are stored in the
+ * same memory block as the track (see lastfm_track_new()), and are
+ * never modified. free_track_url is the same pointer as stream_url if
+ * they're equal. artist, album, album_artist, pls_title and image_url
+ * are shared with other tracks, see strpool.h */
 typedef struct {
         VglObject parent;
         const char *stream_url;
@@ -27,7 +32,7 @@ typedef struct {
         const char *artist;
         guint artistid;
         const char *album; /* "" if empty, never NULL */
-        /* "" if empty, can also be the _same pointer_ as artist */
+        /* "" if empty, the _same pointer_ as artist if they're equal */
         const char *album_artist;
         const char *pls_title;
         guint duration;
@@ -39,7 +44,7 @@ typedef struct {
         const char *free_track_url;
         gboolean dl_in_progress;
         /* Private */
-        GMutex *mutex;
+        GStaticMutex mutex;
 } LastfmTrack;
 
 typedef struct {
@@ -48,7 +53,7 @@ typedef struct {
 
 
 LastfmTrack *
-lastfm_track_new                        (void);
+lastfm_track_new                        (LastfmTrack *parts);
 
 void
 lastfm_track_set_cover_image            (LastfmTrack *track,
@@ -58,6 +63,9 @@ lastfm_track_set_cover_image            (LastfmTrack *track,
 LastfmTrack *
 lastfm_pls_get_track                    (LastfmPls *pls);
 
+LastfmTrack *
+lastfm_pls_peek_track                   (LastfmPls *pls);
+
 void
 lastfm_pls_add_track                    (LastfmPls   *pls,
                                          LastfmTrack *track);
@@ -0,0 +1,297 @@
+/*
+ * pls-bench.c -- Benchmark of the playlist parsers
+ *
+ * Copyright (C) 2007-2010, 2013 Igalia, S.L.
+ * Authors: Alberto Garcia <berto@igalia.com>
+ *
+ * This file is part of Vagalume and is published under the GNU GPLv3
+ * See the README file for more details.
+ */
+
+/*
+ * This parses a set of recorded playlists (or a generated one) with
+ * the two available parsers:
+ *
+ *  - dom:    the whole document is parsed into an xmlDoc and then
+ *            converted with lastfm_parse_playlist(),
+ *  - reader: lastfm_parse_playlist_buffer(), which uses an
+ *            xmlTextReader and never builds the whole tree.
+ *
+ * Each parser runs in a child process so their peak RSS can be
+ * measured separately. For each one it reports the throughput (MB of
+ * XML and tracks parsed per second) and how much the peak RSS grew
+ * while parsing.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <libxml/parser.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "protocol.h"
+
+typedef enum {
+        PARSER_DOM,
+        PARSER_READER
+} bench_parser;
+
+static const char *parser_names[] = { "dom", "reader" };
+
+static long
+bench_peak_rss                          (void)
+{
+        struct rusage ru;
+        getrusage (RUSAGE_SELF, &ru);
+        return ru.ru_maxrss;
+}
+
+/**
+ * Generate a playlist in the new format with lots of tracks
+ * @param n_tracks The number of tracks
+ * @param size Where the size of the playlist will be stored
+ * @return The playlist, to be freed with g_free()
+ */
+static char *
+bench_generate_playlist                 (guint  n_tracks,
+                                         gsize *size)
+{
+        GString *str = g_string_new (
+                "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+                "<lfm status=\"ok\">\n"
+                "<playlist version=\"1\" "
+                "xmlns=\"http://xspf.org/ns/0/\">\n"
+                "  <title>Benchmark+Radio</title>\n"
+                "  <creator>Last.fm</creator>\n"
+                "  <date>2013-01-01T00:00:00</date>\n"
+                "  <link rel=\"http://www.last.fm/expiry\">3600</link>\n"
+                "  <trackList>\n");
+        guint i;
+
+        for (i = 0; i < n_tracks; i++) {
+                /* Artists and albums repeat, as in real playlists */
+                guint artist = i % 50;
+                guint album = i % 200;
+                g_string_append_printf (str,
+                "    <track>\n"
+                "      <location>http://play.last.fm/user/%08x.mp3"
+                "</location>\n"
+                "      <title>Track number %u</title>\n"
+                "      <identifier>%u</identifier>\n"
+                "      <album>Album number %u</album>\n"
+                "      <creator>Artist number %u</creator>\n"
+                "      <duration>240000</duration>\n"
+                "      <image>http://userserve-ak.last.fm/serve/174s/"
+                "%u.jpg</image>\n"
+                "      <extension application=\"http://www.last.fm\">\n"
+                "        <trackauth>%05x</trackauth>\n"
+                "        <albumid>%u</albumid>\n"
+                "        <artistid>%u</artistid>\n"
+                "        <recording>%u</recording>\n"
+                "        <artistpage>http://www.last.fm/music/"
+                "Artist+number+%u</artistpage>\n"
+                "        <albumpage>http://www.last.fm/music/"
+                "Artist+number+%u/Album+number+%u</albumpage>\n"
+                "        <trackpage>http://www.last.fm/music/"
+                "Artist+number+%u/_/Track+number+%u</trackpage>\n"
+                "        <buyTrackURL></buyTrackURL>\n"
+                "        <buyAlbumURL></buyAlbumURL>\n"
+                "        <freeTrackURL></freeTrackURL>\n"
+                "      </extension>\n"
+                "    </track>\n",
+                i, i, 1000000 + i, album, artist, album, i, album, artist,
+                i, artist, artist, album, artist, i);
+        }
+
+        g_string_append (str, "  </trackList>\n</playlist>\n</lfm>\n");
+        *size = str->len;
+        return g_string_free (str, FALSE);
+}
+
+/**
+ * Parse a playlist
+ * @param parser The parser to use
+ * @param data The playlist
+ * @param size The size of the playlist
+ * @return The number of tracks found
+ */
+static guint
+bench_parse                             (bench_parser  parser,
+                                         const char   *data,
+                                         gsize         size)
+{
+        LastfmPls *pls = NULL;
+        guint n_tracks = 0;
+
+        if (parser == PARSER_DOM) {
+                xmlDoc *doc = xmlReadMemory (data, size, NULL, NULL,
+                                             XML_PARSE_NONET);
+                if (doc != NULL) {
+                        pls = lastfm_parse_playlist (doc, NULL, FALSE);
+                        xmlFreeDoc (doc);
+                }
+        } else {
+                pls = lastfm_parse_playlist_buffer (data, size, NULL,
+                                                    FALSE, NULL);
+        }
+
+        if (pls != NULL) {
+                n_tracks = lastfm_pls_size (pls);
+                lastfm_pls_destroy (pls);
+        }
+
+        return n_tracks;
+}
+
+/**
+ * Run a parser several times in a child process and print the results
+ * @param parser The parser to use
+ * @param data The playlist
+ * @param size The size of the playlist
+ * @param runs The number of times to parse it
+ * @return Whether all runs found at least one track
+ */
+static gboolean
+bench_run                               (bench_parser  parser,
+                                         const char   *data,
+                                         gsize         size,
+                                         int           runs)
+{
+        int status;
+        pid_t pid;
+
+        fflush (stdout);
+        pid = fork ();
+        if (pid == -1) {
+                perror ("fork");
+                return FALSE;
+        }
+
+        if (pid == 0) {
+                long rss = bench_peak_rss ();
+                GTimer *timer = g_timer_new ();
+                guint n_tracks = 0;
+                gboolean ok = TRUE;
+                double secs;
+                int i;
+
+                for (i = 0; i < runs; i++) {
+                        guint n = bench_parse (parser, data, size);
+                        if (n == 0) ok = FALSE;
+                        n_tracks += n;
+                }
+                secs = g_timer_elapsed (timer, NULL);
+                g_timer_destroy (timer);
+
+                g_print ("    %-6s  %u tracks in %.3f s, %.1f MB/s, "
+                         "%.0f tracks/s, peak RSS +%ld KB\n",
+                         parser_names[parser], n_tracks, secs,
+                         secs > 0 ? size * runs / secs / 1048576 : 0,
+                         secs > 0 ? n_tracks / secs : 0,
+                         bench_peak_rss () - rss);
+                fflush (stdout);
+                _exit (ok ? 0 : 1);
+        }
+
+        if (waitpid (pid, &status, 0) == -1) {
+                perror ("waitpid");
+                return FALSE;
+        }
+
+        return WIFEXITED (status) && WEXITSTATUS (status) == 0;
+}
+
+static gboolean
+bench_playlist                          (const char *title,
+                                         const char *data,
+                                         gsize       size,
+                                         int         runs)
+{
+        gboolean ok = TRUE;
+        g_print ("  %s (%lu KB)\n", title, (unsigned long) size / 1024);
+        ok = bench_run (PARSER_DOM, data, size, runs) && ok;
+        ok = bench_run (PARSER_READER, data, size, runs) && ok;
+        return ok;
+}
+
+static void
+usage                                   (const char *progname)
+{
+        g_printerr ("Usage:\n  %s [-n runs] [-g tracks] [playlist.xml...]"
+                    "\n\n"
+                    "  runs:      times each playlist is parsed "
+                    "(default: 10)\n"
+                    "  tracks:    parse a generated playlist with this "
+                    "number of tracks\n", progname);
+}
+
+int
+main                                    (int    argc,
+                                         char **argv)
+{
+        gboolean failed = FALSE;
+        int n_generated = 0;
+        int runs = 10;
+        int opt, i;
+
+        xmlInitParser ();
+
+        while ((opt = getopt (argc, argv, "n:g:h")) != -1) {
+                switch (opt) {
+                case 'n':
+                        runs = atoi (optarg);
+                        break;
+                case 'g':
+                        n_generated = atoi (optarg);
+                        break;
+                default:
+                        usage (argv[0]);
+                        return 1;
+                }
+        }
+        if ((optind >= argc && n_generated <= 0) || runs <= 0) {
+                usage (argv[0]);
+                return 1;
+        }
+
+        g_print ("Parsing each playlist %d times:\n", runs);
+
+        if (n_generated > 0) {
+                char *title = g_strdup_printf ("generated, %d tracks",
+                                               n_generated);
+                gsize size;
+                char *data = bench_generate_playlist (n_generated, &size);
+                if (!bench_playlist (title, data, size, runs)) {
+                        failed = TRUE;
+                }
+                g_free (data);
+                g_free (title);
+        }
+
+        for (i = optind; i < argc; i++) {
+                GError *err = NULL;
+                gchar *data;
+                gsize size;
+
+                if (!g_file_get_contents (argv[i], &data, &size, &err)) {
+                        g_printerr ("%s\n", err->message);
+                        g_error_free (err);
+                        failed = TRUE;
+                        continue;
+                }
+                if (!bench_playlist (argv[i], data, size, runs)) {
+                        failed = TRUE;
+                }
+                g_free (data);
+        }
+
+        xmlCleanupParser ();
+        return failed ? 1 : 0;
+}
@@ -9,11 +9,13 @@
  */
 
 #include <glib/gi18n.h>
+#include <libxml/xmlreader.h>
 #include <string.h>
 
 #include "http.h"
 #include "util.h"
 #include "protocol.h"
+#include "strpool.h"
 #include "globaldefs.h"
 
 static const char custom_pls_path[] =
@@ -125,102 +127,132 @@ lastfm_session_new                      (const char *username,
         return s;
 }
 
+/**
+ * Set the album artist of a track from the URL of its album page
+ * @param track The track
+ * @param url The URL of the album page
+ */
 static void
-parse_old_track_parts                   (xmlDoc      *doc,
-                                         xmlNode     *node,
-                                         LastfmTrack *track)
+set_album_artist_from_page              (LastfmTrack *track,
+                                         const char  *url)
 {
-        char *val;
-        glong id, artistid, duration;
-
-        xml_get_string (doc, node, "trackauth", (char **) &(track->trackauth));
-        xml_get_glong (doc, node, "id", &id);
-        xml_get_glong (doc, node, "artistId", &artistid);
-        xml_get_glong (doc, node, "duration", &duration);
-
-        track->id = id;
-        track->artistid = artistid;
-        track->duration = duration;
-
-        node = (xmlNode *) xml_get_string (doc, node, "link", &val);
-        while (node != NULL) {
-                xmlChar *rel = xmlGetProp (node, (xmlChar *) "rel");
-                if (rel != NULL && val != NULL && val[0] != '\0') {
-                        if (xmlStrEqual (rel, free_track_rel)) {
-                                g_free ((gpointer) track->free_track_url);
-                                track->free_track_url = val;
-                                val = NULL;
-                        } else if (xmlStrEqual (rel, album_page_rel) &&
-                                   g_str_has_prefix (
-                                           val, lastfm_music_prefix)) {
-                                char *artist, **parts;
-                                parts = g_strsplit (val, "/", 6);
-                                artist = lastfm_url_decode (parts[4]);
-                                g_strfreev (parts);
-                                g_free ((gpointer) track->album_artist);
-                                track->album_artist = artist;
-                        }
-                        xmlFree (rel);
+        if (g_str_has_prefix (url, lastfm_music_prefix)) {
+                char *artist, **parts;
+                parts = g_strsplit (url, "/", 6);
+                artist = lastfm_url_decode (parts[4]);
+                g_strfreev (parts);
+                g_free ((gpointer) track->album_artist);
+                track->album_artist = artist;
+        }
+}
+
+/* <link rel="..."> elements of the old format, there can be several */
+static void
+parse_old_track_link                    (xmlDoc        *doc,
+                                         const xmlNode *node,
+                                         gpointer       obj)
+{
+        LastfmTrack *track = obj;
+        xmlChar *rel = xmlGetProp ((xmlNode *) node, (xmlChar *) "rel");
+        if (rel != NULL) {
+                char *val = xml_node_get_string (doc, node);
+                if (val[0] == '\0') {
+                        /* Ignore it */
+                } else if (xmlStrEqual (rel, free_track_rel)) {
+                        g_free ((gpointer) track->free_track_url);
+                        track->free_track_url = val;
+                        val = NULL;
+                } else if (xmlStrEqual (rel, album_page_rel)) {
+                        set_album_artist_from_page (track, val);
                 }
                 g_free (val);
-                node = (xmlNode *) xml_get_string (doc, node->next,
-                                                   "link", &val);
+                xmlFree (rel);
         }
 }
 
+/* <albumpage> element inside the <extension> of the new format */
 static void
-parse_new_track_parts                   (xmlDoc      *doc,
-                                         xmlNode     *node,
-                                         LastfmTrack *track)
+parse_new_track_album_page              (xmlDoc        *doc,
+                                         const xmlNode *node,
+                                         gpointer       obj)
 {
-        glong id, duration;
+        char *albumpage = xml_node_get_string (doc, node);
+        set_album_artist_from_page ((LastfmTrack *) obj, albumpage);
+        g_free (albumpage);
+}
 
-        xml_get_glong (doc, node, "identifier", &id);
-        xml_get_glong (doc, node, "duration", &duration);
+#define TRACK_FIELD(member) G_STRUCT_OFFSET (LastfmTrack, member)
 
-        track->id = id;
-        track->duration = duration;
+static const XmlField new_track_ext_fields[] = {
+        { "artistid",     XML_FIELD_GUINT,  TRACK_FIELD (artistid) },
+        { "trackauth",    XML_FIELD_STRING, TRACK_FIELD (trackauth) },
+        { "freeTrackURL", XML_FIELD_STRING, TRACK_FIELD (free_track_url) },
+        { "albumpage",    XML_FIELD_CUSTOM, 0, parse_new_track_album_page },
+        { NULL }
+};
 
-        node = (xmlNode *) xml_find_node (node, "extension");
-        if (node != NULL) {
-                glong artistid;
-                char *albumpage, *auth, *free_track;
-                node = node->xmlChildrenNode;
+static XmlFieldTable new_track_ext_table =
+        XML_FIELD_TABLE_INIT (new_track_ext_fields);
 
-                xml_get_glong (doc, node, "artistid", &artistid);
-                xml_get_string (doc, node, "trackauth", &auth);
-                xml_get_string (doc, node, "freeTrackURL", &free_track);
-                xml_get_string (doc, node, "albumpage", &albumpage);
-
-                if (albumpage &&
-                    g_str_has_prefix (albumpage, lastfm_music_prefix)) {
-                        char *artist, **parts;
-                        parts = g_strsplit (albumpage, "/", 6);
-                        artist = lastfm_url_decode (parts[4]);
-                        g_strfreev (parts);
-                        g_free ((gpointer) track->album_artist);
-                        track->album_artist = artist;
-                }
-
-                /* We don't want empty strings */
-                if (auth && *auth == '\0') {
-                        g_free (auth);
-                        auth = NULL;
-                }
+/* <extension> element of the new format */
+static void
+parse_new_track_extension               (xmlDoc        *doc,
+                                         const xmlNode *node,
+                                         gpointer       obj)
+{
+        LastfmTrack *track = obj;
 
-                if (free_track && *free_track == '\0') {
-                        g_free (free_track);
-                        free_track = NULL;
-                }
+        track->artistid = -1;
+        xml_parse_fields (doc, node->xmlChildrenNode,
+                          &new_track_ext_table, track);
 
-                track->trackauth = auth;
-                track->free_track_url = free_track;
-                track->artistid = artistid;
+        /* We don't want empty strings */
+        if (track->trackauth && *track->trackauth == '\0') {
+                g_free ((gpointer) track->trackauth);
+                track->trackauth = NULL;
+        }
 
-                g_free (albumpage);
+        if (track->free_track_url && *track->free_track_url == '\0') {
+                g_free ((gpointer) track->free_track_url);
+                track->free_track_url = NULL;
         }
 }
 
+/* Elements of a <track> in the new format, parsed in a single pass */
+static const XmlField new_track_fields[] = {
+        { "location",   XML_FIELD_STRING, TRACK_FIELD (stream_url) },
+        { "title",      XML_FIELD_STRING, TRACK_FIELD (title) },
+        { "creator",    XML_FIELD_STRING, TRACK_FIELD (artist) },
+        { "album",      XML_FIELD_STRING, TRACK_FIELD (album) },
+        { "image",      XML_FIELD_STRING, TRACK_FIELD (image_url) },
+        { "identifier", XML_FIELD_GUINT,  TRACK_FIELD (id) },
+        { "duration",   XML_FIELD_GUINT,  TRACK_FIELD (duration) },
+        { "extension",  XML_FIELD_CUSTOM, 0, parse_new_track_extension },
+        { NULL }
+};
+
+/* Elements of a <track> in the old format */
+static const XmlField old_track_fields[] = {
+        { "location",   XML_FIELD_STRING, TRACK_FIELD (stream_url) },
+        { "title",      XML_FIELD_STRING, TRACK_FIELD (title) },
+        { "creator",    XML_FIELD_STRING, TRACK_FIELD (artist) },
+        { "album",      XML_FIELD_STRING, TRACK_FIELD (album) },
+        { "image",      XML_FIELD_STRING, TRACK_FIELD (image_url) },
+        { "trackauth",  XML_FIELD_STRING, TRACK_FIELD (trackauth) },
+        { "id",         XML_FIELD_GUINT,  TRACK_FIELD (id) },
+        { "artistId",   XML_FIELD_GUINT,  TRACK_FIELD (artistid) },
+        { "duration",   XML_FIELD_GUINT,  TRACK_FIELD (duration) },
+        { "link",       XML_FIELD_CUSTOM, 0, parse_old_track_link, TRUE },
+        { NULL }
+};
+
+#undef TRACK_FIELD
+
+static XmlFieldTable new_track_table =
+        XML_FIELD_TABLE_INIT (new_track_fields);
+static XmlFieldTable old_track_table =
+        XML_FIELD_TABLE_INIT (old_track_fields);
+
 /**
  * Parse a <track> element from an XSPF and add it to a playlist
  * @param doc The XML document that is being parsed
@@ -241,23 +273,42 @@ lastfm_parse_track                      (xmlDoc     *doc,
         g_return_val_if_fail (doc && node && pls, FALSE);
 
         gboolean retval = FALSE;
-        LastfmTrack *track = lastfm_track_new ();
-        track->pls_title =
-                g_strdup (pls_title ? pls_title : _("(unknown radio)"));
+        LastfmTrack parts, *track;
 
-        /* Common elements in both formats */
-        xml_get_string (doc, node, "location", (char **) &(track->stream_url));
-        xml_get_string (doc, node, "title", (char **) &(track->title));
-        xml_get_string (doc, node, "creator", (char **) &(track->artist));
-        xml_get_string (doc, node, "album", (char **) &(track->album));
-        xml_get_string (doc, node, "image", (char **) &(track->image_url));
+        /* The fields are parsed into a temporary track first, so the
+         * real one can be allocated with the size of its strings */
+        memset (&parts, 0, sizeof (parts));
+        parts.pls_title =
+                str_pool_add (pls_title ? pls_title : _("(unknown radio)"));
 
+        /* Numeric fields not present in the XML are -1 */
+        parts.id = parts.duration = -1;
         if (new_format) {
-                parse_new_track_parts (doc, node, track);
+                xml_parse_fields (doc, node, &new_track_table, &parts);
         } else {
-                parse_old_track_parts (doc, node, track);
+                parts.artistid = -1;
+                xml_parse_fields (doc, node, &old_track_table, &parts);
+        }
+
+        /* These are repeated in lots of tracks, so only one copy of
+         * each one is kept */
+        parts.artist = str_pool_take ((char *) parts.artist);
+        parts.album = str_pool_take ((char *) parts.album);
+        parts.album_artist = str_pool_take ((char *) parts.album_artist);
+        parts.image_url = str_pool_take ((char *) parts.image_url);
+        if (parts.album_artist == NULL && parts.artist != NULL) {
+                parts.album_artist = str_pool_ref (parts.artist);
+        }
+
+        /* With free streams this is the stream URL itself, and
+         * lastfm_track_new() stores it only once */
+        if (free_streams) {
+                g_free ((char *) parts.free_track_url);
+                parts.free_track_url = parts.stream_url;
         }
 
+        track = lastfm_track_new (&parts);
+
         if (!track->stream_url || track->stream_url[0] == '\0') {
                 g_debug("Found track with no stream URL, discarding it");
         } else if (!track->title || track->title[0] == '\0') {
@@ -265,16 +316,6 @@ lastfm_parse_track                      (xmlDoc     *doc,
         } else if (!track->artist || track->artist[0] == '\0') {
                 g_debug("Found track with no artist, discarding it");
         } else {
-                if (track->album_artist == NULL ||
-                    !strcmp (track->artist, track->album_artist)) {
-                        /* Don't waste memory */
-                        g_free ((gpointer) track->album_artist);
-                        track->album_artist = track->artist;
-                }
-                if (free_streams) {
-                        g_free ((char *) track->free_track_url);
-                        track->free_track_url = g_strdup (track->stream_url);
-                }
                 lastfm_pls_add_track(pls, track);
                 retval = TRUE;
         }
@@ -351,6 +392,174 @@ lastfm_parse_playlist                   (xmlDoc     *doc,
         return pls;
 }
 
+/**
+ * Move an xmlTextReader to the next child element of a node,
+ * skipping the subtree of the current one.
+ * @param reader The reader, positioned either on the parent element
+ *        or on one of its children
+ * @param depth The depth of the children
+ * @return Whether there was a child element. If not, the reader is
+ *         left at the end of the parent (or at the end of the input)
+ */
+static gboolean
+xml_reader_next_child                   (xmlTextReader *reader,
+                                         int            depth)
+{
+        int ret;
+
+        if (xmlTextReaderDepth (reader) < depth) {
+                if (xmlTextReaderIsEmptyElement (reader)) return FALSE;
+                ret = xmlTextReaderRead (reader);
+        } else {
+                ret = xmlTextReaderNext (reader);
+        }
+
+        while (ret == 1 && xmlTextReaderDepth (reader) == depth) {
+                if (xmlTextReaderNodeType (reader) ==
+                    XML_READER_TYPE_ELEMENT) {
+                        return TRUE;
+                }
+                ret = xmlTextReaderNext (reader);
+        }
+
+        return FALSE;
+}
+
+/**
+ * Check the name of the element an xmlTextReader is positioned on
+ * @param reader The reader
+ * @param name The name
+ * @return Whether the names are equal
+ */
+static gboolean
+xml_reader_name_is                      (xmlTextReader *reader,
+                                         const char    *name)
+{
+        return xmlStrEqual (xmlTextReaderConstLocalName (reader),
+                            (xmlChar *) name);
+}
+
+/**
+ * Parse a playlist in XSPF form from a buffer, without building the
+ * XML tree. This reads the document with an xmlTextReader, expanding
+ * one <track> at a time; the reader frees each one as it moves to the
+ * next, so memory usage doesn't depend on the size of the playlist.
+ * @param buffer The playlist, in any of the formats supported by
+ *        lastfm_parse_playlist()
+ * @param size Size of the buffer
+ * @param default_pls_title The title of the playlist in case the XML
+ *        doesn't provide one
+ * @param free_streams Whether the streams can be downloaded
+ * @param ws_ok If non-NULL, whether the document is a web service
+ *        response with status="ok" will be stored here
+ * @return A new playlist, or NULL if none was found
+ */
+LastfmPls *
+lastfm_parse_playlist_buffer            (const char *buffer,
+                                         size_t      size,
+                                         const char *default_pls_title,
+                                         gboolean    free_streams,
+                                         gboolean   *ws_ok)
+{
+        xmlTextReader *reader;
+        gboolean new_format = FALSE;
+        gboolean found = FALSE;
+        LastfmPls *pls = NULL;
+        char *pls_title = NULL;
+        int depth = 0;
+        int ret;
+
+        g_return_val_if_fail (buffer != NULL, NULL);
+
+        if (ws_ok != NULL) *ws_ok = FALSE;
+
+        reader = xmlReaderForMemory (buffer, size, NULL, NULL,
+                                     XML_PARSE_NONET | XML_PARSE_NOBLANKS);
+        if (reader == NULL) {
+                g_warning ("Unable to create XML reader");
+                return NULL;
+        }
+
+        /* Go to the root element */
+        ret = xmlTextReaderRead (reader);
+        while (ret == 1 && xmlTextReaderNodeType (reader) !=
+               XML_READER_TYPE_ELEMENT) {
+                ret = xmlTextReaderNext (reader);
+        }
+
+        /* First see whether the playlist is in the new format or not */
+        if (ret == 1) {
+                if (xml_reader_name_is (reader, "lfm")) {
+                        xmlChar *status = xmlTextReaderGetAttribute (
+                                reader, (xmlChar *) "status");
+                        if (ws_ok != NULL) {
+                                *ws_ok = xmlStrEqual (status,
+                                                      (xmlChar *) "ok");
+                        }
+                        if (status != NULL) xmlFree (status);
+                        new_format = TRUE;
+                        found = xml_reader_next_child (reader, ++depth);
+                        while (found &&
+                               !xml_reader_name_is (reader, "playlist")) {
+                                found = xml_reader_next_child (reader,
+                                                               depth);
+                        }
+                } else {
+                        found = xml_reader_name_is (reader, "playlist");
+                }
+        }
+
+        if (!found) {
+                g_warning ("Playlist file not in the expected format");
+        }
+
+        /* The <title> comes before the <trackList> */
+        while (found && xml_reader_next_child (reader, depth + 1)) {
+                if (pls_title == NULL &&
+                    xml_reader_name_is (reader, "title")) {
+                        pls_title = (char *) xmlTextReaderReadString (reader);
+                } else if (pls == NULL &&
+                           xml_reader_name_is (reader, "trackList")) {
+                        char *title;
+                        if (pls_title) g_strstrip (pls_title);
+                        if (pls_title && pls_title[0] != '\0') {
+                                title = lastfm_url_decode (pls_title);
+                        } else {
+                                title = g_strdup (default_pls_title);
+                        }
+                        pls = lastfm_pls_new ();
+                        while (xml_reader_next_child (reader, depth + 2)) {
+                                xmlNode *node;
+                                if (!xml_reader_name_is (reader, "track")) {
+                                        continue;
+                                }
+                                node = xmlTextReaderExpand (reader);
+                                if (node != NULL &&
+                                    node->xmlChildrenNode != NULL) {
+                                        lastfm_parse_track (
+                                                node->doc,
+                                                node->xmlChildrenNode,
+                                                pls, title, new_format,
+                                                free_streams);
+                                }
+                        }
+                        g_free (title);
+                        break;
+                }
+        }
+
+        if (found && pls == NULL) {
+                g_warning("No tracks found in playlist");
+        } else if (pls != NULL && lastfm_pls_size (pls) == 0) {
+                lastfm_pls_destroy (pls);
+                pls = NULL;
+        }
+
+        if (pls_title != NULL) xmlFree (pls_title);
+        xmlFreeTextReader (reader);
+        return pls;
+}
+
 /**
  * Request a new playlist from the currently active radio.
  * @param s The session
@@ -367,23 +576,21 @@ lastfm_request_playlist                 (LastfmSession *s,
         const char *disc_mode = discovery ? "1" : "0";
         char *url;
         char *buffer = NULL;
-        size_t bufsize = 0;
+        size_t bufsize;
         LastfmPls *pls = NULL;
 
         url = g_strconcat("http://", s->base_url, s->base_path,
                           "/xspf.php?sk=", s->id, "&discovery=", disc_mode,
                           "&desktop=1.5", NULL);
+        http_set_request_tag("playlist");
         http_get_buffer(url, &buffer, &bufsize);
         if (buffer != NULL) {
-                xmlDoc *doc = xmlParseMemory(buffer, bufsize);
-                if (doc != NULL) {
-                        pls = lastfm_parse_playlist (doc, pls_title,
-                                                     s->free_streams);
-                        xmlFreeDoc (doc);
-                } else {
-                        g_warning ("Playlist is not an XML document");
-                }
-                g_free(buffer);
+                pls = lastfm_parse_playlist_buffer (buffer, bufsize,
+                                                    pls_title,
+                                                    s->free_streams, NULL);
+                g_free (buffer);
+        } else {
+                g_warning ("Unable to get playlist");
         }
         g_free(url);
         return pls;
@@ -402,24 +609,21 @@ lastfm_request_custom_playlist          (LastfmSession *s,
 {
         g_return_val_if_fail(s != NULL && radio_url != NULL, NULL);
         char *buffer = NULL;
-        size_t bufsize = 0;
+        size_t bufsize;
         LastfmPls *pls = NULL;
         char *url = NULL;
         char *radio_url_escaped = escape_url(radio_url, TRUE);
         url = g_strconcat("http://", s->base_url, custom_pls_path,
                           "?sk=", s->id, "&url=", radio_url_escaped,
                           "&desktop=1.5", NULL);
+        http_set_request_tag("playlist");
         http_get_buffer(url, &buffer, &bufsize);
         if (buffer != NULL) {
-                xmlDoc *doc = xmlParseMemory(buffer, bufsize);
-                if (doc != NULL) {
-                        pls = lastfm_parse_playlist (doc, NULL,
-                                                     s->free_streams);
-                        xmlFreeDoc (doc);
-                } else {
-                        g_warning ("Playlist is not an XML document");
-                }
-                g_free(buffer);
+                pls = lastfm_parse_playlist_buffer (buffer, bufsize, NULL,
+                                                    s->free_streams, NULL);
+                g_free (buffer);
+        } else {
+                g_warning ("Unable to get custom playlist");
         }
         g_free(url);
         g_free(radio_url_escaped);
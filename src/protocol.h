@@ -47,6 +47,13 @@ lastfm_parse_playlist                   (xmlDoc     *doc,
                                          const char *default_pls_title,
                                          gboolean    free_streams);
 
+LastfmPls *
+lastfm_parse_playlist_buffer            (const char *buffer,
+                                         size_t      size,
+                                         const char *default_pls_title,
+                                         gboolean    free_streams,
+                                         gboolean   *ws_ok);
+
 LastfmPls *
 lastfm_request_custom_playlist          (LastfmSession *s,
                                          const char    *radio_url);
@@ -110,6 +110,7 @@ rsp_session_new                         (const char *username,
         auth = compute_auth_token(password, timestamp);
         url = g_strconcat(server->rsp_base_url, "&u=", username,
                           "&t=", timestamp, "&a=", auth, NULL);
+        http_set_request_tag("scrobble");
         http_get_buffer(url, &buffer, NULL);
         if (buffer == NULL) {
                 g_warning("Unable to initiate rsp session");
@@ -154,19 +155,22 @@ rsp_set_nowplaying                      (const RspSession  *rsp,
 {
         g_return_val_if_fail(rsp != NULL && t != NULL, RSP_RESPONSE_ERROR);
         RspResponse retvalue = RSP_RESPONSE_ERROR;
-        char *buffer;
+        GString *buffer = g_string_sized_new(256);
         char *retbuf = NULL;
-        char *duration = NULL;
-        char *artist = escape_url(t->artist, TRUE);
-        char *title = escape_url(t->title, TRUE);
-        char *album = escape_url(t->album, TRUE);
+        g_string_append(buffer, "s=");
+        g_string_append(buffer, rsp->id);
+        g_string_append(buffer, "&a=");
+        url_escape_gstr(buffer, t->artist);
+        g_string_append(buffer, "&t=");
+        url_escape_gstr(buffer, t->title);
+        g_string_append(buffer, "&b=");
+        url_escape_gstr(buffer, t->album);
+        g_string_append(buffer, "&m=&n=");
         if (t->duration != 0) {
-                duration = g_strdup_printf("&l=%u", t->duration / 1000);
+                g_string_append_printf(buffer, "&l=%u", t->duration / 1000);
         }
-        buffer = g_strconcat("s=", rsp->id, "&a=", artist,
-                             "&t=", title, "&b=", album,
-                             "&m=&n=", duration, NULL);
-        http_post_buffer (rsp->np_url, buffer, &retbuf, NULL, NULL);
+        http_set_request_tag ("scrobble");
+        http_post_buffer (rsp->np_url, buffer->str, &retbuf, NULL, NULL);
         if (retbuf != NULL && !strncmp(retbuf, "OK", 2)) {
                 g_debug("Correctly set Now Playing");
                 retvalue = RSP_RESPONSE_OK;
@@ -178,12 +182,8 @@ rsp_set_nowplaying                      (const RspSession  *rsp,
         } else {
                 g_debug("Problem setting Now Playing, connection error?");
         }
-        g_free(buffer);
+        g_string_free(buffer, TRUE);
         g_free(retbuf);
-        g_free(duration);
-        g_free(artist);
-        g_free(title);
-        g_free(album);
         return retvalue;
 }
 
@@ -195,13 +195,8 @@ rsp_scrobble                            (const RspSession  *rsp,
 {
         g_return_val_if_fail(rsp != NULL && t != NULL, RSP_RESPONSE_ERROR);
         RspResponse retvalue = RSP_RESPONSE_ERROR;
-        char *buffer;
+        GString *buffer = g_string_sized_new(256);
         char *retbuf = NULL;
-        char *duration = NULL;
-        char *timestamp = g_strdup_printf("%lu", start);
-        char *artist = escape_url(t->artist, TRUE);
-        char *title = escape_url(t->title, TRUE);
-        char *album = escape_url(t->album, TRUE);
         char *ratingstr;
         switch (rating) {
         case RSP_RATING_LOVE:
@@ -213,16 +208,24 @@ rsp_scrobble                            (const RspSession  *rsp,
         default:
                 ratingstr = ""; break;
         }
+        g_string_append(buffer, "s=");
+        g_string_append(buffer, rsp->id);
+        g_string_append(buffer, "&a[0]=");
+        url_escape_gstr(buffer, t->artist);
+        g_string_append(buffer, "&t[0]=");
+        url_escape_gstr(buffer, t->title);
+        g_string_append(buffer, "&b[0]=");
+        url_escape_gstr(buffer, t->album);
+        g_string_append_printf(buffer, "&i[0]=%lu&o[0]=L%s"
+                               "&n[0]=&m[0]=&r[0]=%s",
+                               (unsigned long) start,
+                               t->trackauth ? t->trackauth : "",
+                               ratingstr);
         if (t->duration != 0) {
-                duration = g_strdup_printf("&l[0]=%u", t->duration/1000);
+                g_string_append_printf(buffer, "&l[0]=%u", t->duration/1000);
         }
-        buffer = g_strconcat("s=", rsp->id, "&a[0]=", artist,
-                             "&t[0]=", title, "&b[0]=", album,
-                             "&i[0]=", timestamp,
-                             "&o[0]=L", t->trackauth,
-                             "&n[0]=&m[0]=&r[0]=", ratingstr,
-                             duration, NULL);
-        http_post_buffer (rsp->post_url, buffer, &retbuf, NULL, NULL);
+        http_set_request_tag ("scrobble");
+        http_post_buffer (rsp->post_url, buffer->str, &retbuf, NULL, NULL);
         if (retbuf != NULL && !strncmp(retbuf, "OK", 2)) {
                 g_debug("Track scrobbled");
                 retvalue = RSP_RESPONSE_OK;
@@ -234,13 +237,8 @@ rsp_scrobble                            (const RspSession  *rsp,
         } else {
                 g_debug("Problem scrobbling track, connection error?");
         }
-        g_free(buffer);
+        g_string_free(buffer, TRUE);
         g_free(retbuf);
-        g_free(duration);
-        g_free(timestamp);
-        g_free(artist);
-        g_free(title);
-        g_free(album);
         return retvalue;
 }
 
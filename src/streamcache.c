@@ -0,0 +1,607 @@
+/*
+ * streamcache.c -- On-disk cache of audio streams
+ *
+ * Copyright (C) 2007-2008 Igalia, S.L.
+ * Authors: Alberto Garcia <berto@igalia.com>
+ *
+ * This file is part of Vagalume and is published under the GNU GPLv3
+ * See the README file for more details.
+ */
+
+#include "config.h"
+#include "streamcache.h"
+#include "userconfig.h"
+#include "http.h"
+
+#ifndef HAVE_GCHECKSUM
+#   include "md5/md5.h"
+#endif
+
+#include <glib/gstdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+/* The cache is content-addressed: each stream is stored in a file
+ * named after the MD5 hash of its contents. The index maps the keys
+ * (which identify tracks) to those files, and it's used to evict the
+ * least recently used entries when the cache is over its limit.
+ * Several keys can share the same file */
+typedef struct {
+        char *hash;
+        guint64 size;
+        time_t used;
+} stream_cache_entry;
+
+/* Everything here is protected by cache_mutex. The index is loaded
+ * the first time it's needed */
+static GStaticMutex cache_mutex = G_STATIC_MUTEX_INIT;
+static GHashTable *cache_index = NULL;
+static guint64 cache_limit = 0;
+/* The index has changes that are not on disk yet */
+static gboolean index_dirty = FALSE;
+
+/* Number and size of the ranges compared by stream_cache_copy() */
+static const int stream_cache_probes = 3;
+#define STREAM_CACHE_PROBE_SIZE 16384
+
+struct _StreamCacheWriter {
+        char *key;
+        char *tmppath;
+        FILE *file;
+        guint64 size;
+        gboolean failed;
+#ifdef HAVE_GCHECKSUM
+        GChecksum *checksum;
+#else
+        md5_state_t md5;
+#endif
+};
+
+static const char *
+stream_cache_dir                        (void)
+{
+        static char *dir = NULL;
+        if (dir == NULL) {
+                const char *cfgdir = vgl_user_cfg_get_cfgdir ();
+                if (cfgdir != NULL) {
+                        dir = g_strconcat (cfgdir, "/streams", NULL);
+                        g_mkdir_with_parents (dir, 0755);
+                }
+        }
+        return dir;
+}
+
+static char *
+stream_cache_file_path                  (const char *hash)
+{
+        return g_strconcat (stream_cache_dir (), "/", hash, NULL);
+}
+
+static void
+stream_cache_entry_destroy              (stream_cache_entry *e)
+{
+        g_free (e->hash);
+        g_slice_free (stream_cache_entry, e);
+}
+
+/**
+ * Load the index, discarding entries whose file doesn't exist
+ * anymore. Must be called with cache_mutex held.
+ */
+static void
+stream_cache_load_index                 (void)
+{
+        char *indexpath, *contents = NULL;
+        const char *name;
+        GDir *dir;
+
+        if (cache_index != NULL || stream_cache_dir () == NULL) return;
+
+        /* Remove the incomplete streams of previous sessions. This
+         * runs before any new stream is written */
+        dir = g_dir_open (stream_cache_dir (), 0, NULL);
+        if (dir != NULL) {
+                while ((name = g_dir_read_name (dir)) != NULL) {
+                        if (g_str_has_prefix (name, "tmp-")) {
+                                char *path = stream_cache_file_path (name);
+                                g_unlink (path);
+                                g_free (path);
+                        }
+                }
+                g_dir_close (dir);
+        }
+
+        cache_index = g_hash_table_new_full (
+                g_str_hash, g_str_equal, g_free,
+                (GDestroyNotify) stream_cache_entry_destroy);
+
+        indexpath = g_strconcat (stream_cache_dir (), "/index", NULL);
+        if (g_file_get_contents (indexpath, &contents, NULL, NULL)) {
+                char **lines = g_strsplit (contents, "\n", 0);
+                int i;
+                for (i = 0; lines[i] != NULL; i++) {
+                        char **f = g_strsplit (lines[i], "\t", 4);
+                        if (g_strv_length (f) == 4) {
+                                char *path = stream_cache_file_path (f[1]);
+                                if (g_file_test (path, G_FILE_TEST_EXISTS)) {
+                                        stream_cache_entry *e;
+                                        e = g_slice_new (stream_cache_entry);
+                                        e->hash = g_strdup (f[1]);
+                                        e->size = g_ascii_strtoull (f[2],
+                                                                    NULL, 10);
+                                        e->used = strtol (f[3], NULL, 10);
+                                        g_hash_table_replace (cache_index,
+                                                              g_strdup (f[0]),
+                                                              e);
+                                }
+                                g_free (path);
+                        }
+                        g_strfreev (f);
+                }
+                g_strfreev (lines);
+                g_free (contents);
+        }
+        g_free (indexpath);
+}
+
+static void
+stream_cache_write_entry                (gpointer key,
+                                         gpointer value,
+                                         gpointer userdata)
+{
+        stream_cache_entry *e = value;
+        g_string_append_printf (userdata, "%s\t%s\t%" G_GUINT64_FORMAT
+                                "\t%ld\n", (char *) key, e->hash, e->size,
+                                (long) e->used);
+}
+
+/**
+ * Write the index to disk. Must be called with cache_mutex held.
+ */
+static void
+stream_cache_save_index                 (void)
+{
+        char *indexpath;
+        GString *str;
+
+        if (cache_index == NULL) return;
+
+        str = g_string_new (NULL);
+        g_hash_table_foreach (cache_index, stream_cache_write_entry, str);
+        indexpath = g_strconcat (stream_cache_dir (), "/index", NULL);
+        if (g_file_set_contents (indexpath, str->str, str->len, NULL)) {
+                index_dirty = FALSE;
+        } else {
+                g_warning ("Unable to write %s", indexpath);
+        }
+        g_free (indexpath);
+        g_string_free (str, TRUE);
+}
+
+typedef struct {
+        const char *hash;
+        gboolean found;
+} stream_cache_find_data;
+
+static void
+stream_cache_find_hash                  (gpointer key,
+                                         gpointer value,
+                                         gpointer userdata)
+{
+        stream_cache_find_data *d = userdata;
+        stream_cache_entry *e = value;
+        if (g_str_equal (e->hash, d->hash)) d->found = TRUE;
+}
+
+/**
+ * Remove a file from the cache if no entry of the index uses it.
+ * Must be called with cache_mutex held.
+ * @param hash The hash of the file
+ */
+static void
+stream_cache_remove_unused              (const char *hash)
+{
+        stream_cache_find_data d;
+        d.hash = hash;
+        d.found = FALSE;
+        g_hash_table_foreach (cache_index, stream_cache_find_hash, &d);
+        if (!d.found) {
+                char *path = stream_cache_file_path (hash);
+                g_unlink (path);
+                g_free (path);
+        }
+}
+
+/**
+ * Remove an entry from the index, and its file if no other entry
+ * uses it. Must be called with cache_mutex held.
+ * @param key The key of the entry
+ */
+static void
+stream_cache_remove                     (const char *key)
+{
+        stream_cache_entry *e = g_hash_table_lookup (cache_index, key);
+        if (e != NULL) {
+                char *hash = g_strdup (e->hash);
+                g_hash_table_remove (cache_index, key);
+                stream_cache_remove_unused (hash);
+                g_free (hash);
+        }
+}
+
+typedef struct {
+        GHashTable *hashes;
+        guint64 total;
+        const char *oldest_key;
+        time_t oldest;
+} stream_cache_usage;
+
+static void
+stream_cache_add_usage                  (gpointer key,
+                                         gpointer value,
+                                         gpointer userdata)
+{
+        stream_cache_usage *u = userdata;
+        stream_cache_entry *e = value;
+        if (g_hash_table_lookup (u->hashes, e->hash) == NULL) {
+                g_hash_table_insert (u->hashes, e->hash, e);
+                u->total += e->size;
+        }
+        if (u->oldest_key == NULL || e->used < u->oldest) {
+                u->oldest_key = key;
+                u->oldest = e->used;
+        }
+}
+
+/**
+ * Remove the least recently used entries until the files in the
+ * cache fit in cache_limit. Must be called with cache_mutex held.
+ */
+static void
+stream_cache_evict                      (void)
+{
+        stream_cache_usage u;
+        do {
+                u.hashes = g_hash_table_new (g_str_hash, g_str_equal);
+                u.total = 0;
+                u.oldest_key = NULL;
+                g_hash_table_foreach (cache_index, stream_cache_add_usage, &u);
+                g_hash_table_destroy (u.hashes);
+                if (u.total > cache_limit && u.oldest_key != NULL) {
+                        g_debug ("Removing %s from the stream cache",
+                                 u.oldest_key);
+                        stream_cache_remove (u.oldest_key);
+                }
+        } while (u.total > cache_limit && u.oldest_key != NULL);
+}
+
+/**
+ * Set the maximum size of the cache, removing old entries if
+ * necessary
+ * @param bytes The maximum size, 0 to disable the cache
+ */
+void
+stream_cache_set_limit                  (guint64 bytes)
+{
+        g_static_mutex_lock (&cache_mutex);
+        cache_limit = bytes;
+        stream_cache_load_index ();
+        if (cache_index != NULL) {
+                stream_cache_evict ();
+                stream_cache_save_index ();
+        }
+        g_static_mutex_unlock (&cache_mutex);
+}
+
+/**
+ * @return Whether streams are being cached
+ */
+gboolean
+stream_cache_is_enabled                 (void)
+{
+        gboolean enabled;
+        g_static_mutex_lock (&cache_mutex);
+        enabled = cache_limit > 0 && stream_cache_dir () != NULL;
+        g_static_mutex_unlock (&cache_mutex);
+        return enabled;
+}
+
+/**
+ * Start storing a stream in the cache. The data is written to a
+ * temporary file and only added to the cache once it's complete.
+ * @param key The key used to find the stream later. It can't contain
+ *            tabs or newlines
+ * @return A new writer, or NULL if the cache is disabled
+ */
+StreamCacheWriter *
+stream_cache_writer_new                 (const char *key)
+{
+        StreamCacheWriter *w;
+        char *tmppath;
+        int fd;
+
+        g_return_val_if_fail (key != NULL, NULL);
+        g_return_val_if_fail (strpbrk (key, "\t\n") == NULL, NULL);
+
+        if (!stream_cache_is_enabled ()) return NULL;
+
+        tmppath = g_strconcat (stream_cache_dir (), "/tmp-XXXXXX", NULL);
+        fd = g_mkstemp (tmppath);
+        if (fd == -1) {
+                g_warning ("Unable to create a file in the stream cache");
+                g_free (tmppath);
+                return NULL;
+        }
+
+        w = g_slice_new (StreamCacheWriter);
+        w->key = g_strdup (key);
+        w->tmppath = tmppath;
+        w->file = fdopen (fd, "wb");
+        w->size = 0;
+        w->failed = (w->file == NULL);
+#ifdef HAVE_GCHECKSUM
+        w->checksum = g_checksum_new (G_CHECKSUM_MD5);
+#else
+        md5_init (&(w->md5));
+#endif
+        return w;
+}
+
+/**
+ * Add data to a stream being cached
+ * @param w The writer
+ * @param data The data
+ * @param size The size of @data
+ */
+void
+stream_cache_writer_append              (StreamCacheWriter *w,
+                                         const char        *data,
+                                         size_t             size)
+{
+        g_return_if_fail (w != NULL);
+        if (w->failed) return;
+        if (fwrite (data, 1, size, w->file) != size) {
+                g_warning ("Error writing to the stream cache");
+                w->failed = TRUE;
+                return;
+        }
+#ifdef HAVE_GCHECKSUM
+        g_checksum_update (w->checksum, (const guchar *) data, size);
+#else
+        md5_append (&(w->md5), (const md5_byte_t *) data, size);
+#endif
+        w->size += size;
+}
+
+static char *
+stream_cache_writer_get_hash            (StreamCacheWriter *w)
+{
+#ifdef HAVE_GCHECKSUM
+        return g_strdup (g_checksum_get_string (w->checksum));
+#else
+        const int digestlen = 16;
+        unsigned char digest[digestlen];
+        char *hexdigest = g_malloc (digestlen*2 + 1);
+        int i;
+        md5_finish (&(w->md5), digest);
+        for (i = 0; i < digestlen; i++) {
+                sprintf (hexdigest + 2*i, "%02x", digest[i]);
+        }
+        return hexdigest;
+#endif
+}
+
+/**
+ * Finish writing a stream and free the writer. The stream is added
+ * to the cache if it's complete, evicting old entries if necessary.
+ * @param w The writer
+ * @param complete Whether all the stream was written
+ */
+void
+stream_cache_writer_finish              (StreamCacheWriter *w,
+                                         gboolean           complete)
+{
+        g_return_if_fail (w != NULL);
+
+        if (w->file != NULL && fclose (w->file) != 0) {
+                w->failed = TRUE;
+        }
+
+        if (complete && !w->failed && w->size > 0) {
+                char *hash = stream_cache_writer_get_hash (w);
+                char *path = stream_cache_file_path (hash);
+                stream_cache_entry *e;
+
+                g_static_mutex_lock (&cache_mutex);
+                stream_cache_load_index ();
+                /* Same contents as another entry: reuse its file */
+                if (g_file_test (path, G_FILE_TEST_EXISTS)) {
+                        g_unlink (w->tmppath);
+                } else if (g_rename (w->tmppath, path) != 0) {
+                        g_warning ("Unable to add %s to the stream cache",
+                                   w->key);
+                        g_unlink (w->tmppath);
+                        g_free (hash);
+                        hash = NULL;
+                }
+                if (hash != NULL) {
+                        stream_cache_entry *old;
+                        char *oldhash = NULL;
+                        g_debug ("Stream %s cached (%" G_GUINT64_FORMAT
+                                 " bytes)", w->key, w->size);
+                        old = g_hash_table_lookup (cache_index, w->key);
+                        if (old != NULL && !g_str_equal (old->hash, hash)) {
+                                oldhash = g_strdup (old->hash);
+                        }
+                        e = g_slice_new (stream_cache_entry);
+                        e->hash = hash;
+                        e->size = w->size;
+                        e->used = time (NULL);
+                        g_hash_table_replace (cache_index,
+                                              g_strdup (w->key), e);
+                        if (oldhash != NULL) {
+                                stream_cache_remove_unused (oldhash);
+                                g_free (oldhash);
+                        }
+                        stream_cache_evict ();
+                        stream_cache_save_index ();
+                }
+                g_static_mutex_unlock (&cache_mutex);
+                g_free (path);
+        } else {
+                g_unlink (w->tmppath);
+        }
+
+#ifdef HAVE_GCHECKSUM
+        g_checksum_free (w->checksum);
+#endif
+        g_free (w->key);
+        g_free (w->tmppath);
+        g_slice_free (StreamCacheWriter, w);
+}
+
+/**
+ * Open a cached stream, marking it as recently used
+ * @param key The key of the stream
+ * @param size Where to store the size of the stream, or NULL
+ * @return The open file, or NULL if the stream is not in the cache
+ */
+FILE *
+stream_cache_open                       (const char *key,
+                                         guint64    *size)
+{
+        stream_cache_entry *e;
+        FILE *file = NULL;
+
+        g_return_val_if_fail (key != NULL, NULL);
+
+        g_static_mutex_lock (&cache_mutex);
+        if (cache_limit > 0) {
+                stream_cache_load_index ();
+        }
+        e = cache_index ? g_hash_table_lookup (cache_index, key) : NULL;
+        if (e != NULL) {
+                char *path = stream_cache_file_path (e->hash);
+                file = g_fopen (path, "rb");
+                if (file != NULL) {
+                        if (size != NULL) *size = e->size;
+                        /* Only the access time changes, so the index
+                         * is written later, see stream_cache_flush() */
+                        e->used = time (NULL);
+                        index_dirty = TRUE;
+                } else {
+                        stream_cache_remove (key);
+                }
+                g_free (path);
+        }
+        g_static_mutex_unlock (&cache_mutex);
+
+        return file;
+}
+
+/**
+ * Write the index to disk if it has changed since the last time. The
+ * index is always written when entries are added or removed, so this
+ * only needs to be called on shutdown.
+ */
+void
+stream_cache_flush                      (void)
+{
+        g_static_mutex_lock (&cache_mutex);
+        if (index_dirty) {
+                stream_cache_save_index ();
+        }
+        g_static_mutex_unlock (&cache_mutex);
+}
+
+/**
+ * Compare a few ranges of a cached stream (at the beginning, in the
+ * middle and at the end) with the same ranges of a remote file
+ * @param in The cached stream
+ * @param size The size of the stream, which is also the remote size
+ * @param url The URL of the file
+ * @return Whether all ranges are identical
+ */
+static gboolean
+stream_cache_probe_matches              (FILE       *in,
+                                         guint64     size,
+                                         const char *url)
+{
+        char local[STREAM_CACHE_PROBE_SIZE];
+        char remote[STREAM_CACHE_PROBE_SIZE];
+        size_t len = MIN (size, STREAM_CACHE_PROBE_SIZE);
+        gboolean match = TRUE;
+        int i;
+
+        for (i = 0; match && i < stream_cache_probes; i++) {
+                guint64 offset = (size - len) * i / (stream_cache_probes - 1);
+                match = fseek (in, (long) offset, SEEK_SET) == 0 &&
+                        fread (local, 1, len, in) == len &&
+                        http_get_range (url, offset, remote, len) &&
+                        memcmp (local, remote, len) == 0;
+        }
+
+        return match && fseek (in, 0, SEEK_SET) == 0;
+}
+
+/**
+ * Copy a cached stream to a file, if it's the same file that would be
+ * downloaded from a URL. The contents can't be fully compared without
+ * downloading them, so the file is used only if the server reports
+ * the same size and a few ranges of it are identical to the cached
+ * ones (see stream_cache_probe_matches()). This is not a proof that
+ * both files are the same, but a re-encoded file or one with a
+ * different bitrate won't pass. This makes blocking HTTP requests.
+ * @param key The key of the stream
+ * @param url The URL of the file
+ * @param dstpath The destination file
+ * @return TRUE if the file was copied, FALSE otherwise
+ */
+gboolean
+stream_cache_copy                       (const char *key,
+                                         const char *url,
+                                         const char *dstpath)
+{
+        FILE *in, *out;
+        guint64 size = 0;
+        gint64 remote;
+        gboolean success;
+        char *tmppath;
+        char buf[16384];
+        size_t n;
+
+        g_return_val_if_fail (key && url && dstpath, FALSE);
+
+        in = stream_cache_open (key, &size);
+        if (in == NULL) return FALSE;
+
+        remote = http_get_content_length (url);
+        if (remote < 0 || (guint64) remote != size ||
+            !stream_cache_probe_matches (in, size, url)) {
+                g_debug ("Cached stream %s doesn't match %s", key, url);
+                fclose (in);
+                return FALSE;
+        }
+
+        tmppath = g_strconcat (dstpath, ".tmp", NULL);
+        out = g_fopen (tmppath, "wb");
+        success = (out != NULL);
+        while (success && (n = fread (buf, 1, sizeof (buf), in)) > 0) {
+                success = (fwrite (buf, 1, n, out) == n);
+        }
+        success = success && !ferror (in);
+        if (out != NULL && fclose (out) != 0) success = FALSE;
+        fclose (in);
+
+        if (success && g_rename (tmppath, dstpath) == 0) {
+                g_debug ("Copied %s from the stream cache", dstpath);
+        } else {
+                g_unlink (tmppath);
+                success = FALSE;
+        }
+        g_free (tmppath);
+
+        return success;
+}
@@ -0,0 +1,49 @@
+/*
+ * streamcache.h -- On-disk cache of audio streams
+ *
+ * Copyright (C) 2007-2008 Igalia, S.L.
+ * Authors: Alberto Garcia <berto@igalia.com>
+ *
+ * This file is part of Vagalume and is published under the GNU GPLv3
+ * See the README file for more details.
+ */
+
+#ifndef STREAMCACHE_H
+#define STREAMCACHE_H
+
+#include <glib.h>
+#include <stdio.h>
+
+typedef struct _StreamCacheWriter StreamCacheWriter;
+
+void
+stream_cache_set_limit                  (guint64 bytes);
+
+gboolean
+stream_cache_is_enabled                 (void);
+
+StreamCacheWriter *
+stream_cache_writer_new                 (const char *key);
+
+void
+stream_cache_writer_append              (StreamCacheWriter *w,
+                                         const char        *data,
+                                         size_t             size);
+
+void
+stream_cache_writer_finish              (StreamCacheWriter *w,
+                                         gboolean           complete);
+
+FILE *
+stream_cache_open                       (const char *key,
+                                         guint64    *size);
+
+void
+stream_cache_flush                      (void);
+
+gboolean
+stream_cache_copy                       (const char *key,
+                                         const char *url,
+                                         const char *dstpath);
+
+#endif
@@ -0,0 +1,147 @@
+/*
+ * strpool.c -- Pool of shared, reference counted strings
+ *
+ * Copyright (C) 2007-2008 Igalia, S.L.
+ * Authors: Alberto Garcia <berto@igalia.com>
+ *
+ * This file is part of Vagalume and is published under the GNU GPLv3
+ * See the README file for more details.
+ */
+
+#include "strpool.h"
+
+#include <string.h>
+
+/* A string in the pool. The string is stored right after the header,
+ * so the entry of a string can be obtained from its address */
+typedef struct {
+        guint refcount;
+        gsize size; /* Including the trailing nul */
+        char str[1];
+} StrPoolEntry;
+
+#define STR_POOL_ENTRY(s) \
+        ((StrPoolEntry *) ((s) - G_STRUCT_OFFSET (StrPoolEntry, str)))
+
+/* Everything here is protected by pool_mutex, since tracks are
+ * parsed and destroyed from several threads. ref_bytes is the memory
+ * that the strings would need if every reference had its own copy */
+static GStaticMutex pool_mutex = G_STATIC_MUTEX_INIT;
+static GHashTable *pool = NULL;
+static guint n_refs = 0;
+static gsize pool_bytes = 0;
+static gsize ref_bytes = 0;
+
+/**
+ * Get a shared copy of a string from the pool, adding it if it's not
+ * there yet. Strings obtained from the pool must not be modified.
+ * @param str The string, or NULL
+ * @return The shared copy (or NULL). It must be released with
+ * str_pool_unref() when no longer used
+ */
+const char *
+str_pool_add                            (const char *str)
+{
+        StrPoolEntry *entry;
+
+        if (str == NULL) return NULL;
+
+        g_static_mutex_lock (&pool_mutex);
+        if (pool == NULL) {
+                pool = g_hash_table_new (g_str_hash, g_str_equal);
+        }
+        entry = g_hash_table_lookup (pool, str);
+        if (entry == NULL) {
+                gsize size = strlen (str) + 1;
+                entry = g_malloc (G_STRUCT_OFFSET (StrPoolEntry, str) + size);
+                entry->refcount = 0;
+                entry->size = size;
+                memcpy (entry->str, str, size);
+                g_hash_table_insert (pool, entry->str, entry);
+                pool_bytes += size;
+        }
+        entry->refcount++;
+        n_refs++;
+        ref_bytes += entry->size;
+        g_static_mutex_unlock (&pool_mutex);
+
+        return entry->str;
+}
+
+/**
+ * Same as str_pool_add(), but freeing the original string
+ * @param str A string allocated with g_malloc(), or NULL
+ * @return The shared copy (or NULL)
+ */
+const char *
+str_pool_take                           (char *str)
+{
+        const char *retval = str_pool_add (str);
+        g_free (str);
+        return retval;
+}
+
+/**
+ * Add a reference to a string from the pool
+ * @param str A string returned by str_pool_add(), or NULL
+ * @return The same string
+ */
+const char *
+str_pool_ref                            (const char *str)
+{
+        if (str != NULL) {
+                StrPoolEntry *entry = STR_POOL_ENTRY (str);
+                g_static_mutex_lock (&pool_mutex);
+                entry->refcount++;
+                n_refs++;
+                ref_bytes += entry->size;
+                g_static_mutex_unlock (&pool_mutex);
+        }
+        return str;
+}
+
+/**
+ * Release a reference to a string from the pool, removing it from
+ * the pool if it was the last one
+ * @param str A string returned by str_pool_add(), or NULL
+ */
+void
+str_pool_unref                          (const char *str)
+{
+        StrPoolEntry *entry;
+
+        if (str == NULL) return;
+
+        entry = STR_POOL_ENTRY (str);
+        g_static_mutex_lock (&pool_mutex);
+        g_warn_if_fail (entry->refcount > 0);
+        n_refs--;
+        ref_bytes -= entry->size;
+        if (--entry->refcount == 0) {
+                g_hash_table_remove (pool, entry->str);
+                pool_bytes -= entry->size;
+                g_free (entry);
+        }
+        g_static_mutex_unlock (&pool_mutex);
+}
+
+/**
+ * Write a human-readable report of the strings in the pool and the
+ * memory saved by sharing them
+ * @return A newly allocated string, to be freed with g_free()
+ */
+char *
+str_pool_dump                           (void)
+{
+        char *str;
+
+        g_static_mutex_lock (&pool_mutex);
+        str = g_strdup_printf ("String pool: %u strings, %u references, "
+                               "%lu bytes stored, %lu bytes deduplicated\n",
+                               pool ? g_hash_table_size (pool) : 0, n_refs,
+                               (unsigned long) pool_bytes,
+                               (unsigned long) (ref_bytes - pool_bytes));
+        g_static_mutex_unlock (&pool_mutex);
+
+        return str;
+}
@@ -0,0 +1,31 @@
+/*
+ * strpool.h -- Pool of shared, reference counted strings
+ *
+ * Copyright (C) 2007-2008 Igalia, S.L.
+ * Authors: Alberto Garcia <berto@igalia.com>
+ *
+ * This file is part of Vagalume and is published under the GNU GPLv3
+ * See the README file for more details.
+ */
+
+#ifndef STRPOOL_H
+#define STRPOOL_H
+
+#include <glib.h>
+
+const char *
+str_pool_add                            (const char *str);
+
+const char *
+str_pool_take                           (char *str);
+
+const char *
+str_pool_ref                            (const char *str);
+
+void
+str_pool_unref                          (const char *str);
+
+char *
+str_pool_dump                           (void);
+
+#endif
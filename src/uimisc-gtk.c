@@ -9,6 +9,7 @@
  */
 
 #include "uimisc.h"
+#include "audio.h"
 #include "util.h"
 #include "compat.h"
 
@@ -25,6 +26,7 @@ typedef struct {
 #ifdef HAVE_LIBPROXY
         GtkWidget *sysproxy;
 #endif
+        GtkWidget *decodercombo, *sinkcombo, *recalibrate;
         GtkWidget *disableconfdiags;
         GtkWidget *helpbtn;
 #ifdef SET_IM_STATUS
@@ -500,6 +502,76 @@ usercfg_add_imstatus_settings           (usercfgwin *win,
 #endif
 }
 
+static GtkWidget *
+usercfg_create_audio_combobox           (const char * const *names,
+                                         const char         *value)
+{
+        GtkWidget *combo = gtk_combo_box_text_new_with_entry ();
+        GtkEntry *entry = GTK_ENTRY (gtk_bin_get_child (GTK_BIN (combo)));
+        for (; *names != NULL; names++) {
+                gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (combo),
+                                                *names);
+        }
+        gtk_entry_set_text (entry, value);
+        return combo;
+}
+
+static const char *
+usercfg_get_audio_combobox              (GtkWidget *combo)
+{
+        return gtk_entry_get_text (GTK_ENTRY (gtk_bin_get_child (
+                                                      GTK_BIN (combo))));
+}
+
+static void
+usercfg_add_audio_settings              (usercfgwin *win,
+                                         VglUserCfg *cfg)
+{
+        g_return_if_fail(win != NULL && GTK_IS_NOTEBOOK(win->nb));
+        GtkTable *table;
+        GtkWidget *decoderlabel, *sinklabel, *recalibratelabel;
+        const char *help;
+
+        /* Create widgets */
+        table = GTK_TABLE (gtk_table_new (3, 2, FALSE));
+        decoderlabel = gtk_label_new (_("Decoder:"));
+        sinklabel = gtk_label_new (_("Audio output:"));
+        recalibratelabel = gtk_label_new (_("Select the fastest ones "
+                                            "again:"));
+        win->decodercombo = usercfg_create_audio_combobox (
+                lastfm_audio_get_decoder_candidates (), cfg->audio_decoder);
+        win->sinkcombo = usercfg_create_audio_combobox (
+                lastfm_audio_get_sink_candidates (), cfg->audio_sink);
+        win->recalibrate = gtk_check_button_new ();
+
+        /* Pack widgets */
+        gtk_misc_set_alignment (GTK_MISC (decoderlabel), 0, 0.5);
+        gtk_misc_set_alignment (GTK_MISC (sinklabel), 0, 0.5);
+        gtk_misc_set_alignment (GTK_MISC (recalibratelabel), 0, 0.5);
+        gtk_table_attach (table, decoderlabel, 0, 1, 0, 1, GTK_FILL, 0, 5, 5);
+        gtk_table_attach (table, win->decodercombo, 1, 2, 0, 1,
+                          GTK_EXPAND | GTK_FILL, 0, 5, 5);
+        gtk_table_attach (table, sinklabel, 0, 1, 1, 2, GTK_FILL, 0, 5, 5);
+        gtk_table_attach (table, win->sinkcombo, 1, 2, 1, 2,
+                          GTK_EXPAND | GTK_FILL, 0, 5, 5);
+        gtk_table_attach (table, recalibratelabel, 0, 1, 2, 3,
+                          GTK_FILL, 0, 5, 5);
+        gtk_table_attach (table, win->recalibrate, 1, 2, 2, 3, 0, 0, 5, 5);
+        gtk_notebook_append_page (win->nb, GTK_WIDGET (table),
+                                  gtk_label_new (_("Audio")));
+
+        /* Set help */
+        help = _("* Decoder and audio output:\n"
+                 "The GStreamer elements used to play the music. Leave "
+                 "them empty to use the default ones. The first time "
+                 "Vagalume runs it selects the ones that use less CPU.\n\n"
+                 "* Select the fastest ones again:\n"
+                 "Measure all the available decoders and outputs again "
+                 "in background and keep the fastest ones. "
+                 "Changes take effect from the next song.");
+        g_object_set_data(G_OBJECT(table), "help-message", (gpointer) help);
+}
+
 static void
 usercfg_add_misc_settings               (usercfgwin *win,
                                          VglUserCfg *cfg)
@@ -585,6 +657,7 @@ ui_usercfg_window                       (GtkWindow   *parent,
         gboolean changed = FALSE;
         usercfgwin win;
         const VglUserCfg *origcfg = *cfg;
+        const char *decoder, *sink;
 
         if (*cfg == NULL) *cfg = vgl_user_cfg_new();
         memset (&win, 0, sizeof(win));
@@ -601,6 +674,7 @@ ui_usercfg_window                       (GtkWindow   *parent,
         usercfg_add_connection_settings(&win, *cfg);
         usercfg_add_download_settings(&win, *cfg);
         usercfg_add_imstatus_settings(&win, *cfg);
+        usercfg_add_audio_settings(&win, *cfg);
         usercfg_add_misc_settings(&win, *cfg);
 
         gtk_box_pack_start (GTK_BOX (gtk_dialog_get_content_area (win.dialog)),
@@ -650,6 +724,19 @@ ui_usercfg_window                       (GtkWindow   *parent,
                 (*cfg)->im_telepathy = gtk_toggle_button_get_active(
                         GTK_TOGGLE_BUTTON(win.imtelepathy));
 #endif
+                decoder = usercfg_get_audio_combobox(win.decodercombo);
+                sink = usercfg_get_audio_combobox(win.sinkcombo);
+                if (strcmp(decoder, (*cfg)->audio_decoder) ||
+                    strcmp(sink, (*cfg)->audio_sink)) {
+                        /* Selected by hand, don't measure them */
+                        vgl_user_cfg_set_audio_decoder(*cfg, decoder);
+                        vgl_user_cfg_set_audio_sink(*cfg, sink);
+                        (*cfg)->audio_calibrated = TRUE;
+                }
+                if (gtk_toggle_button_get_active(
+                            GTK_TOGGLE_BUTTON(win.recalibrate))) {
+                        (*cfg)->audio_calibrated = FALSE;
+                }
                 (*cfg)->disable_confirm_dialogs = gtk_toggle_button_get_active(
                         GTK_TOGGLE_BUTTON(win.disableconfdiags));
 #ifdef HAVE_TRAY_ICON
@@ -12,6 +12,7 @@
 #include <hildon/hildon.h>
 
 #include "uimisc.h"
+#include "audio.h"
 #include "util.h"
 #include "compat.h"
 
@@ -231,6 +232,34 @@ update_imstatus_config                  (HildonTouchSelector *sel,
         g_list_free (l);
 }
 
+static HildonButton *
+usercfg_create_audio_picker             (const char         *title,
+                                         const char * const *names,
+                                         const char         *value)
+{
+        HildonButton *b;
+        HildonTouchSelector *sel;
+
+        sel = HILDON_TOUCH_SELECTOR (hildon_touch_selector_entry_new_text ());
+        if (*names == NULL) {
+                /* Hack for libhildon < 2.2.5 */
+                hildon_touch_selector_append_text (sel, "");
+        } else for (; *names != NULL; names++) {
+                hildon_touch_selector_append_text (sel, *names);
+        }
+
+        b = HILDON_BUTTON (hildon_picker_button_new (
+               FINGER_SIZE, HILDON_BUTTON_ARRANGEMENT_VERTICAL));
+        hildon_picker_button_set_selector (HILDON_PICKER_BUTTON (b), sel);
+        hildon_button_set_title (b, title);
+        hildon_button_set_value (b, value);
+        hildon_button_set_alignment (b, 0.0, 0.5, 1.0, 0.0);
+        hildon_button_set_title_alignment (b, 0.0, 0.5);
+        hildon_button_set_value_alignment (b, 0.0, 0.5);
+
+        return b;
+}
+
 gboolean
 ui_usercfg_window                       (GtkWindow   *parent,
                                          VglUserCfg **cfg)
@@ -240,14 +269,15 @@ ui_usercfg_window                       (GtkWindow   *parent,
         GtkWidget *label;
         GtkWidget *frame;
         GtkEntry *user, *pw, *proxy, *imtemplate;
-        HildonButton *service, *dlbutton, *imbutton;
+        HildonButton *service, *dlbutton, *imbutton, *decoder, *sink;
         HildonCheckButton *scrob, *discov, *useproxy;
-        HildonCheckButton *lowbitrate, *autodl, *nodiags;
+        HildonCheckButton *lowbitrate, *autodl, *nodiags, *recalibrate;
         HildonTouchSelector *servicesel, *imsel;
         GtkBox *vbox, *hbox, *framebox;
         GtkSizeGroup *size_group;
         gboolean changed = FALSE;
         gboolean none_selected;
+        const char *decoderval, *sinkval;
 
         g_return_val_if_fail (cfg != NULL, FALSE);
         if (*cfg == NULL) *cfg = vgl_user_cfg_new ();
@@ -399,6 +429,30 @@ ui_usercfg_window                       (GtkWindow   *parent,
         gtk_box_pack_start (hbox, GTK_WIDGET (imtemplate), TRUE, TRUE, 0);
         gtk_box_pack_start (vbox, GTK_WIDGET (hbox), FALSE, FALSE, 0);
 
+        /* Audio frame */
+        frame = gtk_frame_new (_("Audio"));
+        vbox = GTK_BOX (gtk_vbox_new (TRUE, 0));
+        gtk_box_pack_start (framebox, frame, FALSE, FALSE, 10);
+        gtk_container_add (GTK_CONTAINER (frame), GTK_WIDGET (vbox));
+
+        /* Decoder and sink */
+        decoder = usercfg_create_audio_picker (
+                _("Decoder"), lastfm_audio_get_decoder_candidates (),
+                (*cfg)->audio_decoder);
+        gtk_box_pack_start (vbox, GTK_WIDGET (decoder), FALSE, FALSE, 0);
+        sink = usercfg_create_audio_picker (
+                _("Audio output"), lastfm_audio_get_sink_candidates (),
+                (*cfg)->audio_sink);
+        gtk_box_pack_start (vbox, GTK_WIDGET (sink), FALSE, FALSE, 0);
+
+        /* Measure them again */
+        recalibrate = HILDON_CHECK_BUTTON (
+                hildon_check_button_new (FINGER_SIZE));
+        gtk_button_set_label (GTK_BUTTON (recalibrate),
+                              /* Translators: keep this string short!! */
+                              _("Select the fastest ones again"));
+        gtk_box_pack_start (vbox, GTK_WIDGET (recalibrate), FALSE, FALSE, 0);
+
         /* Misc frame */
         frame = gtk_frame_new (_("Misc"));
         vbox = GTK_BOX (gtk_vbox_new (TRUE, 0));
@@ -468,6 +522,20 @@ ui_usercfg_window                       (GtkWindow   *parent,
                 vgl_user_cfg_set_imstatus_template (
                         *cfg, gtk_entry_get_text (imtemplate));
                 update_imstatus_config (imsel, *cfg);
+                decoderval = hildon_button_get_value (decoder);
+                sinkval = hildon_button_get_value (sink);
+                if (decoderval == NULL) decoderval = "";
+                if (sinkval == NULL) sinkval = "";
+                if (strcmp (decoderval, (*cfg)->audio_decoder) ||
+                    strcmp (sinkval, (*cfg)->audio_sink)) {
+                        /* Selected by hand, don't measure them */
+                        vgl_user_cfg_set_audio_decoder (*cfg, decoderval);
+                        vgl_user_cfg_set_audio_sink (*cfg, sinkval);
+                        (*cfg)->audio_calibrated = TRUE;
+                }
+                if (hildon_check_button_get_active (recalibrate)) {
+                        (*cfg)->audio_calibrated = FALSE;
+                }
                 (*cfg)->disable_confirm_dialogs =
                         hildon_check_button_get_active (nodiags);
                 changed = TRUE;
@@ -173,6 +173,24 @@ vgl_user_cfg_set_imstatus_template      (VglUserCfg *cfg,
         cfg->imstatus_template = g_strstrip(g_strdup(str));
 }
 
+void
+vgl_user_cfg_set_audio_decoder          (VglUserCfg *cfg,
+                                         const char *decoder)
+{
+        g_return_if_fail(cfg != NULL && decoder != NULL);
+        g_free(cfg->audio_decoder);
+        cfg->audio_decoder = g_strstrip(g_strdup(decoder));
+}
+
+void
+vgl_user_cfg_set_audio_sink             (VglUserCfg *cfg,
+                                         const char *sink)
+{
+        g_return_if_fail(cfg != NULL && sink != NULL);
+        g_free(cfg->audio_sink);
+        cfg->audio_sink = g_strstrip(g_strdup(sink));
+}
+
 VglUserCfg *
 vgl_user_cfg_new                        (void)
 {
@@ -182,6 +200,8 @@ vgl_user_cfg_new                        (void)
         cfg->http_proxy = g_strdup("");
         cfg->download_dir = default_download_dir();
         cfg->imstatus_template = g_strdup(DEFAULT_IMSTATUS_TEMPLATE);
+        cfg->audio_decoder = g_strdup("");
+        cfg->audio_sink = g_strdup("");
         cfg->server = vgl_server_get_default ();
         if (cfg->server) vgl_object_ref (cfg->server);
         cfg->use_proxy = FALSE;
@@ -197,6 +217,16 @@ vgl_user_cfg_new                        (void)
         cfg->show_notifications = TRUE;
         cfg->close_to_systray = TRUE;
         cfg->autodl_free_tracks = FALSE;
+        /* Longer than the stall timeout of the streams, see http.c */
+        cfg->prefetch_window = 10;
+        cfg->prefetch_max_kb = 1024;
+        cfg->playlist_low_watermark = 2;
+        cfg->buffer_preroll_kb = 64;
+        cfg->buffer_low_kb = 32;
+        cfg->buffer_high_kb = 512;
+        cfg->keep_pipeline_warm = FALSE;
+        cfg->stream_cache_mb = 50;
+        cfg->audio_calibrated = FALSE;
         return cfg;
 }
 
@@ -208,6 +238,8 @@ vgl_user_cfg_destroy                    (VglUserCfg *cfg)
         g_free(cfg->http_proxy);
         g_free(cfg->download_dir);
         g_free(cfg->imstatus_template);
+        g_free(cfg->audio_decoder);
+        g_free(cfg->audio_sink);
         vgl_object_unref(cfg->server);
         g_slice_free(VglUserCfg, cfg);
 }
@@ -279,6 +311,76 @@ lastfm_old_usercfg_read                 (void)
         return cfg;
 }
 
+static void
+cfg_parse_password                      (xmlDoc        *doc,
+                                         const xmlNode *node,
+                                         gpointer       obj)
+{
+        char *str = xml_node_get_string (doc, node);
+        obfuscate_string (str);
+        vgl_user_cfg_set_password ((VglUserCfg *) obj, str);
+        g_free (str);
+}
+
+static void
+cfg_parse_server_name                   (xmlDoc        *doc,
+                                         const xmlNode *node,
+                                         gpointer       obj)
+{
+        char *str = xml_node_get_string (doc, node);
+        vgl_user_cfg_set_server_name ((VglUserCfg *) obj, str);
+        g_free (str);
+}
+
+#define CFG_FIELD(member) G_STRUCT_OFFSET (VglUserCfg, member)
+
+/* Elements of the config file, parsed in a single pass */
+static const XmlField cfg_fields[] = {
+        { "username",          XML_FIELD_STRING, CFG_FIELD (username) },
+        { "password",          XML_FIELD_CUSTOM, 0, cfg_parse_password },
+        { "http-proxy",        XML_FIELD_STRING, CFG_FIELD (http_proxy) },
+        { "download-dir",      XML_FIELD_STRING, CFG_FIELD (download_dir) },
+        { "imstatus-template", XML_FIELD_STRING,
+          CFG_FIELD (imstatus_template) },
+        { "audio-decoder",     XML_FIELD_STRING, CFG_FIELD (audio_decoder) },
+        { "audio-sink",        XML_FIELD_STRING, CFG_FIELD (audio_sink) },
+        { "server-name",       XML_FIELD_CUSTOM, 0, cfg_parse_server_name },
+        { "use-proxy",         XML_FIELD_BOOL, CFG_FIELD (use_proxy) },
+        { "use-system-proxy",  XML_FIELD_BOOL, CFG_FIELD (use_system_proxy) },
+        { "low-bitrate",       XML_FIELD_BOOL, CFG_FIELD (low_bitrate) },
+        { "discovery-mode",    XML_FIELD_BOOL, CFG_FIELD (discovery_mode) },
+        { "enable-scrobbling", XML_FIELD_BOOL,
+          CFG_FIELD (enable_scrobbling) },
+        { "im-pidgin",         XML_FIELD_BOOL, CFG_FIELD (im_pidgin) },
+        { "im-gajim",          XML_FIELD_BOOL, CFG_FIELD (im_gajim) },
+        { "im-gossip",         XML_FIELD_BOOL, CFG_FIELD (im_gossip) },
+        { "im-telepathy",      XML_FIELD_BOOL, CFG_FIELD (im_telepathy) },
+        { "disable-confirm-dialogs", XML_FIELD_BOOL,
+          CFG_FIELD (disable_confirm_dialogs) },
+        { "show-notifications", XML_FIELD_BOOL,
+          CFG_FIELD (show_notifications) },
+        { "close-to-systray",  XML_FIELD_BOOL, CFG_FIELD (close_to_systray) },
+        { "autodownload-free-tracks", XML_FIELD_BOOL,
+          CFG_FIELD (autodl_free_tracks) },
+        { "keep-pipeline-warm", XML_FIELD_BOOL,
+          CFG_FIELD (keep_pipeline_warm) },
+        { "audio-calibrated",  XML_FIELD_BOOL, CFG_FIELD (audio_calibrated) },
+        { "prefetch-window",   XML_FIELD_GLONG, CFG_FIELD (prefetch_window) },
+        { "prefetch-max-kb",   XML_FIELD_GLONG, CFG_FIELD (prefetch_max_kb) },
+        { "playlist-low-watermark", XML_FIELD_GLONG,
+          CFG_FIELD (playlist_low_watermark) },
+        { "buffer-preroll-kb", XML_FIELD_GLONG,
+          CFG_FIELD (buffer_preroll_kb) },
+        { "buffer-low-kb",     XML_FIELD_GLONG, CFG_FIELD (buffer_low_kb) },
+        { "buffer-high-kb",    XML_FIELD_GLONG, CFG_FIELD (buffer_high_kb) },
+        { "stream-cache-mb",   XML_FIELD_GLONG, CFG_FIELD (stream_cache_mb) },
+        { NULL }
+};
+
+#undef CFG_FIELD
+
+static XmlFieldTable cfg_table = XML_FIELD_TABLE_INIT (cfg_fields);
+
 VglUserCfg *
 vgl_user_cfg_read                       (void)
 {
@@ -326,54 +428,17 @@ vgl_user_cfg_read                       (void)
 
         /* Parse the configuration */
         if (node != NULL) {
-                char *str;
                 cfg = vgl_user_cfg_new();
-                /* This code is not very optimal, but it is simpler */
-                if (xml_get_string (doc, node, "username", &str)) {
-                        vgl_user_cfg_set_username (cfg, str);
-                        g_free (str);
-                }
-                if (xml_get_string (doc, node, "password", &str)) {
-                        obfuscate_string (str);
-                        vgl_user_cfg_set_password (cfg, str);
-                        g_free (str);
-                }
-                if (xml_get_string (doc, node, "http-proxy", &str)) {
-                        vgl_user_cfg_set_http_proxy (cfg, str);
-                        g_free (str);
-                }
-                if (xml_get_string (doc, node, "download-dir", &str)) {
-                        vgl_user_cfg_set_download_dir (cfg, str);
-                        g_free (str);
-                }
-                if (xml_get_string (doc, node, "imstatus-template", &str)) {
-                        vgl_user_cfg_set_imstatus_template (cfg, str);
-                        g_free (str);
-                }
-                if (xml_get_string (doc, node, "server-name", &str)) {
-                        vgl_user_cfg_set_server_name (cfg, str);
-                        g_free (str);
-                }
-                xml_get_bool (doc, node, "use-proxy", &(cfg->use_proxy));
-                xml_get_bool (doc, node, "use-system-proxy",
-                              &(cfg->use_system_proxy));
-                xml_get_bool (doc, node, "low-bitrate", &(cfg->low_bitrate));
-                xml_get_bool (doc, node, "discovery-mode",
-                              &(cfg->discovery_mode));
-                xml_get_bool (doc, node, "enable-scrobbling",
-                              &(cfg->enable_scrobbling));
-                xml_get_bool (doc, node, "im-pidgin", &(cfg->im_pidgin));
-                xml_get_bool (doc, node, "im-gajim", &(cfg->im_gajim));
-                xml_get_bool (doc, node, "im-gossip", &(cfg->im_gossip));
-                xml_get_bool (doc, node, "im-telepathy", &(cfg->im_telepathy));
-                xml_get_bool (doc, node, "disable-confirm-dialogs",
-                              &(cfg->disable_confirm_dialogs));
-                xml_get_bool (doc, node, "show-notifications",
-                              &(cfg->show_notifications));
-                xml_get_bool (doc, node, "close-to-systray",
-                              &(cfg->close_to_systray));
-                xml_get_bool (doc, node, "autodownload-free-tracks",
-                              &(cfg->autodl_free_tracks));
+                /* Keep the defaults of the fields not present */
+                xml_parse_fields (doc, node, &cfg_table, cfg);
+                cfg->prefetch_window = MAX (cfg->prefetch_window, 0);
+                cfg->prefetch_max_kb = MAX (cfg->prefetch_max_kb, 0);
+                cfg->playlist_low_watermark =
+                        MAX (cfg->playlist_low_watermark, 0);
+                cfg->buffer_preroll_kb = MAX (cfg->buffer_preroll_kb, 0);
+                cfg->buffer_low_kb = MAX (cfg->buffer_low_kb, 0);
+                cfg->buffer_high_kb = MAX (cfg->buffer_high_kb, 1);
+                cfg->stream_cache_mb = MAX (cfg->stream_cache_mb, 0);
         }
 
         if (doc != NULL) xmlFreeDoc (doc);
@@ -395,7 +460,7 @@ vgl_user_cfg_write                      (VglUserCfg *cfg)
         doc = xmlNewDoc ((xmlChar *) "1.0");
         root = xmlNewNode (NULL, (xmlChar *) "config");
         xmlSetProp (root, (xmlChar *) "version", (xmlChar *) "1");
-        xmlSetProp (root, (xmlChar *) "revision", (xmlChar *) "5");
+        xmlSetProp (root, (xmlChar *) "revision", (xmlChar *) "6");
         xmlDocSetRootElement (doc, root);
 
         xml_add_string (root, "username", cfg->username);
@@ -405,6 +470,8 @@ vgl_user_cfg_write                      (VglUserCfg *cfg)
         xml_add_string (root, "http-proxy", cfg->http_proxy);
         xml_add_string (root, "download-dir", cfg->download_dir);
         xml_add_string (root, "imstatus-template", cfg->imstatus_template);
+        xml_add_string (root, "audio-decoder", cfg->audio_decoder);
+        xml_add_string (root, "audio-sink", cfg->audio_sink);
         xml_add_bool (root, "use-proxy", cfg->use_proxy);
         xml_add_bool (root, "use-system-proxy", cfg->use_system_proxy);
         xml_add_bool (root, "low-bitrate", cfg->low_bitrate);
@@ -420,6 +487,16 @@ vgl_user_cfg_write                      (VglUserCfg *cfg)
         xml_add_bool (root, "close-to-systray", cfg->close_to_systray);
         xml_add_bool (root, "autodownload-free-tracks",
                       cfg->autodl_free_tracks);
+        xml_add_bool (root, "keep-pipeline-warm", cfg->keep_pipeline_warm);
+        xml_add_bool (root, "audio-calibrated", cfg->audio_calibrated);
+        xml_add_glong (root, "prefetch-window", cfg->prefetch_window);
+        xml_add_glong (root, "prefetch-max-kb", cfg->prefetch_max_kb);
+        xml_add_glong (root, "playlist-low-watermark",
+                       cfg->playlist_low_watermark);
+        xml_add_glong (root, "buffer-preroll-kb", cfg->buffer_preroll_kb);
+        xml_add_glong (root, "buffer-low-kb", cfg->buffer_low_kb);
+        xml_add_glong (root, "buffer-high-kb", cfg->buffer_high_kb);
+        xml_add_glong (root, "stream-cache-mb", cfg->stream_cache_mb);
 
         if (xmlSaveFormatFileEnc (cfgfile, doc, "UTF-8", 1) == -1) {
                 g_critical ("Unable to open %s", cfgfile);
@@ -21,6 +21,8 @@ typedef struct {
         char *http_proxy; /* Never NULL, even if not defined */
         char *download_dir; /* Never NULL */
         char *imstatus_template; /* Never NULL */
+        char *audio_decoder; /* Never NULL, "" for the default one */
+        char *audio_sink; /* Never NULL, "" for the default one */
         VglServer *server;
         gboolean use_proxy;
         gboolean use_system_proxy;
@@ -35,6 +37,15 @@ typedef struct {
         gboolean show_notifications;
         gboolean close_to_systray;
         gboolean autodl_free_tracks;
+        glong prefetch_window; /* Seconds, 0 to disable prefetching */
+        glong prefetch_max_kb;
+        glong playlist_low_watermark; /* Tracks, 0 to disable refills */
+        glong buffer_preroll_kb;
+        glong buffer_low_kb;
+        glong buffer_high_kb;
+        gboolean keep_pipeline_warm;
+        glong stream_cache_mb; /* 0 to disable the stream cache */
+        gboolean audio_calibrated; /* FALSE to select them again */
 } VglUserCfg;
 
 VglUserCfg *
@@ -67,6 +78,14 @@ void
 vgl_user_cfg_set_imstatus_template      (VglUserCfg *cfg,
                                          const char *str);
 
+void
+vgl_user_cfg_set_audio_decoder          (VglUserCfg *cfg,
+                                         const char *decoder);
+
+void
+vgl_user_cfg_set_audio_sink             (VglUserCfg *cfg,
+                                         const char *sink);
+
 VglUserCfg *
 vgl_user_cfg_read                       (void);
 
@@ -10,6 +10,7 @@
 
 #include "util.h"
 #include "http.h"
+#include "compat.h"
 
 #ifndef HAVE_GCHECKSUM
 #   include "md5/md5.h"
@@ -163,6 +164,85 @@ string_replace_char                     (char *str,
         }
 }
 
+/* Characters that don't need to be percent-encoded in URLs (the
+ * "unreserved" characters from RFC 3986) */
+static const guchar url_unreserved_chars[256] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0,
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0,
+        0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 1,
+        0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 1, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+static const char url_hex_digits[] = "0123456789ABCDEF";
+
+static inline void
+url_escape_char                         (GString *dst,
+                                         guchar   c)
+{
+        if (url_unreserved_chars[c]) {
+                g_string_append_c (dst, c);
+        } else {
+                g_string_append_c (dst, '%');
+                g_string_append_c (dst, url_hex_digits[c >> 4]);
+                g_string_append_c (dst, url_hex_digits[c & 0xF]);
+        }
+}
+
+/**
+ * Percent-encode a string and append it to a GString. All characters
+ * except the unreserved ones (letters, digits, '-', '.', '_' and
+ * '~') are encoded.
+ * @param dst The GString where the result will be appended
+ * @param str The string to encode
+ */
+void
+url_escape_gstr                         (GString    *dst,
+                                         const char *str)
+{
+        const guchar *i;
+        g_return_if_fail (dst != NULL && str != NULL);
+        for (i = (const guchar *) str; *i != '\0'; i++) {
+                url_escape_char (dst, *i);
+        }
+}
+
+/**
+ * Decode a percent-encoded string and append it to a GString.
+ * Invalid escape sequences are copied unmodified.
+ * @param dst The GString where the result will be appended
+ * @param str The string to decode
+ */
+void
+url_unescape_gstr                       (GString    *dst,
+                                         const char *str)
+{
+        const char *i;
+        g_return_if_fail (dst != NULL && str != NULL);
+        for (i = str; *i != '\0'; i++) {
+                int hi, lo;
+                if (*i == '%' &&
+                    (hi = g_ascii_xdigit_value (i[1])) >= 0 &&
+                    (lo = g_ascii_xdigit_value (i[2])) >= 0) {
+                        g_string_append_c (dst, (hi << 4) | lo);
+                        i += 2;
+                } else {
+                        g_string_append_c (dst, *i);
+                }
+        }
+}
+
 /**
  * Creates a GdkPixbuf from a image in any supported format
  * @param data The original image in memory, or NULL
@@ -274,14 +354,12 @@ obfuscate_string                        (char *str)
 char *
 lastfm_url_decode                       (const char *str)
 {
-        char *tmp;
         GString *gstr;
 
         g_return_val_if_fail (str != NULL, NULL);
 
-        tmp = escape_url (str, FALSE);
-        gstr = g_string_new (tmp);
-        g_free (tmp);
+        gstr = g_string_sized_new (strlen (str));
+        url_unescape_gstr (gstr, str);
 
         string_replace_gstr (gstr, "&amp;", "&");
         string_replace_gstr (gstr, "%26", "&");
@@ -300,19 +378,26 @@ lastfm_url_decode                       (const char *str)
 char *
 lastfm_url_encode                       (const char *str)
 {
-        char *retvalue;
+        const char *i;
         GString *gstr;
 
         g_return_val_if_fail (str != NULL, NULL);
 
-        gstr = g_string_new (str);
+        gstr = g_string_sized_new (strlen (str) * 3);
 
-        string_replace_char (gstr->str, ' ', '+');
-        string_replace_gstr (gstr, "&", "%26");
-        retvalue = escape_url (gstr->str, TRUE);
+        /* Spaces become '+' and ampersands become "%26", and then
+         * the whole string is percent-encoded. Do it in one pass */
+        for (i = str; *i != '\0'; i++) {
+                if (*i == ' ') {
+                        g_string_append (gstr, "%2B");
+                } else if (*i == '&') {
+                        g_string_append (gstr, "%2526");
+                } else {
+                        url_escape_char (gstr, *i);
+                }
+        }
 
-        g_string_free (gstr, TRUE);
-        return retvalue;
+        return g_string_free (gstr, FALSE);
 }
 
 /**
@@ -419,6 +504,75 @@ xml_find_node                           (const xmlNode *node,
         return NULL;
 }
 
+/**
+ * Get the text of an XML element if it consists on a single text
+ * node, which is the common case. That text can be used directly,
+ * with no need to expand entities or concatenate nodes.
+ * @param node The XML element
+ * @return The text, or NULL if the element has other contents
+ */
+static const char *
+xml_node_simple_text                    (const xmlNode *node)
+{
+        const xmlNode *child = node->xmlChildrenNode;
+        if (child != NULL && child->next == NULL &&
+            (child->type == XML_TEXT_NODE ||
+             child->type == XML_CDATA_SECTION_NODE)) {
+                return (const char *) child->content;
+        }
+        return NULL;
+}
+
+/**
+ * Copy a string without its leading and trailing whitespace. Same as
+ * g_strstrip (g_strdup (str)) but copying only the needed bytes.
+ * @param str The string
+ * @return A newly allocated string
+ */
+static char *
+strdup_stripped                         (const char *str)
+{
+        const char *end;
+        while (g_ascii_isspace (*str)) str++;
+        end = str + strlen (str);
+        while (end > str && g_ascii_isspace (end[-1])) end--;
+        return g_strndup (str, end - str);
+}
+
+/**
+ * Get the contents of an XML element as a string, without leading
+ * or trailing whitespace.
+ * @param doc The xmlDoc
+ * @param node The XML element
+ * @return A newly allocated string (empty if the element has no
+ * contents)
+ */
+char *
+xml_node_get_string                     (xmlDoc        *doc,
+                                         const xmlNode *node)
+{
+        const char *text;
+        xmlChar *val;
+        char *retval;
+
+        g_return_val_if_fail (doc && node, NULL);
+
+        text = xml_node_simple_text (node);
+        if (text != NULL) {
+                return strdup_stripped (text);
+        }
+
+        val = xmlNodeListGetString (doc, node->xmlChildrenNode, 1);
+        if (val != NULL) {
+                retval = strdup_stripped ((char *) val);
+                xmlFree (val);
+        } else {
+                retval = g_strdup ("");
+        }
+
+        return retval;
+}
+
 /**
  * Find an XML node in a list and get its value as a string.
  * @param doc The xmlDoc
@@ -437,18 +591,7 @@ xml_get_string                          (xmlDoc         *doc,
         g_return_val_if_fail (doc && name && value, NULL);
 
         node = xml_find_node (node, name);
-        if (node) {
-                xmlChar *val;
-                val = xmlNodeListGetString (doc, node->xmlChildrenNode, 1);
-                if (val != NULL) {
-                        *value = g_strstrip (g_strdup ((char *) val));
-                        xmlFree (val);
-                } else {
-                        *value = g_strdup ("");
-                }
-        } else {
-                *value = NULL;
-        }
+        *value = node ? xml_node_get_string (doc, node) : NULL;
 
         return node;
 }
@@ -505,6 +648,213 @@ xml_get_glong                           (xmlDoc        *doc,
         return position;
 }
 
+/* Protects the indexes of the XmlFieldTables */
+static GStaticMutex xml_field_mutex = G_STATIC_MUTEX_INIT;
+
+/**
+ * Get the hash table that maps the names of the fields of a table
+ * to their positions (plus one), building it on first use.
+ * @param table The table
+ * @return The index
+ */
+static GHashTable *
+xml_field_table_get_index               (XmlFieldTable *table)
+{
+        g_static_mutex_lock (&xml_field_mutex);
+        if (table->index == NULL) {
+                GHashTable *index;
+                guint i;
+                index = g_hash_table_new (g_str_hash, g_str_equal);
+                for (i = 0; table->fields[i].name != NULL; i++) {
+                        g_hash_table_insert (index,
+                                             (gpointer) table->fields[i].name,
+                                             GUINT_TO_POINTER (i + 1));
+                }
+                table->n_fields = i;
+                table->index = index;
+        }
+        g_static_mutex_unlock (&xml_field_mutex);
+        return table->index;
+}
+
+/**
+ * Get the contents of an XML element as a glong, without allocating
+ * memory in the common case.
+ * @param doc The xmlDoc
+ * @param node The XML element
+ * @return The value
+ */
+static glong
+xml_node_get_glong                      (xmlDoc        *doc,
+                                         const xmlNode *node)
+{
+        const char *text = xml_node_simple_text (node);
+        glong val;
+        if (text == NULL) {
+                char *str = xml_node_get_string (doc, node);
+                val = atol (str);
+                g_free (str);
+        } else {
+                val = atol (text);
+        }
+        return val;
+}
+
+/**
+ * Get the contents of an XML element as a boolean ("1" is TRUE,
+ * anything else is FALSE), without allocating memory in the common
+ * case.
+ * @param doc The xmlDoc
+ * @param node The XML element
+ * @return The value
+ */
+static gboolean
+xml_node_get_bool                       (xmlDoc        *doc,
+                                         const xmlNode *node)
+{
+        const char *text = xml_node_simple_text (node);
+        gboolean val;
+        if (text == NULL) {
+                char *str = xml_node_get_string (doc, node);
+                val = g_str_equal (str, "1");
+                g_free (str);
+        } else {
+                while (g_ascii_isspace (*text)) text++;
+                val = (*text++ == '1');
+                while (val && *text != '\0') {
+                        val = g_ascii_isspace (*text++);
+                }
+        }
+        return val;
+}
+
+/**
+ * Parse a list of XML elements in a single pass, storing the values
+ * of the ones in the table in the members of a struct. If an element
+ * appears more than once only the first one is used, unless the field
+ * is marked as repeated. Members of fields not present in the XML are
+ * left untouched, so defaults must be set before calling this.
+ * @param doc The xmlDoc
+ * @param node The first node on the list
+ * @param table The fields to look for
+ * @param obj The struct where the values are stored
+ */
+void
+xml_parse_fields                        (xmlDoc        *doc,
+                                         const xmlNode *node,
+                                         XmlFieldTable *table,
+                                         gpointer       obj)
+{
+        GHashTable *index;
+        const xmlNode *iter;
+        guint64 seen = 0;
+
+        g_return_if_fail (doc && table && obj);
+
+        index = xml_field_table_get_index (table);
+        g_return_if_fail (table->n_fields <= 64);
+
+        for (iter = node; iter != NULL; iter = iter->next) {
+                const XmlField *field;
+                gpointer member;
+                guint pos;
+
+                if (iter->type != XML_ELEMENT_NODE) continue;
+
+                pos = GPOINTER_TO_UINT (g_hash_table_lookup (index,
+                                                             iter->name));
+                if (pos-- == 0) continue;
+
+                field = &(table->fields[pos]);
+                if (seen & (G_GUINT64_CONSTANT (1) << pos)) continue;
+                if (!field->repeat) {
+                        seen |= G_GUINT64_CONSTANT (1) << pos;
+                }
+
+                member = G_STRUCT_MEMBER_P (obj, field->offset);
+                switch (field->type) {
+                case XML_FIELD_STRING:
+                        g_free (*(char **) member);
+                        *(char **) member = xml_node_get_string (doc, iter);
+                        break;
+                case XML_FIELD_GLONG:
+                        *(glong *) member = xml_node_get_glong (doc, iter);
+                        break;
+                case XML_FIELD_GUINT:
+                        *(guint *) member = xml_node_get_glong (doc, iter);
+                        break;
+                case XML_FIELD_BOOL:
+                        *(gboolean *) member = xml_node_get_bool (doc, iter);
+                        break;
+                case XML_FIELD_CUSTOM:
+                        field->handler (doc, iter, obj);
+                        break;
+                default:
+                        g_return_if_reached ();
+                }
+        }
+}
+
+/* Covers being downloaded, see lastfm_get_track_cover_image() */
+static GStaticMutex cover_mutex = G_STATIC_MUTEX_INIT;
+static GList *cover_dloads_in_progress = NULL;
+static GCond *cover_cond = NULL;
+/* CoverAsyncData of the async calls waiting for one of those */
+static GList *cover_async_waiters = NULL;
+
+typedef struct {
+        LastfmTrack *track;
+        lastfm_cover_cb cb;
+        gpointer userdata;
+} CoverAsyncData;
+
+static void
+cover_async_data_finish                 (CoverAsyncData *d)
+{
+        if (d->cb != NULL) {
+                (*(d->cb)) (d->track, d->userdata);
+        }
+        vgl_object_unref (d->track);
+        g_slice_free (CoverAsyncData, d);
+}
+
+/**
+ * Remove from the list of waiters the async calls waiting for the
+ * cover of a track. cover_mutex must be locked.
+ * @param track The track
+ * @return The CoverAsyncData of those calls
+ */
+static GList *
+cover_async_take_waiters                (LastfmTrack *track)
+{
+        GList *waiters = NULL;
+        GList *iter = cover_async_waiters;
+        while (iter != NULL) {
+                GList *next = iter->next;
+                CoverAsyncData *d = iter->data;
+                if (d->track == track) {
+                        cover_async_waiters =
+                                g_list_remove_link (cover_async_waiters, iter);
+                        waiters = g_list_concat (iter, waiters);
+                }
+                iter = next;
+        }
+        return waiters;
+}
+
+/* Call the callbacks of a list of CoverAsyncData and free them */
+static gboolean
+cover_async_waiters_idle                (gpointer userdata)
+{
+        GList *waiters = userdata;
+        GList *iter;
+        for (iter = waiters; iter != NULL; iter = iter->next) {
+                cover_async_data_finish (iter->data);
+        }
+        g_list_free (waiters);
+        return FALSE;
+}
+
 /**
  * Download the album cover of a track, and store it in the track
  * object. This function can take a long time so better use threads or
@@ -517,10 +867,7 @@ void
 lastfm_get_track_cover_image            (LastfmTrack *track)
 {
         g_return_if_fail(track != NULL);
-        static GStaticMutex static_mutex = G_STATIC_MUTEX_INIT;
-        static GList *dloads_in_progress = NULL;
-        static GCond *cond = NULL;
-        GMutex *mutex = g_static_mutex_get_mutex (&static_mutex);
+        GMutex *mutex = g_static_mutex_get_mutex (&cover_mutex);
 
         /* If this track has no cover image then we have nothing to do */
         if (track->image_url == NULL) return;
@@ -528,20 +875,21 @@ lastfm_get_track_cover_image            (LastfmTrack *track)
         /* Critical section: decide if the cover needs to be downloaded */
         g_mutex_lock(mutex);
 
-        if (G_UNLIKELY (cond == NULL)) {
-                cond = g_cond_new();
+        if (G_UNLIKELY (cover_cond == NULL)) {
+                cover_cond = g_cond_new();
         }
 
         if (!track->image_data_available) {
-                if (g_list_find(dloads_in_progress, track) != NULL) {
+                if (g_list_find(cover_dloads_in_progress, track) != NULL) {
                         /* If the track is being downloaded, then wait */
                         while (!track->image_data_available) {
-                                g_cond_wait(cond, mutex);
+                                g_cond_wait(cover_cond, mutex);
                         }
                 } else {
                         /* Otherwise, mark the track as being downloaded */
-                        dloads_in_progress =
-                                g_list_prepend(dloads_in_progress, track);
+                        cover_dloads_in_progress =
+                                g_list_prepend(cover_dloads_in_progress,
+                                               track);
                 }
         }
 
@@ -550,15 +898,105 @@ lastfm_get_track_cover_image            (LastfmTrack *track)
         if (!track->image_data_available) {
                 char *imgdata;
                 size_t imgsize;
+                GList *waiters;
 
                 /* Download the cover and save it on the track */
+                http_set_request_tag("cover");
                 http_get_buffer(track->image_url, &imgdata, &imgsize);
                 lastfm_track_set_cover_image(track, imgdata, imgsize);
 
                 /* Remove from the download list and tell everyone */
                 g_mutex_lock(mutex);
-                dloads_in_progress = g_list_remove(dloads_in_progress, track);
-                g_cond_broadcast(cond);
+                cover_dloads_in_progress =
+                        g_list_remove(cover_dloads_in_progress, track);
+                g_cond_broadcast(cover_cond);
+                waiters = cover_async_take_waiters (track);
                 g_mutex_unlock(mutex);
+
+                /* The async callbacks run in the main loop */
+                if (waiters != NULL) {
+                        gdk_threads_add_idle (cover_async_waiters_idle,
+                                              waiters);
+                }
+        }
+}
+
+static void
+cover_async_downloaded_cb               (char     *buffer,
+                                         size_t    bufsize,
+                                         gpointer  userdata)
+{
+        CoverAsyncData *d = userdata;
+        GMutex *mutex = g_static_mutex_get_mutex (&cover_mutex);
+        GList *waiters;
+
+        lastfm_track_set_cover_image (d->track, buffer, bufsize);
+
+        g_mutex_lock(mutex);
+        cover_dloads_in_progress =
+                g_list_remove(cover_dloads_in_progress, d->track);
+        g_cond_broadcast(cover_cond);
+        waiters = cover_async_take_waiters (d->track);
+        g_mutex_unlock(mutex);
+
+        cover_async_data_finish (d);
+        cover_async_waiters_idle (waiters);
+}
+
+/**
+ * Asynchronous version of lastfm_get_track_cover_image(). Must be
+ * called from the main thread. The callback is always called, also
+ * if the cover could not be downloaded (then track->image_data will
+ * be NULL). It will be called immediately if the cover is already
+ * available.
+ * @param track The track
+ * @param cb Function to call when the cover is ready
+ * @param userdata Data passed to @cb
+ */
+void
+lastfm_get_track_cover_image_async      (LastfmTrack     *track,
+                                         lastfm_cover_cb  cb,
+                                         gpointer         userdata)
+{
+        g_return_if_fail(track != NULL);
+        GMutex *mutex = g_static_mutex_get_mutex (&cover_mutex);
+        gboolean in_progress = FALSE;
+        CoverAsyncData *d;
+
+        d = g_slice_new (CoverAsyncData);
+        d->track = vgl_object_ref (track);
+        d->cb = cb;
+        d->userdata = userdata;
+
+        g_mutex_lock(mutex);
+
+        if (G_UNLIKELY (cover_cond == NULL)) {
+                cover_cond = g_cond_new();
+        }
+
+        if (track->image_url != NULL && !track->image_data_available) {
+                if (g_list_find(cover_dloads_in_progress, track) != NULL) {
+                        /* Someone else is downloading this cover, the
+                         * callback will be called when it finishes */
+                        cover_async_waiters =
+                                g_list_prepend (cover_async_waiters, d);
+                        in_progress = TRUE;
+                } else {
+                        cover_dloads_in_progress =
+                                g_list_prepend(cover_dloads_in_progress,
+                                               track);
+                }
+        }
+
+        g_mutex_unlock(mutex);
+
+        if (in_progress) {
+                /* Nothing to do, see cover_async_take_waiters() */
+        } else if (track->image_url == NULL || track->image_data_available) {
+                cover_async_data_finish (d);
+        } else {
+                http_set_request_tag ("cover");
+                http_get_buffer_async (track->image_url,
+                                       cover_async_downloaded_cb, d);
         }
 }
@@ -20,6 +20,42 @@
 #    include <gio/gio.h>
 #endif
 
+typedef void
+(*lastfm_cover_cb)                      (LastfmTrack *track,
+                                         gpointer     userdata);
+
+typedef enum {
+        XML_FIELD_STRING,       /* char *, NULL if not present */
+        XML_FIELD_GLONG,
+        XML_FIELD_GUINT,
+        XML_FIELD_BOOL,
+        XML_FIELD_CUSTOM        /* Handled by a callback */
+} XmlFieldType;
+
+typedef void
+(*XmlFieldHandler)                      (xmlDoc        *doc,
+                                         const xmlNode *node,
+                                         gpointer       obj);
+
+/* A child element to be stored in a member of a struct */
+typedef struct {
+        const char *name;
+        XmlFieldType type;
+        gsize offset;           /* G_STRUCT_OFFSET() of the member */
+        XmlFieldHandler handler;
+        gboolean repeat;        /* Handle all occurrences, not only
+                                 * the first one (XML_FIELD_CUSTOM) */
+} XmlField;
+
+/* A NULL-terminated list of fields, indexed by name on first use */
+typedef struct {
+        const XmlField *fields;
+        GHashTable *index;
+        guint n_fields;
+} XmlFieldTable;
+
+#define XML_FIELD_TABLE_INIT(fields) { fields, NULL, 0 }
+
 char *
 get_md5_hash                            (const char *str);
 
@@ -39,6 +75,14 @@ string_replace_gstr                     (GString    *str,
                                          const char *old,
                                          const char *new);
 
+void
+url_escape_gstr                         (GString    *dst,
+                                         const char *str);
+
+void
+url_unescape_gstr                       (GString    *dst,
+                                         const char *str);
+
 char *
 string_replace                          (const char *str,
                                          const char *old,
@@ -101,6 +145,16 @@ xml_get_glong                           (xmlDoc        *doc,
                                          const char    *name,
                                          glong         *value);
 
+char *
+xml_node_get_string                     (xmlDoc        *doc,
+                                         const xmlNode *node);
+
+void
+xml_parse_fields                        (xmlDoc        *doc,
+                                         const xmlNode *node,
+                                         XmlFieldTable *table,
+                                         gpointer       obj);
+
 #ifdef HAVE_GIO
 void
 launch_url                              (const char        *url,
@@ -110,4 +164,9 @@ launch_url                              (const char        *url,
 void
 lastfm_get_track_cover_image            (LastfmTrack *track);
 
+void
+lastfm_get_track_cover_image_async      (LastfmTrack     *track,
+                                         lastfm_cover_cb  cb,
+                                         gpointer         userdata);
+
 #endif
@@ -413,6 +413,17 @@ vgl_main_window_set_state               (VglMainWindow      *w,
         gtk_progress_bar_set_fraction(priv->progressbar, 0);
 }
 
+/* The progress bar is only updated while the window is visible */
+static void
+update_progress_interest                (VglMainWindow *win)
+{
+        if (win->priv->is_hidden) {
+                controller_remove_progress_interest (win);
+        } else {
+                controller_add_progress_interest (win, 1);
+        }
+}
+
 static gboolean
 window_state_cb                         (GtkWidget           *widget,
                                          GdkEventWindowState *event,
@@ -428,6 +439,7 @@ window_state_cb                         (GtkWidget           *widget,
         priv->is_fullscreen = (st & GDK_WINDOW_STATE_FULLSCREEN);
         priv->is_hidden =
                 st & (GDK_WINDOW_STATE_ICONIFIED|GDK_WINDOW_STATE_WITHDRAWN);
+        update_progress_interest (win);
         if (!priv->is_hidden) {
                 controller_show_cover();
         }
@@ -443,6 +455,7 @@ is_topmost_cb                           (GObject       *obj,
         g_return_if_fail(VGL_IS_MAIN_WINDOW(win));
         HildonWindow *hildonwin = HILDON_WINDOW(win);
         win->priv->is_hidden = !hildon_window_get_is_topmost(hildonwin);
+        update_progress_interest (win);
         if (!(win->priv->is_hidden)) {
                 controller_show_cover();
         }
@@ -793,6 +806,7 @@ vgl_main_window_finalize                (GObject *object)
 {
         VglMainWindowPrivate *priv = VGL_MAIN_WINDOW (object)->priv;
         g_debug("Destroying main window ...");
+        controller_remove_progress_interest (object);
         g_string_free(priv->progressbar_text, TRUE);
         G_OBJECT_CLASS(vgl_main_window_parent_class)->finalize(object);
 }
@@ -815,5 +829,6 @@ vgl_main_window_new                     (VglController *controller)
         g_signal_connect (controller, "playback-progress",
                           G_CALLBACK (vgl_main_window_controller_progress_cb),
                           win);
+        update_progress_interest (VGL_MAIN_WINDOW (win));
         return win;
 }
@@ -116,6 +116,27 @@ new_request                             (const char *user,
         return retval;
 }
 
+/**
+ * Check the response to an XMLRPC request
+ * @param retbuf The body of the response, or NULL on connection error
+ * @param name Name of the method (for debugging purposes only)
+ * @return Whether the operation was successful or not
+ */
+static gboolean
+xmlrpc_check_response                   (const char *retbuf,
+                                         const char *name)
+{
+        if (retbuf != NULL && g_strrstr(retbuf, "OK")) {
+                g_debug("XMLRPC call (%s) OK", name);
+                return TRUE;
+        } else if (retbuf != NULL) {
+                g_debug("Error in XMLRPC call (%s): %s", name, retbuf);
+        } else {
+                g_debug("Error in XMLRPC call (%s), connection error?", name);
+        }
+        return FALSE;
+}
+
 /**
  * Send the actual request
  * @param request String containing the request in XML
@@ -127,21 +148,14 @@ xmlrpc_send_request                     (const char *request,
                                          const char *name)
 {
         g_return_val_if_fail(request != NULL, FALSE);
-        gboolean retval = FALSE;
+        gboolean retval;
         GSList *headers = NULL;
         char *retbuf = NULL;
         headers = g_slist_append(headers, "Content-Type: text/xml");
         http_post_buffer (xmlrpc_url, request, &retbuf, NULL, headers);
 
         /* Check its return value */
-        if (retbuf != NULL && g_strrstr(retbuf, "OK")) {
-                g_debug("XMLRPC call (%s) OK", name);
-                retval = TRUE;
-        } else if (retbuf != NULL) {
-                g_debug("Error in XMLRPC call (%s): %s", name, retbuf);
-        } else {
-                g_debug("Error in XMLRPC call (%s), connection error?", name);
-        }
+        retval = xmlrpc_check_response (retbuf, name);
 
         /* Cleanup */
         g_slist_free(headers);
@@ -149,58 +163,157 @@ xmlrpc_send_request                     (const char *request,
         return retval;
 }
 
+typedef struct {
+        char *name;
+        xmlrpc_cb cb;
+        gpointer userdata;
+} XmlrpcAsyncData;
+
+static void
+xmlrpc_send_request_async_cb            (char     *buffer,
+                                         size_t    bufsize,
+                                         gpointer  userdata)
+{
+        XmlrpcAsyncData *d = userdata;
+        gboolean retval = xmlrpc_check_response (buffer, d->name);
+        if (d->cb != NULL) {
+                (*(d->cb)) (retval, d->userdata);
+        }
+        g_free(buffer);
+        g_free(d->name);
+        g_slice_free(XmlrpcAsyncData, d);
+}
+
 /**
- * Tags an artist, track or album, Previous tags will be overwritten.
+ * Send the actual request without blocking. Must be called from the
+ * main thread
+ * @param request String containing the request in XML
+ * @param name Name of the method (for debugging purposes only)
+ * @param cb Function to call when the request is finished
+ * @param userdata Data passed to @cb
+ */
+static void
+xmlrpc_send_request_async               (const char *request,
+                                         const char *name,
+                                         xmlrpc_cb   cb,
+                                         gpointer    userdata)
+{
+        g_return_if_fail(request != NULL);
+        XmlrpcAsyncData *d = g_slice_new(XmlrpcAsyncData);
+        GSList *headers = NULL;
+        d->name = g_strdup(name);
+        d->cb = cb;
+        d->userdata = userdata;
+        headers = g_slist_append(headers, "Content-Type: text/xml");
+        http_post_buffer_async (xmlrpc_url, request, headers,
+                                xmlrpc_send_request_async_cb, d);
+        g_slist_free(headers);
+}
+
+/**
+ * Create a request to tag an artist, track or album
  *
  * @param user The user's Last.fm ID
  * @param password The user's password
  * @param track The track to tag
  * @param type The type of the tag (artist/track/album)
  * @param tags A list of tags to set
- * @return Whether the operation was successful or not
+ * @param method Where the name of the method will be stored
+ * @return A new string containing the full XML request
  */
-gboolean
-tag_track                               (const char           *user,
+static char *
+tag_track_request                       (const char           *user,
                                          const char           *password,
                                          const LastfmTrack    *track,
                                          LastfmTrackComponent  type,
-                                         GSList               *tags)
+                                         GSList               *tags,
+                                         const char          **method)
 {
-        g_return_val_if_fail(user && password && track, FALSE);
-        gboolean retval;
         char *request;
         xmlNode *param1, *param2, *param3, *param4;
-        const char *method;
         param3 = array_param(tags);
         param4 = string_param("set");                  /* or use "append" */
         if (type == LASTFM_TRACK_COMPONENT_ARTIST) {
-                method = "tagArtist";
+                *method = "tagArtist";
                 param1 = string_param(track->artist);
                 param2 = NULL;
         } else if (type == LASTFM_TRACK_COMPONENT_TRACK) {
-                method = "tagTrack";
+                *method = "tagTrack";
                 param1 = string_param(track->artist);
                 param2 = string_param(track->title);
         } else {
-                method = "tagAlbum";
+                *method = "tagAlbum";
                 param1 = string_param (track->album_artist);
                 param2 = string_param (track->album);
         }
         if (param2 != NULL) {
-                request = new_request(user, password, method, param1, param2,
+                request = new_request(user, password, *method, param1, param2,
                                       param3, param4, NULL);
         } else {
-                request = new_request(user, password, method, param1,
+                request = new_request(user, password, *method, param1,
                                       param3, param4, NULL);
         }
+        return request;
+}
 
+/**
+ * Tags an artist, track or album, Previous tags will be overwritten.
+ *
+ * @param user The user's Last.fm ID
+ * @param password The user's password
+ * @param track The track to tag
+ * @param type The type of the tag (artist/track/album)
+ * @param tags A list of tags to set
+ * @return Whether the operation was successful or not
+ */
+gboolean
+tag_track                               (const char           *user,
+                                         const char           *password,
+                                         const LastfmTrack    *track,
+                                         LastfmTrackComponent  type,
+                                         GSList               *tags)
+{
+        g_return_val_if_fail(user && password && track, FALSE);
+        gboolean retval;
+        const char *method;
+        char *request = tag_track_request(user, password, track,
+                                          type, tags, &method);
         retval = xmlrpc_send_request(request, method);
         g_free(request);
         return retval;
 }
 
 /**
- * Recommend a track to a user
+ * Asynchronous version of tag_track(). Must be called from the main
+ * thread.
+ *
+ * @param user The user's Last.fm ID
+ * @param password The user's password
+ * @param track The track to tag
+ * @param type The type of the tag (artist/track/album)
+ * @param tags A list of tags to set
+ * @param cb Function to call when the operation is finished
+ * @param userdata Data passed to @cb
+ */
+void
+tag_track_async                         (const char           *user,
+                                         const char           *password,
+                                         const LastfmTrack    *track,
+                                         LastfmTrackComponent  type,
+                                         GSList               *tags,
+                                         xmlrpc_cb             cb,
+                                         gpointer              userdata)
+{
+        g_return_if_fail(user && password && track);
+        const char *method;
+        char *request = tag_track_request(user, password, track,
+                                          type, tags, &method);
+        xmlrpc_send_request_async(request, method, cb, userdata);
+        g_free(request);
+}
+
+/**
+ * Create a request to recommend a track to a user
  *
  * @param user The user's Last.fm ID
  * @param password The user's password
@@ -208,19 +321,16 @@ tag_track                               (const char           *user,
  * @param text The text of the recommendation
  * @param type Whether to recommend an artist, track or album
  * @param rcpt The user who will receive the recommendation
- * @return Whether the operation was successful or not
+ * @return A new string containing the full XML request
  */
-gboolean
-recommend_track                         (const char           *user,
+static char *
+recommend_track_request                 (const char           *user,
                                          const char           *password,
                                          const LastfmTrack    *track,
                                          const char           *text,
                                          LastfmTrackComponent  type,
                                          const char           *rcpt)
 {
-        g_return_val_if_fail(user && password && track && text && rcpt, FALSE);
-        gboolean retval;
-        char *request;
         const char *method = "recommendItem";
         xmlNode *artist, *title, *recomm_type, *recomm_to;
         xmlNode *recomm_body, *language;
@@ -240,14 +350,89 @@ recommend_track                         (const char           *user,
         recomm_to = string_param(rcpt);
         recomm_body = string_param(text);
         language = string_param("en");
-        request = new_request(user, password, method, artist,
-                              title, recomm_type, recomm_to,
-                              recomm_body, language, NULL);
-        retval = xmlrpc_send_request(request, method);
+        return new_request(user, password, method, artist,
+                           title, recomm_type, recomm_to,
+                           recomm_body, language, NULL);
+}
+
+/**
+ * Recommend a track to a user
+ *
+ * @param user The user's Last.fm ID
+ * @param password The user's password
+ * @param track The track to recommend
+ * @param text The text of the recommendation
+ * @param type Whether to recommend an artist, track or album
+ * @param rcpt The user who will receive the recommendation
+ * @return Whether the operation was successful or not
+ */
+gboolean
+recommend_track                         (const char           *user,
+                                         const char           *password,
+                                         const LastfmTrack    *track,
+                                         const char           *text,
+                                         LastfmTrackComponent  type,
+                                         const char           *rcpt)
+{
+        g_return_val_if_fail(user && password && track && text && rcpt, FALSE);
+        gboolean retval;
+        char *request = recommend_track_request(user, password, track,
+                                                text, type, rcpt);
+        retval = xmlrpc_send_request(request, "recommendItem");
         g_free(request);
         return retval;
 }
 
+/**
+ * Asynchronous version of recommend_track(). Must be called from the
+ * main thread.
+ *
+ * @param user The user's Last.fm ID
+ * @param password The user's password
+ * @param track The track to recommend
+ * @param text The text of the recommendation
+ * @param type Whether to recommend an artist, track or album
+ * @param rcpt The user who will receive the recommendation
+ * @param cb Function to call when the operation is finished
+ * @param userdata Data passed to @cb
+ */
+void
+recommend_track_async                   (const char           *user,
+                                         const char           *password,
+                                         const LastfmTrack    *track,
+                                         const char           *text,
+                                         LastfmTrackComponent  type,
+                                         const char           *rcpt,
+                                         xmlrpc_cb             cb,
+                                         gpointer              userdata)
+{
+        g_return_if_fail(user && password && track && text && rcpt);
+        char *request = recommend_track_request(user, password, track,
+                                                text, type, rcpt);
+        xmlrpc_send_request_async(request, "recommendItem", cb, userdata);
+        g_free(request);
+}
+
+/**
+ * Create a request to add a track to the user's playlist
+ *
+ * @param user The user's Last.fm ID
+ * @param password The user's password
+ * @param track The track to add to the playlist
+ * @return A new string containing the full XML request
+ */
+static char *
+add_to_playlist_request                 (const char        *user,
+                                         const char        *password,
+                                         const LastfmTrack *track)
+{
+        const char *method = "addTrackToUserPlaylist";
+        xmlNode *artist, *title;
+        artist = string_param(track->artist);
+        title = string_param(track->title);
+        return new_request(user, password, method, artist, title, NULL);
+}
+
 /**
  * Add a track to the user's playlist
  *
@@ -263,13 +448,32 @@ add_to_playlist                         (const char        *user,
 {
         g_return_val_if_fail(user && password && track, FALSE);
         gboolean retval;
-        char *request;
-        const char *method = "addTrackToUserPlaylist";
-        xmlNode *artist, *title;
-        artist = string_param(track->artist);
-        title = string_param(track->title);
-        request = new_request(user, password, method, artist, title, NULL);
-        retval = xmlrpc_send_request(request, method);
+        char *request = add_to_playlist_request(user, password, track);
+        retval = xmlrpc_send_request(request, "addTrackToUserPlaylist");
         g_free(request);
         return retval;
 }
+
+/**
+ * Asynchronous version of add_to_playlist(). Must be called from the
+ * main thread.
+ *
+ * @param user The user's Last.fm ID
+ * @param password The user's password
+ * @param track The track to add to the playlist
+ * @param cb Function to call when the operation is finished
+ * @param userdata Data passed to @cb
+ */
+void
+add_to_playlist_async                   (const char        *user,
+                                         const char        *password,
+                                         const LastfmTrack *track,
+                                         xmlrpc_cb          cb,
+                                         gpointer           userdata)
+{
+        g_return_if_fail(user && password && track);
+        char *request = add_to_playlist_request(user, password, track);
+        xmlrpc_send_request_async(request, "addTrackToUserPlaylist",
+                                  cb, userdata);
+        g_free(request);
+}
@@ -15,6 +15,10 @@
 #include <glib.h>
 #include "playlist.h"
 
+typedef void
+(*xmlrpc_cb)                            (gboolean success,
+                                         gpointer userdata);
+
 gboolean
 tag_track                               (const char           *user,
                                          const char           *password,
@@ -22,6 +26,15 @@ tag_track                               (const char           *user,
                                          LastfmTrackComponent  type,
                                          GSList               *tags);
 
+void
+tag_track_async                         (const char           *user,
+                                         const char           *password,
+                                         const LastfmTrack    *track,
+                                         LastfmTrackComponent  type,
+                                         GSList               *tags,
+                                         xmlrpc_cb             cb,
+                                         gpointer              userdata);
+
 gboolean
 recommend_track                         (const char           *user,
                                          const char           *password,
@@ -30,9 +43,26 @@ recommend_track                         (const char           *user,
                                          LastfmTrackComponent  type,
                                          const char           *rcpt);
 
+void
+recommend_track_async                   (const char           *user,
+                                         const char           *password,
+                                         const LastfmTrack    *track,
+                                         const char           *text,
+                                         LastfmTrackComponent  type,
+                                         const char           *rcpt,
+                                         xmlrpc_cb             cb,
+                                         gpointer              userdata);
+
 gboolean
 add_to_playlist                         (const char        *user,
                                          const char        *password,
                                          const LastfmTrack *track);
 
+void
+add_to_playlist_async                   (const char        *user,
+                                         const char        *password,
+                                         const LastfmTrack *track,
+                                         xmlrpc_cb          cb,
+                                         gpointer           userdata);
+
 #endif